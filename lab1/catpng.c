@@ -5,7 +5,20 @@
  *         convention *_N.png where N is a series of consecutive increasing numbers 
  *         (0, 1, 2, 3, 4, ...), which indicate the position of the image from top to bottom.
  *         The resulting combined PNG should be called all.png.
+ *         With -s the strips are streamed: headers first, then one strip at a time through a small
+ *         inflate window into a single deflate stream, so memory does not grow with the output height.
+ *         With -t N the strips are read and inflated by N threads at once, each straight into its place
+ *         in the combined buffer (the offsets come from the strip heights, read from the headers first).
+ *         With -g ROWSxCOLS the images are tiled on a grid instead (filled row by row, -H puts them all
+ *         side by side). Widths and heights may differ, smaller images are padded. The mosaic is re-filtered
+ *         (-e picks the filter, adaptive by default) and written a scanline at a time.
+ *         With -d DIR the inputs are the *_N.png files of DIR, in order of N, instead of the argument list.
+ *         Whatever the mode, the next few files are prefetched into the page cache while a strip is inflated.
  * EXAMPLE: ./catpng ./img1.png ./png/img2.png
+ *          ./catpng -s -d ./strips
+ *          ./catpng -s ./img1.png ./png/img2.png
+ *          ./catpng -t 4 ./img1.png ./png/img2.png
+ *          ./catpng -g 2x3 -e paeth a.png b.png c.png d.png e.png f.png
  */
 
 #include <stdio.h>
@@ -13,32 +26,439 @@
 #include <errno.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "helpers.c"
 #include "./png_util/crc.c"
 #include "./png_util/zutil.c"
+#include "png_filter.c"
+#include "png_stream.c"
+#include "png_tile.c"
 
+#define OUTPUT_FILE "all.png"
+
+// Concatenates the strips in memory: every input and the whole inflated image are held at once
+int catpng_memory(char **files, int num_files);
+
+// Concatenates the strips in constant memory (see the -s option)
+int catpng_stream(char **files, int num_files);
+
+// Concatenates the strips, loading and inflating them on several threads (see the -t option)
+int catpng_parallel(char **files, int num_files, int num_threads);
+
+// Tiles the images on a rows x cols grid (see the -g and -H options)
+int catpng_grid(char **files, int num_files, int rows, int cols, int mode);
+
+// Finds the *_N.png files of a directory, sorted by N (see the -d option)
+int find_strips(char *dir, char ***files, int *num_files);
+
+/**
+ * A file found by find_strips
+ */
+typedef struct strip_file {
+    unsigned long long n; // The N of *_N.png
+    char *path;
+} strip_file_t;
+
+/**
+ * Shared by the threads of catpng_parallel
+ */
+typedef struct strip_job {
+    char **files; // The strips, top to bottom
+    int num_files;
+    U64 *offsets; // Where each strip goes in catbuf (num_files + 1 entries, the last is the total size)
+    U8 *catbuf; // The combined filtered image
+    int next; // Next strip to take. Atomic.
+    int failed; // Set to 1 if any strip failed. Atomic.
+} strip_job_t;
 
 int main(int argc, char *argv[]) {
 
-    if(argc < 2) {
+	int stream = 0;
+	int num_threads = 0;
+	int rows = 0;
+	int cols = 0;
+	int horizontal = 0;
+	int mode = PNG_FILTER_ADAPTIVE;
+	char *dir = NULL;
+
+	int c;
+	while ((c = getopt (argc, argv, "st:g:He:d:")) != -1) {
+		switch (c) {
+		case 's':
+			stream = 1;
+			break;
+		case 't':
+			num_threads = strtoul(optarg, NULL, 10);
+			if (num_threads < 1) {
+				printf("number of threads must be 1 or more -- 't'\n");
+				return -1;
+			}
+			break;
+		case 'g':
+			if (sscanf(optarg, "%dx%d", &rows, &cols) != 2 || rows < 1 || cols < 1) {
+				printf("grid must be ROWSxCOLS, e.g. 2x3 -- 'g'\n");
+				return -1;
+			}
+			break;
+		case 'H':
+			horizontal = 1;
+			break;
+		case 'e':
+			mode = -1;
+			for (int m = 0; m <= PNG_FILTER_ADAPTIVE; m++) {
+				if (strcmp(optarg, png_filter_names[m]) == 0) mode = m;
+			}
+			if (mode < 0) {
+				printf("filter must be none, sub, up, average, paeth or adaptive -- 'e'\n");
+				return -1;
+			}
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		default:
+			printf("Usage example: ./catpng [-s | -t 4 | -g 2x3 | -H] ./img1.png ./png/img2.png\n");
+			return -1;
+		}
+	}
+	if (stream + (num_threads > 0) + (rows > 0) + horizontal > 1) {
+		printf("only one of -s, -t, -g and -H can be used\n");
+		return -1;
+	}
+
+    if((dir == NULL && optind >= argc) || (dir != NULL && optind < argc)) {
         printf("Usage example: ./catpng ./img1.png ./png/img2.png\n");
+        printf("               ./catpng -d ./strips\n");
         return -1;
     }
 
+	// **Inputs: the Argument List, or the Strips Found in the Directory**
+	char **files = argv + optind;
+	int num_files = argc - optind;
+	if (dir != NULL && find_strips(dir, &files, &num_files) != 0) return -1;
+
+	int ret;
+	if (stream) ret = catpng_stream(files, num_files);
+	else if (num_threads > 0) ret = catpng_parallel(files, num_files, num_threads);
+	else if (horizontal) ret = catpng_grid(files, num_files, 1, num_files, mode);
+	else if (rows > 0) ret = catpng_grid(files, num_files, rows, cols, mode);
+	else ret = catpng_memory(files, num_files);
+
+	if (dir != NULL) {
+		for (int i=0; i<num_files; i++){
+			free(files[i]);
+		}
+		free(files);
+	}
+	return ret;
+}
+
+// Orders strip_file_t by N, then by path so the order is the same on every run
+int compare_strips(const void *a, const void *b) {
+	const strip_file_t *x = (const strip_file_t *) a;
+	const strip_file_t *y = (const strip_file_t *) b;
+	if (x->n != y->n) return (x->n < y->n) ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+// Returns 1 if name looks like *_N.png (N one or more digits) and sets n, 0 if not
+int parse_strip_name(const char *name, unsigned long long *n) {
+	size_t len = strlen(name);
+	if (len < 6 || strcmp(name + len - 4, ".png") != 0) return 0;
+	size_t end = len - 4;
+	size_t start = end;
+	while (start > 0 && name[start - 1] >= '0' && name[start - 1] <= '9') start--;
+	if (start == end || start == 0 || name[start - 1] != '_') return 0;
+	*n = strtoull(name + start, NULL, 10);
+	return 1;
+}
+
+// Finds the *_N.png files of a directory (not its subdirectories), sorted by N
+// files: set to a malloced array of malloced paths, freeing them is up to the caller
+// Return values:
+// -1: Error (message printed), including no strips or two with the same N
+// 0: Success
+int find_strips(char *dir, char ***files, int *num_files) {
+	DIR *this_dir = opendir(dir);
+	if (this_dir == NULL) {
+		printf("%s: could not open directory\n", dir);
+		return -1;
+	}
+
+	strip_file_t *strips = NULL;
+	int count = 0;
+	int capacity = 0;
+	int ret = 0;
+	struct dirent *dir_entry;
+	size_t dir_len = strlen(dir);
+
+	while ((dir_entry = readdir(this_dir)) != NULL) {
+		unsigned long long n;
+		if (dir_entry->d_name[0] == '.' || !parse_strip_name(dir_entry->d_name, &n)) continue;
+		if (dir_entry->d_type != DT_REG && dir_entry->d_type != DT_UNKNOWN && dir_entry->d_type != DT_LNK) continue;
+
+		if (count == capacity) {
+			capacity = (capacity > 0) ? 2 * capacity : 64;
+			strip_file_t *grown = (strip_file_t *) realloc(strips, capacity * sizeof(strip_file_t));
+			if (grown == NULL) {
+				perror("realloc");
+				ret = -1;
+				break;
+			}
+			strips = grown;
+		}
+		char *path = malloc(dir_len + strlen(dir_entry->d_name) + 2);
+		if (path == NULL) {
+			perror("malloc");
+			ret = -1;
+			break;
+		}
+		strcpy(path, dir);
+		if (dir_len == 0 || dir[dir_len - 1] != '/') strcat(path, "/");
+		strcat(path, dir_entry->d_name);
+		strips[count].n = n;
+		strips[count].path = path;
+		count++;
+	}
+	closedir(this_dir);
+
+	if (ret == 0 && count == 0) {
+		printf("%s: no *_N.png files found\n", dir);
+		ret = -1;
+	}
+	if (ret == 0) {
+		qsort(strips, count, sizeof(strip_file_t), compare_strips);
+		for (int i=1; i<count; i++){
+			if (strips[i].n == strips[i - 1].n) {
+				printf("%s and %s have the same number\n", strips[i - 1].path, strips[i].path);
+				ret = -1;
+				break;
+			}
+		}
+	}
+	if (ret == 0) {
+		*files = (char **) malloc(count * sizeof(char *));
+		if (*files == NULL) {
+			perror("malloc");
+			ret = -1;
+		}
+	}
+
+	for (int i=0; i<count; i++){
+		if (ret == 0) (*files)[i] = strips[i].path;
+		else free(strips[i].path);
+	}
+	free(strips);
+	if (ret == 0) *num_files = count;
+	return ret;
+}
+
+// Reads only the headers of the strips: checks they can be stacked and fills out with the header of the combined image
+// heights: if not NULL, filled with the height of each strip
+// Return values:
+// -1: Error (message printed)
+// 0: Success
+int get_strip_headers(char **files, int num_files, data_IHDR_p out, U32 *heights) {
+	struct data_IHDR ihdr;
+	U64 height = 0;
+
+	for (int i=0; i<num_files; i++){
+		if (get_png_header(files[i], &ihdr) != 0) {
+			printf("%s: failed to get png\n", files[i]);
+			return -1;
+		}
+		if (i == 0) {
+			*out = ihdr;
+		} else if (ihdr.width != out->width || ihdr.bit_depth != out->bit_depth || ihdr.color_type != out->color_type) {
+			printf("%s: width or pixel format differs from %s\n", files[i], files[0]);
+			return -1;
+		}
+		if (ihdr.interlace != 0) {
+			printf("%s: interlaced images cannot be concatenated\n", files[i]);
+			return -1;
+		}
+		if (heights != NULL) heights[i] = ihdr.height;
+		height += ihdr.height;
+	}
+	if (height > PNG_MAX_CHUNK_LEN) {
+		printf("StdError: combined height %lu is too large for a PNG\n", height);
+		return -1;
+	}
+	out->height = (U32) height;
+	return 0;
+}
+
+// Thread function of catpng_parallel: takes strips until there are none left and inflates each into its place in catbuf
+void *strip_worker(void *arg) {
+	strip_job_t *job = (strip_job_t *) arg;
+	png_reader_t *reader = (png_reader_t *) malloc(sizeof(png_reader_t));
+	if (reader == NULL) {
+		__atomic_store_n(&(job->failed), 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	while (!__atomic_load_n(&(job->failed), __ATOMIC_RELAXED)) {
+		int i = __atomic_fetch_add(&(job->next), 1, __ATOMIC_RELAXED);
+		if (i >= job->num_files) break;
+		png_prefetch_ahead(job->files, job->num_files, i);
+
+		// The reader never writes past the strip's own slice, even for a corrupt strip
+		U64 size = job->offsets[i + 1] - job->offsets[i];
+		if (png_reader_open(reader, job->files[i]) != 0) {
+			printf("%s: failed to get png\n", job->files[i]);
+			__atomic_store_n(&(job->failed), 1, __ATOMIC_RELAXED);
+			break;
+		}
+		if (png_reader_read(reader, job->catbuf + job->offsets[i], size) != (long) size) {
+			printf("%s: failed to inflate\n", job->files[i]);
+			__atomic_store_n(&(job->failed), 1, __ATOMIC_RELAXED);
+		}
+		png_reader_close(reader);
+	}
+
+	free(reader);
+	return NULL;
+}
+
+int catpng_parallel(char **files, int num_files, int num_threads) {
+
+	// **Headers Only: Strip Heights give every Strip's Offset (Prefix Sum)**
+	struct data_IHDR ihdr;
+	U32 *heights = (U32 *) malloc(num_files * sizeof(U32));
+	U64 *offsets = (U64 *) malloc((num_files + 1) * sizeof(U64));
+	if (heights == NULL || offsets == NULL || get_strip_headers(files, num_files, &ihdr, heights) != 0) {
+		free(heights);
+		free(offsets);
+		return -1;
+	}
+	U64 row_bytes = png_row_bytes(&ihdr);
+	offsets[0] = 0;
+	for (int i=0; i<num_files; i++){
+		offsets[i + 1] = offsets[i] + heights[i] * (row_bytes + 1);
+	}
+	free(heights);
+
+	// **Load and Inflate the Strips Concurrently, each into its own Slice of catbuf**
+	strip_job_t job;
+	job.files = files;
+	job.num_files = num_files;
+	job.offsets = offsets;
+	job.catbuf = (U8 *) malloc(offsets[num_files] > 0 ? offsets[num_files] : 1);
+	job.next = 0;
+	job.failed = (job.catbuf == NULL);
+
+	if (num_threads > num_files) num_threads = num_files;
+	pthread_t threads[num_threads];
+	int started = 0;
+	for (; started<num_threads && !job.failed; started++){
+		if (pthread_create(threads + started, NULL, strip_worker, &job) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+	if (started == 0) strip_worker(&job); // No thread could be created: do it here
+	for (int i=0; i<started; i++){
+		pthread_join(threads[i], NULL);
+	}
+
+	// **Deflate and Write**
+	int ret = job.failed ? -1 : 0;
+	if (ret == 0) {
+		png_writer_t *writer = (png_writer_t *) malloc(sizeof(png_writer_t));
+		if (writer == NULL || png_writer_open(writer, OUTPUT_FILE, &ihdr, Z_DEFAULT_COMPRESSION) != 0 || png_writer_write(writer, job.catbuf, offsets[num_files]) != 0 || png_writer_close(writer) != 0) {
+			printf("StdError: could not write %s\n", OUTPUT_FILE);
+			ret = -1;
+		}
+		free(writer);
+	}
+
+	free(job.catbuf);
+	free(offsets);
+	return ret;
+}
+
+int catpng_grid(char **files, int num_files, int rows, int cols, int mode) {
+	png_layout_t layout;
+	if (png_layout_init(&layout, files, num_files, rows, cols) != 0) return -1;
+
+	int ret = png_layout_write(&layout, OUTPUT_FILE, mode, Z_DEFAULT_COMPRESSION);
+	png_layout_free(&layout);
+	return ret;
+}
+
+int catpng_stream(char **files, int num_files) {
+
+	// **Headers Only: the Output Height goes in the IHDR, Before any Data**
+	struct data_IHDR first;
+	if (get_strip_headers(files, num_files, &first, NULL) != 0) return -1;
+	U64 row_bytes = png_row_bytes(&first);
+
+	// **One Strip at a Time: Inflate a Window, Deflate it Straight into the Output**
+	png_reader_t *reader = (png_reader_t *) malloc(sizeof(png_reader_t));
+	png_writer_t *writer = (png_writer_t *) malloc(sizeof(png_writer_t));
+	U8 *window = (U8 *) malloc(PNG_STREAM_WINDOW);
+	int ret = 0;
+
+	if (reader == NULL || writer == NULL || window == NULL || png_writer_open(writer, OUTPUT_FILE, &first, Z_DEFAULT_COMPRESSION) != 0) {
+		printf("StdError: could not create %s\n", OUTPUT_FILE);
+		free(reader);
+		free(writer);
+		free(window);
+		return -1;
+	}
+
+	for (int i=0; i<num_files && ret == 0; i++){
+		png_prefetch_ahead(files, num_files, i);
+		if (png_reader_open(reader, files[i]) != 0) {
+			printf("%s: failed to get png\n", files[i]);
+			ret = -1;
+			break;
+		}
+		U64 left = reader->ihdr.height * (row_bytes + 1); // Filtered bytes in this strip
+		while (left > 0 && ret == 0) {
+			long got = png_reader_read(reader, window, left < PNG_STREAM_WINDOW ? left : PNG_STREAM_WINDOW);
+			if (got <= 0) {
+				printf("%s: failed to inflate\n", files[i]);
+				ret = -1;
+			} else if (png_writer_write(writer, window, got) != 0) {
+				printf("StdError: could not write %s\n", OUTPUT_FILE);
+				ret = -1;
+			}
+			left -= (got > 0) ? got : 0;
+		}
+		png_reader_close(reader);
+	}
+
+	if (png_writer_close(writer) != 0 && ret == 0) {
+		printf("StdError: could not write %s\n", OUTPUT_FILE);
+		ret = -1;
+	}
+	free(reader);
+	free(writer);
+	free(window);
+	return ret;
+}
+
+int catpng_memory(char **files, int num_files) {
+
+	if (num_files < 1) return -1;
+
 	// **Fill Initial Array of PNG Structs**
-	simple_PNG_p imgs[argc-1];
+	simple_PNG_p imgs[num_files];
 
    	int get_png_status = 1;
 
-   	for (int i=0; i<(argc-1); i++){
+   	for (int i=0; i<num_files; i++){
 		// Allocate memory for PNG struct, fill it with the data
+		png_prefetch_ahead(files, num_files, i);
 		imgs[i] = (simple_PNG_p) malloc(sizeof(struct simple_PNG));
-   		get_png_status = get_png(argv[i+1], imgs[i]);
+   		get_png_status = get_png(files[i], imgs[i]);
 
 		
    		if (get_png_status != 0) {
 			// PNG struct creation failed
-			printf("%s: failed to get png\n", argv[i+1]);
+			printf("%s: failed to get png\n", files[i]);
 
 			for(int j=0;j<i;j++){
 				free_png(imgs[j]);
@@ -52,18 +472,18 @@ int main(int argc, char *argv[]) {
 	// **Fill Initial Array of Header Data**
 
    	U32 height = 0;
-   	data_IHDR_p calcs[argc-1];
+   	data_IHDR_p calcs[num_files];
 
-   	for (int i=0; i<(argc-1); i++){  //loop get IHDR data for dimensions
+   	for (int i=0; i<num_files; i++){  //loop get IHDR data for dimensions
 	   	calcs[i] = (data_IHDR_p)malloc(sizeof(struct data_IHDR));
    		int get_data_IHDR_status = get_data_IHDR((char*) imgs[i]->p_IHDR->p_data, calcs[i]);
 
 		if (get_data_IHDR_status != 0) {
-			printf("%s: failed to get IHDR data\n", argv[i+1]);
+			printf("%s: failed to get IHDR data\n", files[i]);
 			for(int j=0;j<=i;j++){
 				free(calcs[j]);
 			}
-			for(int j=0;j<=(argc-1);j++){
+			for(int j=0;j<num_files;j++){
 				free_png(imgs[j]);
 			}
 	    	return get_png_status;
@@ -82,14 +502,14 @@ int main(int argc, char *argv[]) {
     U64 len_tot = 0;      //running tally of total length
     int ret = 0;        //debug param
 
-   	for (int i=0; i<(argc-1); i++){ //loop inflate data
+   	for (int i=0; i<num_files; i++){ //loop inflate data
    		len_def = imgs[i]->p_IDAT->length;
    		len_inf = 0;
    		ret = mem_inf(catbuf+len_tot, &len_inf, imgs[i]->p_IDAT->p_data, len_def); //automatically concatenate inflated data to buffer
 	    
 		if (ret !=0){
 	        printf("StdError: mem_def failed. ret = %d.\n", ret);
-			for(int j=0;j<=(argc-1);j++){
+			for(int j=0;j<num_files;j++){
 				free_png(imgs[j]);
 				free(calcs[j]);
 			}
@@ -108,7 +528,7 @@ int main(int argc, char *argv[]) {
     ret = mem_def(newdata, &len_def, catbuf, size, Z_DEFAULT_COMPRESSION);
     if (ret !=0){
         printf("StdError: mem_def failed. ret = %d.\n", ret);
-		for(int j=0;j<=(argc-1);j++){
+		for(int j=0;j<num_files;j++){
 			free_png(imgs[j]);
 			free(calcs[j]);
 		}
@@ -142,9 +562,9 @@ int main(int argc, char *argv[]) {
 
 	newpng->p_IEND = imgs[0]->p_IEND; // Re-use same END data structure
 
-   	write_png_file("all.png", newpng);
+   	write_png_file(OUTPUT_FILE, newpng);
 
-	for (int i=0; i<(argc-1); i++){  //loop to free memory
+	for (int i=0; i<num_files; i++){  //loop to free memory
    		free_png(imgs[i]);
 		free(calcs[i]);
    	}
@@ -7,6 +7,9 @@
 #include <errno.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include "./png_util/lab_png.h"
 #include "./png_util/crc.c"
@@ -22,8 +25,8 @@ unsigned long crccheck (struct chunk* data){
 	// Declare crc buffer
 	char * restrict chunk_crc_data = (char *)malloc(len);
 
-	// Copy type field into buffer
-	strcpy(chunk_crc_data, (char *)data->type);
+	// Copy type field into buffer (not NUL terminated, so no strcpy)
+	memcpy(chunk_crc_data, data->type, CHUNK_TYPE_SIZE);
 	// Copy data field into buffer
 	for(int i=0;i<data->length;i++){
 		*(chunk_crc_data + 4 + i) = (char) *(data->p_data + i);
@@ -31,6 +34,7 @@ unsigned long crccheck (struct chunk* data){
 
 	// Run crc comparison
 	unsigned long testcrc = crc((unsigned char *)chunk_crc_data, len);
+	free(chunk_crc_data);
 
 	// Test if crc is the same or not
 	if (testcrc != data->crc){
@@ -245,6 +249,35 @@ int get_chunk(chunk_p out, char* file_path, long *offset){
     return 0; //returns current file position on a success
 }
 
+// Reads only the signature and the IHDR chunk of a png file (nothing past byte 33), for when the dimensions are all that is needed
+// Fills out with the IHDR data
+// Return values:
+// -1: Error in reading file
+// 0: got header
+// 1: Not a png (bad signature, or the first chunk is not a 13 byte IHDR)
+int get_png_header(char* file_path, data_IHDR_p out) {
+    U8 buffer[PNG_SIG_SIZE + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + DATA_IHDR_SIZE];
+
+    FILE *fp = fopen(file_path, "rb");
+    if(!fp) return -1;
+
+    size_t read = fread(buffer, 1, sizeof(buffer), fp);
+    int read_error = ferror(fp);
+    fclose(fp);
+
+    if(read_error) return -1;
+    if(read < PNG_SIG_SIZE) return 1;
+    for(int i=0;i<PNG_SIG_SIZE;i++){
+        if((char) buffer[i] != png_header[i]) return 1;
+    }
+    if(read != sizeof(buffer)) return 1;
+
+    U32 len = ntohl(*((U32 *)(buffer + PNG_SIG_SIZE)));
+    if(len != DATA_IHDR_SIZE || memcmp(buffer + PNG_SIG_SIZE + CHUNK_LEN_SIZE, "IHDR", CHUNK_TYPE_SIZE) != 0) return 1;
+
+    return get_data_IHDR((char *)(buffer + PNG_SIG_SIZE + CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE), out);
+}
+
 // Takes a complete png file and returns all the data decoded into a simple_PNG data structure
 // Return values:
 // -1: Error in reading file
@@ -313,63 +346,78 @@ int get_png(char* file_path, struct simple_PNG* png) {
 }
 
 
-int write_png_file (char* file_path, struct simple_PNG* newpng){
-    FILE *fpw;
-	fpw = fopen (file_path, "wb+");
+// CRC of a chunk's type and data, computed in place (crccheck copies them into a buffer first)
+U32 chunk_crc(struct chunk* data){
+    unsigned long c = update_crc(0xffffffffL, data->type, CHUNK_TYPE_SIZE);
+    if(data->length > 0) c = update_crc(c, data->p_data, data->length);
+    return (U32)(c ^ 0xffffffffL);
+}
 
-    if(!fpw){
-        // File doesn't exist
-        fclose(fpw);
-        return -1;
+// Writes every buffer of iov to fd, calling writev again after a short write
+// Return values:
+// -1: Error
+// 0: Success
+int writev_all(int fd, struct iovec *iov, int iovcnt){
+    while(iovcnt > 0){
+        ssize_t written = writev(fd, iov, iovcnt);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        // Skip what was written, which may end part way through a buffer
+        while(iovcnt > 0 && (size_t) written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
     }
+    return 0;
+}
 
-	//write png header
-	for (int i=0; i<8; i++){
-		fwrite(&png_header[i], 1, 1, fpw);  //this works for sure
-	}
-
-    unsigned int len = 0;
-    unsigned long crc = 0;
-
-	//write IHDR
-    len = htonl(newpng->p_IHDR->length);
-    crc = crccheck(newpng->p_IHDR);
-    if(crc == 0){
-        crc = newpng->p_IHDR->crc;
-    }
-    crc = htonl(crc);
-	fwrite(&(len), CHUNK_LEN_SIZE, 1, fpw);
-	fwrite(&(newpng->p_IHDR->type[0]), CHUNK_TYPE_SIZE, 1, fpw);
-	fwrite(newpng->p_IHDR->p_data, newpng->p_IHDR->length, 1, fpw);
-	fwrite(&(crc), CHUNK_CRC_SIZE, 1, fpw);
-
-	//write IDAT
-    len = htonl(newpng->p_IDAT->length);
-    crc = crccheck(newpng->p_IDAT);
-    if(crc == 0){
-        crc = newpng->p_IDAT->crc;
+// Writes a simple_PNG to a file, with the right CRC for every chunk whatever their crc fields say
+// The signature, each chunk's fields and the chunk data already in memory go out with one writev, nothing is copied
+// Return values:
+// -1: Error
+// 0: Success
+int write_png_file (char* file_path, struct simple_PNG* newpng){
+    static const U8 signature[PNG_SIG_SIZE] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    chunk_p chunks[3] = {newpng->p_IHDR, newpng->p_IDAT, newpng->p_IEND};
+    U32 lengths[3]; // Big endian
+    U32 crcs[3]; // Big endian
+    struct iovec iov[1 + 4 * 3];
+    int n = 0;
+
+    iov[n].iov_base = (void *) signature;
+    iov[n++].iov_len = PNG_SIG_SIZE;
+
+    // Length, type, data and CRC of each chunk
+    for (int i=0; i<3; i++){
+        lengths[i] = htonl(chunks[i]->length);
+        crcs[i] = htonl(chunk_crc(chunks[i]));
+        iov[n].iov_base = &lengths[i];
+        iov[n++].iov_len = CHUNK_LEN_SIZE;
+        iov[n].iov_base = chunks[i]->type;
+        iov[n++].iov_len = CHUNK_TYPE_SIZE;
+        iov[n].iov_base = chunks[i]->p_data;
+        iov[n++].iov_len = chunks[i]->length;
+        iov[n].iov_base = &crcs[i];
+        iov[n++].iov_len = CHUNK_CRC_SIZE;
     }
-    crc = htonl(crc);
-	fwrite(&(len), CHUNK_LEN_SIZE, 1, fpw);
-	fwrite(&(newpng->p_IDAT->type[0]), CHUNK_TYPE_SIZE, 1, fpw);
-	fwrite(newpng->p_IDAT->p_data, newpng->p_IDAT->length, 1, fpw);
-	fwrite(&(crc), CHUNK_CRC_SIZE, 1, fpw);
-
-	//write IEND
-    len = htonl(newpng->p_IEND->length);
-    crc = crccheck(newpng->p_IEND);
-    if(crc == 0){
-        crc = newpng->p_IEND->crc;
+
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0){
+        // Could not create the file
+        return -1;
     }
-    crc = htonl(crc);
-	fwrite(&(len), CHUNK_LEN_SIZE, 1, fpw);
-	fwrite(&(newpng->p_IEND->type[0]), CHUNK_TYPE_SIZE, 1, fpw);
-	fwrite(newpng->p_IEND->p_data, newpng->p_IEND->length, 1, fpw);
-	fwrite(&(crc), CHUNK_CRC_SIZE, 1, fpw);
-	
-	fclose(fpw);
 
-    return 0;
+    int result = writev_all(fd, iov, n);
+    if(close(fd) != 0) result = -1;
+
+    return result;
 }
 
 int free_png(struct simple_PNG* png_file) {
@@ -0,0 +1,174 @@
+/**
+ * @brief: Checks a PNG file without loading it. Reads the signature and IHDR for the dimensions and, when asked,
+ *         walks every chunk up to IEND verifying its CRC through a fixed buffer, so no chunk data is ever held
+ *         in memory whatever the size of the IDAT.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "helpers.c"
+
+#pragma once
+
+#define PNG_CHECK_BUF_SZ 65536 // Bytes of chunk data read at a time when verifying CRCs
+
+// Results of png_check_file
+#define PNG_CHECK_READ_ERROR -1 // Could not open or read the file
+#define PNG_CHECK_OK 0
+#define PNG_CHECK_NOT_PNG 1 // Bad signature, or the first chunk is not a 13 byte IHDR
+#define PNG_CHECK_CRC_ERROR 2 // A chunk's CRC does not match its type and data
+#define PNG_CHECK_TRUNCATED 3 // The file ends before the IEND chunk
+
+/**
+ * What png_check_file found out about one file
+ */
+typedef struct png_check {
+    int status; // One of the PNG_CHECK_ results
+    struct data_IHDR ihdr; // Valid unless status is PNG_CHECK_READ_ERROR or PNG_CHECK_NOT_PNG
+    int crc_checked; // 1 if every chunk's CRC was verified (or the first bad one found)
+    U8 bad_type[CHUNK_TYPE_SIZE]; // Type of the chunk with the CRC error
+    U32 computed_crc; // CRC of the bad chunk's type and data
+    U32 expected_crc; // CRC stored in the file for the bad chunk
+} png_check_t;
+
+/**
+ * @brief: Short name of a png_check_file result, for machine-readable output
+ */
+const char *png_check_status_name(int status){
+    switch(status){
+        case PNG_CHECK_OK: return "ok";
+        case PNG_CHECK_NOT_PNG: return "not_png";
+        case PNG_CHECK_CRC_ERROR: return "crc_error";
+        case PNG_CHECK_TRUNCATED: return "truncated";
+        default: return "read_error";
+    }
+}
+
+/**
+ * @brief: Reads the rest of a chunk after its type: the data, fed to the CRC a buffer at a time, then the stored CRC.
+ * @params:
+ * crc_value: running CRC, already updated with the chunk type. Updated in place.
+ * buf: PNG_CHECK_BUF_SZ bytes of scratch space
+ * stored_crc: out, the CRC field of the chunk
+ * @return:
+ * -1: Error reading the file
+ * 0: Success
+ * 1: The file ends inside the chunk
+ */
+int png_check_chunk_body(FILE *fp, U32 len, unsigned long *crc_value, U8 *buf, U32 *stored_crc){
+    while(len > 0){
+        size_t want = (len < PNG_CHECK_BUF_SZ) ? len : PNG_CHECK_BUF_SZ;
+        size_t got = fread(buf, 1, want, fp);
+        if(got > 0) *crc_value = update_crc(*crc_value, buf, (int) got);
+        if(got != want) return ferror(fp) ? -1 : 1;
+        len -= got;
+    }
+
+    U32 crc_field;
+    if(fread(&crc_field, CHUNK_CRC_SIZE, 1, fp) != 1) return ferror(fp) ? -1 : 1;
+    *stored_crc = ntohl(crc_field);
+    return 0;
+}
+
+/**
+ * @brief: Checks one file. Reads only the first 33 bytes unless verify_crc is set.
+ * @params:
+ * file_path: the file to check
+ * verify_crc: 1 to walk every chunk up to IEND and verify its CRC, 0 to stop after the IHDR
+ * out: filled by the function, out->status is also the return value
+ * @return:
+ * PNG_CHECK_READ_ERROR, PNG_CHECK_OK, PNG_CHECK_NOT_PNG, PNG_CHECK_CRC_ERROR or PNG_CHECK_TRUNCATED
+ */
+int png_check_file(char *file_path, int verify_crc, png_check_t *out){
+    memset(out, 0, sizeof(png_check_t));
+
+    if(!verify_crc){
+        int result = get_png_header(file_path, &(out->ihdr));
+        out->status = (result < 0) ? PNG_CHECK_READ_ERROR : (result == 0) ? PNG_CHECK_OK : PNG_CHECK_NOT_PNG;
+        return out->status;
+    }
+
+    // Make sure the CRC table exists, callers on several threads should have called this before starting them
+    if(!crc_table_computed) make_crc_table();
+
+    FILE *fp = fopen(file_path, "rb");
+    if(fp == NULL){
+        out->status = PNG_CHECK_READ_ERROR;
+        return out->status;
+    }
+
+    U8 *buf = (U8 *) malloc(PNG_CHECK_BUF_SZ);
+    if(buf == NULL){
+        perror("malloc");
+        fclose(fp);
+        out->status = PNG_CHECK_READ_ERROR;
+        return out->status;
+    }
+    out->crc_checked = 1;
+    out->status = PNG_CHECK_NOT_PNG;
+
+    // **Signature**
+    U8 sig[PNG_SIG_SIZE];
+    size_t got = fread(sig, 1, PNG_SIG_SIZE, fp);
+    int is_signature = (got == PNG_SIG_SIZE);
+    for(int i = 0; i < PNG_SIG_SIZE && is_signature; i++){
+        if((char) sig[i] != png_header[i]) is_signature = 0;
+    }
+    if(ferror(fp)) out->status = PNG_CHECK_READ_ERROR;
+
+    // **Chunks, up to and including IEND**
+    int first = 1;
+    while(is_signature){
+        U8 head[CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE];
+        got = fread(head, 1, sizeof(head), fp);
+        if(got != sizeof(head)){
+            out->status = ferror(fp) ? PNG_CHECK_READ_ERROR : first ? PNG_CHECK_NOT_PNG : PNG_CHECK_TRUNCATED;
+            break;
+        }
+        U32 len = ntohl(*((U32 *) head));
+        U8 *type = head + CHUNK_LEN_SIZE;
+
+        unsigned long crc_value = update_crc(0xffffffffL, type, CHUNK_TYPE_SIZE);
+
+        // The IHDR must come first, its data is read whole to fill in the header
+        if(first){
+            U8 ihdr_data[DATA_IHDR_SIZE];
+            if(len != DATA_IHDR_SIZE || memcmp(type, "IHDR", CHUNK_TYPE_SIZE) != 0) break;
+            if(fread(ihdr_data, 1, DATA_IHDR_SIZE, fp) != DATA_IHDR_SIZE){
+                out->status = ferror(fp) ? PNG_CHECK_READ_ERROR : PNG_CHECK_NOT_PNG;
+                break;
+            }
+            get_data_IHDR((char *) ihdr_data, &(out->ihdr));
+            crc_value = update_crc(crc_value, ihdr_data, DATA_IHDR_SIZE);
+            out->status = PNG_CHECK_TRUNCATED; // Until IEND is seen
+        }
+
+        U32 stored_crc = 0;
+        int result = png_check_chunk_body(fp, first ? 0 : len, &crc_value, buf, &stored_crc);
+        if(result != 0){
+            out->status = (result < 0) ? PNG_CHECK_READ_ERROR : PNG_CHECK_TRUNCATED;
+            break;
+        }
+        first = 0;
+
+        U32 computed_crc = (U32)(crc_value ^ 0xffffffffL);
+        if(computed_crc != stored_crc){
+            out->status = PNG_CHECK_CRC_ERROR;
+            memcpy(out->bad_type, type, CHUNK_TYPE_SIZE);
+            out->computed_crc = computed_crc;
+            out->expected_crc = stored_crc;
+            break;
+        }
+        if(memcmp(type, "IEND", CHUNK_TYPE_SIZE) == 0){
+            out->status = PNG_CHECK_OK;
+            break;
+        }
+    }
+
+    free(buf);
+    fclose(fp);
+    return out->status;
+}
@@ -0,0 +1,638 @@
+/**
+ * @brief: PNG scanline filters (Sub, Up, Average, Paeth, see the PNG spec section 9).
+ *         Decoding reverses the per-row filters of an inflated IDAT into packed pixels. Every kernel has a scalar reference;
+ *         SSE2 and AVX2 versions are picked at run time for 4 byte pixels (8 bit RGBA, the format of every image in
+ *         the labs). Sub, Average and Paeth depend on the pixel to the left, so they go one pixel (or, for Sub,
+ *         one prefix sum of 4 pixels) at a time; only Up is wide enough for AVX2.
+ *         Encoding filters rows from the original pixels, which has no such dependency, so every filter is vectorized
+ *         for any pixel size. Each row can use one fixed filter or the one with the smallest sum of absolute differences.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./png_util/lab_png.h"
+#include "./png_util/zutil.h" // U64 and zlib
+
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <immintrin.h>
+#define PNG_FILTER_X86 1
+#endif
+
+#pragma once
+
+// Row filter types (first byte of every filtered scanline)
+#define PNG_FILTER_NONE 0
+#define PNG_FILTER_SUB 1
+#define PNG_FILTER_UP 2
+#define PNG_FILTER_AVG 3
+#define PNG_FILTER_PAETH 4
+#define PNG_NUM_FILTERS 5
+#define PNG_FILTER_ADAPTIVE PNG_NUM_FILTERS // Encoder only: best filter per row
+
+// Kernel sets
+#define PNG_SIMD_SCALAR 0
+#define PNG_SIMD_SSE2 1
+#define PNG_SIMD_AVX2 2
+#define PNG_SIMD_AUTO -1
+
+const char *png_filter_names[PNG_NUM_FILTERS + 1] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+const char *png_simd_names[3] = {"scalar", "sse2", "avx2"};
+
+int png_simd_level = PNG_SIMD_AUTO; // Kernel set to use, PNG_SIMD_AUTO picks the best the CPU has
+
+/**
+ * @brief: Best kernel set the CPU supports.
+ */
+int png_simd_detect(){
+#ifdef PNG_FILTER_X86
+    if(__builtin_cpu_supports("avx2")) return PNG_SIMD_AVX2;
+    return PNG_SIMD_SSE2;
+#else
+    return PNG_SIMD_SCALAR;
+#endif
+}
+
+/**
+ * @brief: Kernel set in use (resolves PNG_SIMD_AUTO, and anything the CPU does not have, once).
+ */
+int png_simd_active(){
+    int best = png_simd_detect();
+    if(png_simd_level == PNG_SIMD_AUTO || png_simd_level > best) png_simd_level = best;
+    return png_simd_level;
+}
+
+/**
+ * @brief: Number of channels of a PNG colour type, 0 if the type is invalid.
+ */
+int png_channels(U8 color_type){
+    switch(color_type){
+    case 0: return 1; // Greyscale
+    case 2: return 3; // Truecolour
+    case 3: return 1; // Indexed
+    case 4: return 2; // Greyscale with alpha
+    case 6: return 4; // Truecolour with alpha
+    }
+    return 0;
+}
+
+/**
+ * @brief: Filter unit of an image: bytes per complete pixel, rounded up to 1 for bit depths below 8.
+ */
+int png_bytes_per_pixel(data_IHDR_p ihdr){
+    int bits = png_channels(ihdr->color_type) * ihdr->bit_depth;
+    return (bits < 8) ? 1 : bits / 8;
+}
+
+/**
+ * @brief: Bytes in one unfiltered scanline (without the filter type byte).
+ */
+U64 png_row_bytes(data_IHDR_p ihdr){
+    return ((U64) ihdr->width * png_channels(ihdr->color_type) * ihdr->bit_depth + 7) / 8;
+}
+
+/**
+ * @brief: Paeth predictor: whichever of left (a), up (b) and up-left (c) is closest to a + b - c, ties to a then b.
+ */
+U8 png_paeth_predictor(int a, int b, int c){
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - 2 * c);
+    if(pa <= pb && pa <= pc) return (U8) a;
+    if(pb <= pc) return (U8) b;
+    return (U8) c;
+}
+
+/**
+ * @brief: Scalar reference for every filter type and pixel size.
+ * @params:
+ * out: unfiltered row (n bytes)
+ * in: filtered row, without its type byte (n bytes)
+ * prior: the previous unfiltered row (all zero for the first row)
+ * @return:
+ * -1: Unknown filter type
+ * 0: Success
+ */
+int png_unfilter_row_scalar(int type, U8 *out, const U8 *in, const U8 *prior, U64 n, int bpp){
+    U64 i;
+    switch(type){
+    case PNG_FILTER_NONE:
+        memcpy(out, in, n);
+        break;
+    case PNG_FILTER_SUB:
+        for(i = 0; i < n && i < (U64) bpp; i++) out[i] = in[i];
+        for(; i < n; i++) out[i] = in[i] + out[i - bpp];
+        break;
+    case PNG_FILTER_UP:
+        for(i = 0; i < n; i++) out[i] = in[i] + prior[i];
+        break;
+    case PNG_FILTER_AVG:
+        for(i = 0; i < n && i < (U64) bpp; i++) out[i] = in[i] + (prior[i] >> 1);
+        for(; i < n; i++) out[i] = in[i] + ((out[i - bpp] + prior[i]) >> 1);
+        break;
+    case PNG_FILTER_PAETH:
+        for(i = 0; i < n && i < (U64) bpp; i++) out[i] = in[i] + prior[i]; // Left and up-left are 0
+        for(; i < n; i++) out[i] = in[i] + png_paeth_predictor(out[i - bpp], prior[i], prior[i - bpp]);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef PNG_FILTER_X86
+
+/** SSE2 kernels for 4 byte pixels. n is a multiple of 4. **/
+
+__m128i png_load32(const U8 *p){
+    int v;
+    memcpy(&v, p, sizeof(int));
+    return _mm_cvtsi32_si128(v);
+}
+
+void png_store32(U8 *p, __m128i v){
+    int x = _mm_cvtsi128_si32(v);
+    memcpy(p, &x, sizeof(int));
+}
+
+void png_unfilter_up_sse2(U8 *out, const U8 *in, const U8 *prior, U64 n){
+    U64 i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (prior + i));
+        _mm_storeu_si128((__m128i *) (out + i), _mm_add_epi8(x, b));
+    }
+    for(; i < n; i++) out[i] = in[i] + prior[i];
+}
+
+void png_unfilter_sub4_sse2(U8 *out, const U8 *in, U64 n){
+    __m128i carry = _mm_setzero_si128(); // Last output pixel, in every lane
+    U64 i = 0;
+        // Prefix sum of 4 pixels in two shifted adds, plus the pixel carried from the previous block
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi8(x, carry);
+        _mm_storeu_si128((__m128i *) (out + i), x);
+        carry = _mm_shuffle_epi32(x, 0xFF);
+    }
+    for(; i < n; i += 4){
+        carry = _mm_add_epi8(png_load32(in + i), carry);
+        png_store32(out + i, carry);
+    }
+}
+
+void png_unfilter_avg4_sse2(U8 *out, const U8 *in, const U8 *prior, U64 n){
+    __m128i a = _mm_setzero_si128(); // Left pixel
+    __m128i one = _mm_set1_epi8(1);
+    for(U64 i = 0; i < n; i += 4){
+        __m128i b = png_load32(prior + i);
+            // _mm_avg_epu8 rounds up, the filter rounds down: take off the carry of odd sums
+        __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        a = _mm_add_epi8(png_load32(in + i), avg);
+        png_store32(out + i, a);
+    }
+}
+
+__m128i png_abs_epi16(__m128i v){
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+__m128i png_select_epi16(__m128i mask, __m128i t, __m128i e){
+    return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, e));
+}
+
+/**
+ * @brief: Paeth predictor on 8 lanes of 16 bit values (0 to 255).
+ */
+__m128i png_paeth_epi16(__m128i a, __m128i b, __m128i c){
+    __m128i pa = _mm_sub_epi16(b, c); // p - a
+    __m128i pb = _mm_sub_epi16(a, c); // p - b
+    __m128i pc = _mm_add_epi16(pa, pb); // p - c
+    pa = png_abs_epi16(pa);
+    pb = png_abs_epi16(pb);
+    pc = png_abs_epi16(pc);
+    __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    return png_select_epi16(_mm_cmpeq_epi16(smallest, pa), a,
+           png_select_epi16(_mm_cmpeq_epi16(smallest, pb), b, c));
+}
+
+void png_unfilter_paeth4_sse2(U8 *out, const U8 *in, const U8 *prior, U64 n){
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, c = zero; // Left and up-left pixels, one 16 bit lane per channel
+    for(U64 i = 0; i < n; i += 4){
+        __m128i b = _mm_unpacklo_epi8(png_load32(prior + i), zero);
+        __m128i x = _mm_unpacklo_epi8(png_load32(in + i), zero);
+
+        a = _mm_and_si128(_mm_add_epi16(x, png_paeth_epi16(a, b, c)), _mm_set1_epi16(0xFF));
+        c = b;
+        png_store32(out + i, _mm_packus_epi16(a, zero));
+    }
+}
+
+/** AVX2 kernels **/
+
+__attribute__((target("avx2")))
+void png_unfilter_up_avx2(U8 *out, const U8 *in, const U8 *prior, U64 n){
+    U64 i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i x = _mm256_loadu_si256((const __m256i *) (in + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (prior + i));
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_add_epi8(x, b));
+    }
+    png_unfilter_up_sse2(out + i, in + i, prior + i, n - i);
+}
+
+#endif
+
+/**
+ * @brief: Unfilters one row with the kernel set in png_simd_level.
+ * @params: see png_unfilter_row_scalar
+ * @return:
+ * -1: Unknown filter type
+ * 0: Success
+ */
+int png_unfilter_row(int type, U8 *out, const U8 *in, const U8 *prior, U64 n, int bpp){
+#ifdef PNG_FILTER_X86
+    int level = png_simd_active();
+    if(level >= PNG_SIMD_SSE2){
+        switch(type){
+        case PNG_FILTER_UP:
+            if(level == PNG_SIMD_AVX2) png_unfilter_up_avx2(out, in, prior, n);
+            else png_unfilter_up_sse2(out, in, prior, n);
+            return 0;
+        case PNG_FILTER_SUB:
+            if(bpp != 4) break;
+            png_unfilter_sub4_sse2(out, in, n);
+            return 0;
+        case PNG_FILTER_AVG:
+            if(bpp != 4) break;
+            png_unfilter_avg4_sse2(out, in, prior, n);
+            return 0;
+        case PNG_FILTER_PAETH:
+            if(bpp != 4) break;
+            png_unfilter_paeth4_sse2(out, in, prior, n);
+            return 0;
+        }
+    }
+#endif
+    return png_unfilter_row_scalar(type, out, in, prior, n, bpp);
+}
+
+/**
+ * @brief: Unfilters a whole image.
+ * @params:
+ * pixels: output, height * row_bytes bytes (packed rows, no filter bytes)
+ * filtered: inflated IDAT, height * (row_bytes + 1) bytes
+ * @return:
+ * -1: Error (bad filter type)
+ * 0: Success
+ */
+int png_unfilter(U8 *pixels, const U8 *filtered, U32 height, U64 row_bytes, int bpp){
+    U8 *zero_row = (U8 *) calloc(row_bytes > 0 ? row_bytes : 1, 1); // Prior of the first row
+    if(zero_row == NULL){
+        perror("calloc");
+        return -1;
+    }
+
+    const U8 *prior = zero_row;
+    for(U32 y = 0; y < height; y++){
+        const U8 *in = filtered + (U64) y * (row_bytes + 1);
+        U8 *out = pixels + (U64) y * row_bytes;
+        if(png_unfilter_row(in[0], out, in + 1, prior, row_bytes, bpp) != 0){
+            fprintf(stderr, "png_unfilter: row %u has unknown filter type %u\n", y, in[0]);
+            free(zero_row);
+            return -1;
+        }
+        prior = out;
+    }
+
+    free(zero_row);
+    return 0;
+}
+
+/**
+ * @brief: Decodes an image to packed pixels: inflates the IDAT and reverses the row filters.
+ * @params:
+ * pixels: set to a malloced buffer of height * png_row_bytes bytes. Freeing it is up to the caller.
+ * size: set to the size of *pixels
+ * ihdr: the image's IHDR data
+ * idat: the image's IDAT chunk
+ * @return:
+ * -1: Error (unsupported format, corrupt data)
+ * 0: Success
+ */
+int png_decode(U8 **pixels, U64 *size, data_IHDR_p ihdr, struct chunk *idat){
+    *pixels = NULL;
+    *size = 0;
+    if(png_channels(ihdr->color_type) == 0 || ihdr->interlace != 0){
+        fprintf(stderr, "png_decode: only non interlaced images are supported\n");
+        return -1;
+    }
+
+    U64 row_bytes = png_row_bytes(ihdr);
+    U64 filtered_len = (U64) ihdr->height * (row_bytes + 1);
+    U8 *filtered = (U8 *) malloc(filtered_len);
+    U8 *out = (U8 *) malloc(ihdr->height * row_bytes > 0 ? ihdr->height * row_bytes : 1);
+    if(filtered == NULL || out == NULL){
+        perror("malloc");
+        free(filtered);
+        free(out);
+        return -1;
+    }
+
+        // uncompress stops at the end of the buffer (mem_inf would write past it on a corrupt IDAT)
+    uLongf len_inf = filtered_len;
+    int ret = uncompress(filtered, &len_inf, idat->p_data, idat->length);
+    if(ret != Z_OK || len_inf != filtered_len || png_unfilter(out, filtered, ihdr->height, row_bytes, png_bytes_per_pixel(ihdr)) != 0){
+        fprintf(stderr, "png_decode: corrupt image data\n");
+        free(filtered);
+        free(out);
+        return -1;
+    }
+
+    free(filtered);
+    *pixels = out;
+    *size = ihdr->height * row_bytes;
+    return 0;
+}
+
+/**
+ * @brief: Filters one byte: x minus its prediction from left (a), up (b) and up-left (c).
+ */
+U8 png_filter_byte(int type, U8 x, U8 a, U8 b, U8 c){
+    switch(type){
+    case PNG_FILTER_SUB: return x - a;
+    case PNG_FILTER_UP: return x - b;
+    case PNG_FILTER_AVG: return x - ((a + b) >> 1);
+    case PNG_FILTER_PAETH: return x - png_paeth_predictor(a, b, c);
+    }
+    return x;
+}
+
+/**
+ * @brief: Scalar reference of the encoder: filters bytes [start, n) of a row.
+ * @params:
+ * out: filtered row, without its type byte (n bytes)
+ * row: unfiltered row (n bytes)
+ * prior: the previous unfiltered row (all zero for the first row)
+ */
+void png_filter_row_scalar(int type, U8 *out, const U8 *row, const U8 *prior, U64 start, U64 n, int bpp){
+    for(U64 i = start; i < n; i++){
+        U8 a = (i >= (U64) bpp) ? row[i - bpp] : 0;
+        U8 c = (i >= (U64) bpp) ? prior[i - bpp] : 0;
+        out[i] = png_filter_byte(type, row[i], a, prior[i], c);
+    }
+}
+
+/**
+ * @brief: Scalar reference of the cost of a filtered row: sum of its bytes taken as signed (smaller deflates better).
+ */
+U64 png_row_cost_scalar(const U8 *row, U64 n){
+    U64 sum = 0;
+    for(U64 i = 0; i < n; i++) sum += abs((signed char) row[i]);
+    return sum;
+}
+
+#ifdef PNG_FILTER_X86
+
+/** SSE2 encoder kernels, any pixel size: 16 bytes at a time once past the first pixel **/
+
+void png_filter_row_sse2(int type, U8 *out, const U8 *row, const U8 *prior, U64 n, int bpp){
+    U64 i = (n < (U64) bpp) ? n : (U64) bpp;
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+
+    png_filter_row_scalar(type, out, row, prior, 0, i, bpp);
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + i));
+        __m128i a = _mm_loadu_si128((const __m128i *) (row + i - bpp));
+        __m128i b = _mm_loadu_si128((const __m128i *) (prior + i));
+        __m128i c = _mm_loadu_si128((const __m128i *) (prior + i - bpp));
+        __m128i pred;
+        switch(type){
+        case PNG_FILTER_SUB:
+            pred = a;
+            break;
+        case PNG_FILTER_UP:
+            pred = b;
+            break;
+        case PNG_FILTER_AVG:
+            pred = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            break;
+        case PNG_FILTER_PAETH:
+            pred = _mm_packus_epi16(png_paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero)),
+                                    png_paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero)));
+            break;
+        default:
+            pred = zero;
+        }
+        _mm_storeu_si128((__m128i *) (out + i), _mm_sub_epi8(x, pred));
+    }
+    png_filter_row_scalar(type, out, row, prior, i, n, bpp);
+}
+
+U64 png_row_cost_sse2(const U8 *row, U64 n){
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+    U64 i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + i));
+            // |x| as a signed byte is the smaller of x and -x as unsigned bytes, psadbw adds them up
+        __m128i abs = _mm_min_epu8(x, _mm_sub_epi8(zero, x));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(abs, zero));
+    }
+    U64 total = (U64) _mm_cvtsi128_si64(sum) + (U64) _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+    return total + png_row_cost_scalar(row + i, n - i);
+}
+
+/** AVX2 encoder kernels: Paeth (the most work per byte) and the row cost **/
+
+__attribute__((target("avx2")))
+void png_filter_paeth_avx2(U8 *out, const U8 *row, const U8 *prior, U64 n, int bpp){
+    U64 i = (n < (U64) bpp) ? n : (U64) bpp;
+
+    png_filter_row_scalar(PNG_FILTER_PAETH, out, row, prior, 0, i, bpp);
+    for(; i + 16 <= n; i += 16){
+        __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (row + i - bpp)));
+        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (prior + i)));
+        __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (prior + i - bpp)));
+
+        __m256i pa = _mm256_sub_epi16(b, c);
+        __m256i pb = _mm256_sub_epi16(a, c);
+        __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+        pa = _mm256_abs_epi16(pa);
+        pb = _mm256_abs_epi16(pb);
+        __m256i smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+        __m256i nearest = _mm256_blendv_epi8(_mm256_blendv_epi8(c, b, _mm256_cmpeq_epi16(smallest, pb)), a, _mm256_cmpeq_epi16(smallest, pa));
+
+            // Back to 16 bytes: packus works per 128 bit lane, so take the low half of each lane
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(nearest, nearest), 0x08);
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + i));
+        _mm_storeu_si128((__m128i *) (out + i), _mm_sub_epi8(x, _mm256_castsi256_si128(packed)));
+    }
+    png_filter_row_scalar(PNG_FILTER_PAETH, out, row, prior, i, n, bpp);
+}
+
+__attribute__((target("avx2")))
+U64 png_row_cost_avx2(const U8 *row, U64 n){
+    __m256i zero = _mm256_setzero_si256();
+    __m256i sum = zero;
+    U64 i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i x = _mm256_loadu_si256((const __m256i *) (row + i));
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_abs_epi8(x), zero)); // abs(-128) is 0x80, still 128 unsigned
+    }
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    U64 total = (U64) _mm_cvtsi128_si64(half) + (U64) _mm_cvtsi128_si64(_mm_unpackhi_epi64(half, half));
+    return total + png_row_cost_sse2(row + i, n - i);
+}
+
+#endif
+
+/**
+ * @brief: Filters one row with the kernel set in png_simd_level.
+ * @params: see png_filter_row_scalar (the whole row is filtered)
+ */
+void png_filter_row(int type, U8 *out, const U8 *row, const U8 *prior, U64 n, int bpp){
+#ifdef PNG_FILTER_X86
+    int level = png_simd_active();
+    if(level == PNG_SIMD_AVX2 && type == PNG_FILTER_PAETH){
+        png_filter_paeth_avx2(out, row, prior, n, bpp);
+        return;
+    }
+    if(level >= PNG_SIMD_SSE2 && type != PNG_FILTER_NONE){
+        png_filter_row_sse2(type, out, row, prior, n, bpp);
+        return;
+    }
+#endif
+    if(type == PNG_FILTER_NONE) memcpy(out, row, n);
+    else png_filter_row_scalar(type, out, row, prior, 0, n, bpp);
+}
+
+/**
+ * @brief: Cost of a filtered row with the kernel set in png_simd_level (see png_row_cost_scalar).
+ */
+U64 png_row_cost(const U8 *row, U64 n){
+#ifdef PNG_FILTER_X86
+    int level = png_simd_active();
+    if(level == PNG_SIMD_AVX2) return png_row_cost_avx2(row, n);
+    if(level == PNG_SIMD_SSE2) return png_row_cost_sse2(row, n);
+#endif
+    return png_row_cost_scalar(row, n);
+}
+
+/**
+ * @brief: Filters one row, choosing the filter type when mode is PNG_FILTER_ADAPTIVE.
+ * @params:
+ * out: output, row_bytes + 1 bytes (the filter type, then the filtered row)
+ * row: the row's pixels
+ * prior: the row above's pixels (zeros for the first row)
+ * mode: a filter type, or PNG_FILTER_ADAPTIVE to try all five and keep the cheapest
+ * candidate: row_bytes bytes of scratch space, only used by PNG_FILTER_ADAPTIVE
+ * @return: the filter type used
+ */
+int png_filter_select_row(U8 *out, const U8 *row, const U8 *prior, U64 row_bytes, int bpp, int mode, U8 *candidate){
+    int type = mode;
+
+    if(mode == PNG_FILTER_ADAPTIVE){
+        // Minimum sum of absolute differences. The best so far is kept in place in out, the others go through candidate.
+        U64 best_cost = 0;
+        for(int t = 0; t < PNG_NUM_FILTERS; t++){
+            U8 *dest = (t == 0) ? out + 1 : candidate;
+            png_filter_row(t, dest, row, prior, row_bytes, bpp);
+            U64 cost = png_row_cost(dest, row_bytes);
+            if(t == 0 || cost < best_cost){
+                if(t != 0) memcpy(out + 1, candidate, row_bytes);
+                best_cost = cost;
+                type = t;
+            }
+        }
+    }else{
+        png_filter_row(type, out + 1, row, prior, row_bytes, bpp);
+    }
+
+    out[0] = (U8) type;
+    return type;
+}
+
+/**
+ * @brief: Filters a whole image, the inverse of png_unfilter.
+ * @params:
+ * filtered: output, height * (row_bytes + 1) bytes (each row starts with its filter type)
+ * pixels: height * row_bytes bytes of packed rows
+ * mode: a filter type for every row, or PNG_FILTER_ADAPTIVE to try all five on each row and keep the cheapest
+ * counts: if not NULL, counts[type] is incremented for every row filtered with type
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int png_filter_image(U8 *filtered, const U8 *pixels, U32 height, U64 row_bytes, int bpp, int mode, long *counts){
+    if(mode < 0 || mode > PNG_FILTER_ADAPTIVE) return -1;
+
+    U8 *zero_row = (U8 *) calloc(row_bytes > 0 ? row_bytes : 1, 1); // Prior of the first row
+    U8 *candidate = (U8 *) malloc(row_bytes > 0 ? row_bytes : 1);
+    if(zero_row == NULL || candidate == NULL){
+        perror("malloc");
+        free(zero_row);
+        free(candidate);
+        return -1;
+    }
+
+    const U8 *prior = zero_row;
+    for(U32 y = 0; y < height; y++){
+        const U8 *row = pixels + (U64) y * row_bytes;
+        U8 *out = filtered + (U64) y * (row_bytes + 1);
+        int type = png_filter_select_row(out, row, prior, row_bytes, bpp, mode, candidate);
+        if(counts != NULL) counts[type]++;
+        prior = row;
+    }
+
+    free(zero_row);
+    free(candidate);
+    return 0;
+}
+
+/**
+ * @brief: Encodes packed pixels into IDAT data: filters the rows and deflates them.
+ * @params:
+ * idat: set to the malloced IDAT data. Freeing it is up to the caller.
+ * idat_len: set to the length of *idat
+ * pixels: height * png_row_bytes bytes
+ * ihdr: the image's IHDR data
+ * mode: see png_filter_image
+ * level: zlib compression level (Z_DEFAULT_COMPRESSION for the default)
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int png_encode(U8 **idat, U64 *idat_len, const U8 *pixels, data_IHDR_p ihdr, int mode, int level){
+    *idat = NULL;
+    *idat_len = 0;
+    if(png_channels(ihdr->color_type) == 0 || ihdr->interlace != 0) return -1;
+
+    U64 row_bytes = png_row_bytes(ihdr);
+    U64 filtered_len = (U64) ihdr->height * (row_bytes + 1);
+    uLongf def_len = compressBound(filtered_len);
+    U8 *filtered = (U8 *) malloc(filtered_len);
+    U8 *out = (U8 *) malloc(def_len);
+    if(filtered == NULL || out == NULL){
+        perror("malloc");
+        free(filtered);
+        free(out);
+        return -1;
+    }
+
+    if(png_filter_image(filtered, pixels, ihdr->height, row_bytes, png_bytes_per_pixel(ihdr), mode, NULL) != 0 || compress2(out, &def_len, filtered, filtered_len, level) != Z_OK){
+        free(filtered);
+        free(out);
+        return -1;
+    }
+
+    free(filtered);
+    *idat = out;
+    *idat_len = def_len;
+    return 0;
+}
@@ -0,0 +1,305 @@
+/**
+ * @brief: Streaming PNG reader and writer, for images too big to hold in memory.
+ *         The reader walks a file's chunks and inflates its IDAT data on demand through a fixed window.
+ *         The writer deflates whatever it is given into one IDAT chunk, written as it goes: the chunk length
+ *         is back-patched and the CRC is kept running, so memory stays the same whatever the image height.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "helpers.c"
+#include "./png_util/zutil.h" // U64 and zlib
+
+#pragma once
+
+#define PNG_STREAM_WINDOW 16384 // Bytes of compressed input / output held at a time
+#define PNG_MAX_CHUNK_LEN 0x7FFFFFFFu // Largest chunk length the format allows, a bigger IDAT is split
+#define PNG_PREFETCH_AHEAD 8 // Files prefetched ahead of the one being read
+
+const U8 png_signature[PNG_SIG_SIZE] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+/**
+ * Pull side: inflated IDAT bytes of one file, a window at a time.
+ */
+typedef struct png_reader {
+    FILE *fp;
+    z_stream strm;
+    U8 in[PNG_STREAM_WINDOW]; // Compressed bytes read from the file
+    U32 idat_left; // Compressed bytes of the current IDAT chunk still in the file
+    int done; // 1 once the zlib stream has ended
+    struct data_IHDR ihdr; // The file's header
+} png_reader_t;
+
+/**
+ * Push side: deflates into one IDAT chunk written straight to the file.
+ */
+typedef struct png_writer {
+    FILE *fp;
+    z_stream strm;
+    U8 out[PNG_STREAM_WINDOW]; // Deflated bytes waiting to be written
+    long idat_start; // File offset of the current IDAT chunk's length field
+    U32 idat_len; // Bytes written to the current IDAT chunk so far
+    unsigned long crc; // Running CRC of the current IDAT chunk (zlib's crc32 is the PNG CRC)
+} png_writer_t;
+
+/**
+ * @brief: Opens a file for streaming: checks the signature, reads the IHDR and stops at the first IDAT byte.
+ * @params:
+ * reader: pointer to an allocated struct. Will be filled by the function.
+ * @return:
+ * -1: Error (not a PNG, or no IDAT chunk)
+ * 0: Success
+ */
+int png_reader_open(png_reader_t *reader, char *file_path){
+    U8 sig[PNG_SIG_SIZE];
+    U8 ihdr_chunk[DATA_IHDR_SIZE + CHUNK_CRC_SIZE];
+    U32 len;
+    U8 type[CHUNK_TYPE_SIZE];
+
+    memset(reader, 0, sizeof(png_reader_t));
+    reader->fp = fopen(file_path, "rb");
+    if(reader->fp == NULL) return -1;
+
+    if(fread(sig, PNG_SIG_SIZE, 1, reader->fp) != 1 || memcmp(sig, png_signature, PNG_SIG_SIZE) != 0) goto fail;
+    if(fread(&len, CHUNK_LEN_SIZE, 1, reader->fp) != 1 || fread(type, CHUNK_TYPE_SIZE, 1, reader->fp) != 1) goto fail;
+    if(ntohl(len) != DATA_IHDR_SIZE || memcmp(type, "IHDR", CHUNK_TYPE_SIZE) != 0) goto fail;
+    if(fread(ihdr_chunk, sizeof(ihdr_chunk), 1, reader->fp) != 1) goto fail;
+    get_data_IHDR((char *) ihdr_chunk, &(reader->ihdr));
+
+        // Skip to the first IDAT chunk
+    while(1){
+        if(fread(&len, CHUNK_LEN_SIZE, 1, reader->fp) != 1 || fread(type, CHUNK_TYPE_SIZE, 1, reader->fp) != 1) goto fail;
+        if(memcmp(type, "IDAT", CHUNK_TYPE_SIZE) == 0) break;
+        if(memcmp(type, "IEND", CHUNK_TYPE_SIZE) == 0 || fseek(reader->fp, (long) ntohl(len) + CHUNK_CRC_SIZE, SEEK_CUR) != 0) goto fail;
+    }
+    reader->idat_left = ntohl(len);
+
+    if(inflateInit(&(reader->strm)) != Z_OK) goto fail;
+    return 0;
+
+fail:
+    fclose(reader->fp);
+    reader->fp = NULL;
+    return -1;
+}
+
+/**
+ * @brief: Refills the compressed window from the current IDAT chunk, moving on to the next IDAT chunk when it runs out.
+ * @return:
+ * -1: Error (the file ends before the zlib stream does)
+ * 0: Success
+ */
+int png_reader_fill(png_reader_t *reader){
+    while(reader->idat_left == 0){
+        U32 len;
+        U8 type[CHUNK_TYPE_SIZE];
+            // Skip the CRC of the chunk just finished, and any non IDAT chunk
+        if(fseek(reader->fp, CHUNK_CRC_SIZE, SEEK_CUR) != 0) return -1;
+        if(fread(&len, CHUNK_LEN_SIZE, 1, reader->fp) != 1 || fread(type, CHUNK_TYPE_SIZE, 1, reader->fp) != 1) return -1;
+        if(memcmp(type, "IDAT", CHUNK_TYPE_SIZE) == 0){
+            reader->idat_left = ntohl(len);
+        }else if(memcmp(type, "IEND", CHUNK_TYPE_SIZE) == 0 || fseek(reader->fp, (long) ntohl(len), SEEK_CUR) != 0){
+            return -1;
+        }
+    }
+
+    U32 want = (reader->idat_left < PNG_STREAM_WINDOW) ? reader->idat_left : PNG_STREAM_WINDOW;
+    if(fread(reader->in, want, 1, reader->fp) != 1) return -1;
+    reader->idat_left -= want;
+    reader->strm.next_in = reader->in;
+    reader->strm.avail_in = want;
+    return 0;
+}
+
+/**
+ * @brief: Reads the next inflated (still filtered) bytes of the image.
+ * @params:
+ * buf: where to put them
+ * len: how many to read
+ * @return: the number of bytes read, less than len only at the end of the image. -1 on error.
+ */
+long png_reader_read(png_reader_t *reader, U8 *buf, U64 len){
+    reader->strm.next_out = buf;
+    reader->strm.avail_out = len;
+
+    while(reader->strm.avail_out > 0 && !reader->done){
+        if(reader->strm.avail_in == 0 && png_reader_fill(reader) != 0) return -1;
+        int ret = inflate(&(reader->strm), Z_NO_FLUSH);
+        if(ret == Z_STREAM_END){
+            reader->done = 1;
+        }else if(ret != Z_OK && ret != Z_BUF_ERROR){
+            return -1;
+        }
+    }
+    return (long)(len - reader->strm.avail_out);
+}
+
+/**
+ * @brief: Closes the file and frees the inflate state.
+ */
+void png_reader_close(png_reader_t *reader){
+    if(reader->fp == NULL) return;
+    inflateEnd(&(reader->strm));
+    fclose(reader->fp);
+    reader->fp = NULL;
+}
+
+/**
+ * @brief: Asks the kernel to start reading a whole file into the page cache, without waiting for it.
+ *         Called a few files ahead of the one being inflated, so its reads find the data already there.
+ *         Only a hint: errors are ignored.
+ */
+void png_prefetch(const char *file_path){
+    int fd = open(file_path, O_RDONLY);
+    if(fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED); // Starts readahead of the whole file, which outlives the descriptor
+    close(fd);
+}
+
+/**
+ * @brief: Prefetches files[i + PNG_PREFETCH_AHEAD], or every file up to it when i is 0, so the window is
+ *         filled once and then moves one file at a time.
+ * @params:
+ * files: the files in the order they will be read
+ * i: index of the file about to be read
+ */
+void png_prefetch_ahead(char **files, int num_files, int i){
+    int from = (i == 0) ? 1 : i + PNG_PREFETCH_AHEAD;
+    for(int j = from; j <= i + PNG_PREFETCH_AHEAD && j < num_files; j++) png_prefetch(files[j]);
+}
+
+/**
+ * @brief: Writes a whole chunk (length, type, data, CRC).
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int png_write_chunk(FILE *fp, const char *type, U8 *data, U32 len){
+    U32 net_len = htonl(len);
+    unsigned long crc = crc32(0L, (const Bytef *) type, CHUNK_TYPE_SIZE);
+    if(len > 0) crc = crc32(crc, data, len); // crc32 of a NULL buffer is its initial value, not crc
+    U32 net_crc = htonl((U32) crc);
+    if(fwrite(&net_len, CHUNK_LEN_SIZE, 1, fp) != 1 || fwrite(type, CHUNK_TYPE_SIZE, 1, fp) != 1) return -1;
+    if(len > 0 && fwrite(data, len, 1, fp) != 1) return -1;
+    if(fwrite(&net_crc, CHUNK_CRC_SIZE, 1, fp) != 1) return -1;
+    return 0;
+}
+
+/**
+ * @brief: Starts an IDAT chunk whose length is written later, by png_writer_end_idat.
+ */
+int png_writer_begin_idat(png_writer_t *writer){
+    U32 placeholder = 0;
+    writer->idat_start = ftell(writer->fp);
+    writer->idat_len = 0;
+    writer->crc = crc32(0L, (const Bytef *) "IDAT", CHUNK_TYPE_SIZE);
+    if(writer->idat_start < 0 || fwrite(&placeholder, CHUNK_LEN_SIZE, 1, writer->fp) != 1 || fwrite("IDAT", CHUNK_TYPE_SIZE, 1, writer->fp) != 1) return -1;
+    return 0;
+}
+
+/**
+ * @brief: Ends the current IDAT chunk: writes its CRC, then goes back to fill in its length.
+ */
+int png_writer_end_idat(png_writer_t *writer){
+    U32 net_crc = htonl((U32) writer->crc);
+    U32 net_len = htonl(writer->idat_len);
+    if(fwrite(&net_crc, CHUNK_CRC_SIZE, 1, writer->fp) != 1) return -1;
+    long end = ftell(writer->fp);
+    if(fseek(writer->fp, writer->idat_start, SEEK_SET) != 0 || fwrite(&net_len, CHUNK_LEN_SIZE, 1, writer->fp) != 1) return -1;
+    return fseek(writer->fp, end, SEEK_SET);
+}
+
+/**
+ * @brief: Writes the deflated bytes waiting in the window to the IDAT chunk (a new chunk if it would get too long).
+ */
+int png_writer_flush(png_writer_t *writer){
+    U32 have = PNG_STREAM_WINDOW - writer->strm.avail_out;
+    if(have == 0) return 0;
+    if(writer->idat_len > PNG_MAX_CHUNK_LEN - have){
+        if(png_writer_end_idat(writer) != 0 || png_writer_begin_idat(writer) != 0) return -1;
+    }
+    if(fwrite(writer->out, have, 1, writer->fp) != 1) return -1;
+    writer->crc = crc32(writer->crc, writer->out, have);
+    writer->idat_len += have;
+    writer->strm.next_out = writer->out;
+    writer->strm.avail_out = PNG_STREAM_WINDOW;
+    return 0;
+}
+
+/**
+ * @brief: Creates the file and writes everything up to the IDAT data: signature, IHDR and the IDAT chunk header.
+ * @params:
+ * writer: pointer to an allocated struct. Will be filled by the function.
+ * ihdr: header of the output image (height included, so it has to be known up front)
+ * level: zlib compression level
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int png_writer_open(png_writer_t *writer, char *file_path, data_IHDR_p ihdr, int level){
+    struct chunk ihdr_chunk;
+
+    memset(writer, 0, sizeof(png_writer_t));
+    writer->fp = fopen(file_path, "wb+");
+    if(writer->fp == NULL) return -1;
+
+    fill_data_IHDR(ihdr, &ihdr_chunk);
+    int status = fwrite(png_signature, PNG_SIG_SIZE, 1, writer->fp) == 1 ? 0 : -1;
+    if(status == 0) status = png_write_chunk(writer->fp, "IHDR", ihdr_chunk.p_data, ihdr_chunk.length);
+    free(ihdr_chunk.p_data);
+    if(status == 0) status = png_writer_begin_idat(writer);
+    if(status == 0 && deflateInit(&(writer->strm), level) != Z_OK) status = -1;
+    if(status != 0){
+        fclose(writer->fp);
+        writer->fp = NULL;
+        return -1;
+    }
+
+    writer->strm.next_out = writer->out;
+    writer->strm.avail_out = PNG_STREAM_WINDOW;
+    return 0;
+}
+
+/**
+ * @brief: Deflates the next filtered bytes of the image into the file.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int png_writer_write(png_writer_t *writer, U8 *data, U64 len){
+    writer->strm.next_in = data;
+    writer->strm.avail_in = len;
+    while(writer->strm.avail_in > 0){
+        if(deflate(&(writer->strm), Z_NO_FLUSH) == Z_STREAM_ERROR) return -1;
+        if(writer->strm.avail_out == 0 && png_writer_flush(writer) != 0) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief: Finishes the deflate stream, the IDAT chunk and the file (IEND), and closes it.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int png_writer_close(png_writer_t *writer){
+    int ret = Z_OK;
+    int status = 0;
+
+    while(ret != Z_STREAM_END && status == 0){
+        ret = deflate(&(writer->strm), Z_FINISH);
+        if(ret == Z_STREAM_ERROR || png_writer_flush(writer) != 0) status = -1;
+    }
+    deflateEnd(&(writer->strm));
+
+    if(status == 0) status = png_writer_end_idat(writer);
+    if(status == 0) status = png_write_chunk(writer->fp, "IEND", NULL, 0);
+    if(fclose(writer->fp) != 0) status = -1;
+    writer->fp = NULL;
+    return status;
+}
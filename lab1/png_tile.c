@@ -0,0 +1,272 @@
+/**
+ * @brief: Lays PNG images out on a grid (rows x cols, filled row by row) and writes the mosaic as one PNG.
+ *         Each column is as wide as its widest image and each grid row as tall as its tallest, smaller images
+ *         are padded with zero bytes (transparent for images with alpha, black otherwise).
+ *         Nothing is held whole: one grid row of images is open at a time, every scanline of each is inflated
+ *         and unfiltered on its own, copied into its place in the output scanline, which is re-filtered and
+ *         deflated straight into the output file.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "helpers.c"
+#include "./png_util/zutil.h" // U64 and zlib
+#include "png_filter.c"
+#include "png_stream.c"
+
+#pragma once
+
+/**
+ * Where every image goes in the mosaic
+ */
+typedef struct png_layout {
+    char **files; // The images, filled row by row
+    int num_files;
+    int rows;
+    int cols;
+    struct data_IHDR *tiles; // Header of each image
+    U64 *col_offset; // Byte offset of each column in an output scanline (cols + 1 entries, the last is the row size)
+    U32 *row_height; // Height of each grid row
+    struct data_IHDR ihdr; // Header of the mosaic
+    int bpp; // Bytes per pixel
+} png_layout_t;
+
+/**
+ * One image of the grid row being written
+ */
+typedef struct png_tile {
+    png_reader_t reader;
+    int is_open; // 0 for an empty cell
+    U64 row_bytes;
+    U8 *cur; // The scanline just unfiltered
+    U8 *prior; // The one above it (zeros for the first)
+} png_tile_t;
+
+/**
+ * @brief: Frees the arrays of a layout.
+ */
+void png_layout_free(png_layout_t *layout){
+    free(layout->tiles);
+    free(layout->col_offset);
+    free(layout->row_height);
+    layout->tiles = NULL;
+    layout->col_offset = NULL;
+    layout->row_height = NULL;
+}
+
+/**
+ * @brief: Reads the header of every image and works out the size of each grid cell and of the mosaic.
+ * @params:
+ * layout: filled by the function, free it with png_layout_free
+ * files: the images, filled row by row. Cells past the last image are left empty.
+ * rows, cols: grid size, rows * cols must be at least num_files
+ * @return:
+ * -1: Error (message printed)
+ * 0: Success
+ */
+int png_layout_init(png_layout_t *layout, char **files, int num_files, int rows, int cols){
+    memset(layout, 0, sizeof(png_layout_t));
+    if(rows < 1 || cols < 1 || num_files < 1 || (long) rows * cols < num_files){
+        printf("a %d x %d grid cannot hold %d images\n", rows, cols, num_files);
+        return -1;
+    }
+    layout->files = files;
+    layout->num_files = num_files;
+    layout->rows = rows;
+    layout->cols = cols;
+    layout->tiles = (struct data_IHDR *) malloc(num_files * sizeof(struct data_IHDR));
+    layout->col_offset = (U64 *) calloc(cols + 1, sizeof(U64));
+    layout->row_height = (U32 *) calloc(rows, sizeof(U32));
+    U32 *col_width = (U32 *) calloc(cols, sizeof(U32));
+    if(layout->tiles == NULL || layout->col_offset == NULL || layout->row_height == NULL || col_width == NULL){
+        perror("malloc");
+        free(col_width);
+        png_layout_free(layout);
+        return -1;
+    }
+
+    // **Headers Only: Cell Sizes are the Largest Image in each Column and Row**
+    for(int i = 0; i < num_files; i++){
+        data_IHDR_p tile = layout->tiles + i;
+        if(get_png_header(files[i], tile) != 0){
+            printf("%s: failed to get png\n", files[i]);
+            goto fail;
+        }
+        if(i == 0){
+            layout->ihdr = *tile;
+        }else if(tile->bit_depth != layout->ihdr.bit_depth || tile->color_type != layout->ihdr.color_type){
+            printf("%s: pixel format differs from %s\n", files[i], files[0]);
+            goto fail;
+        }
+        if(tile->interlace != 0){
+            printf("%s: interlaced images cannot be tiled\n", files[i]);
+            goto fail;
+        }
+        if(png_channels(tile->color_type) * tile->bit_depth < 8){
+            // Columns would start part way through a byte
+            printf("%s: images with less than 8 bits per pixel cannot be tiled\n", files[i]);
+            goto fail;
+        }
+        if(tile->width > col_width[i % cols]) col_width[i % cols] = tile->width;
+        if(tile->height > layout->row_height[i / cols]) layout->row_height[i / cols] = tile->height;
+    }
+
+    layout->bpp = png_bytes_per_pixel(&(layout->ihdr));
+    U64 width = 0;
+    U64 height = 0;
+    for(int c = 0; c < cols; c++){
+        layout->col_offset[c] = width * layout->bpp;
+        width += col_width[c];
+    }
+    layout->col_offset[cols] = width * layout->bpp;
+    for(int r = 0; r < rows; r++) height += layout->row_height[r];
+    if(width > PNG_MAX_CHUNK_LEN || height > PNG_MAX_CHUNK_LEN){
+        printf("StdError: mosaic of %lu x %lu is too large for a PNG\n", width, height);
+        goto fail;
+    }
+    layout->ihdr.width = (U32) width;
+    layout->ihdr.height = (U32) height;
+
+    free(col_width);
+    return 0;
+
+fail:
+    free(col_width);
+    png_layout_free(layout);
+    return -1;
+}
+
+/**
+ * @brief: Writes the mosaic, one scanline at a time.
+ * @params:
+ * layout: from png_layout_init
+ * file_path: the output PNG
+ * mode: filter of the output rows, a filter type or PNG_FILTER_ADAPTIVE
+ * level: zlib compression level
+ * @return:
+ * -1: Error (message printed)
+ * 0: Success
+ */
+int png_layout_write(png_layout_t *layout, char *file_path, int mode, int level){
+    int cols = layout->cols;
+    int bpp = layout->bpp;
+    U64 row_bytes = layout->col_offset[cols];
+    U64 max_tile_bytes = 0;
+    for(int c = 0; c < cols; c++){
+        U64 col_bytes = layout->col_offset[c + 1] - layout->col_offset[c];
+        if(col_bytes > max_tile_bytes) max_tile_bytes = col_bytes;
+    }
+
+    // Output rows (the one being built and the one above it), its filtered form, and the scanline read from an image
+    U8 *rows_buf = (U8 *) calloc(2 * row_bytes + 1, 1);
+    U8 *filtered = (U8 *) malloc(row_bytes + 1);
+    U8 *candidate = (U8 *) malloc(row_bytes + 1);
+    U8 *in_row = (U8 *) malloc(max_tile_bytes + 1);
+    U8 *tile_rows = (U8 *) malloc(2 * max_tile_bytes * cols + 1); // cur and prior of each open image
+    png_tile_t *tiles = (png_tile_t *) calloc(cols, sizeof(png_tile_t));
+    png_writer_t *writer = (png_writer_t *) malloc(sizeof(png_writer_t));
+    if(rows_buf == NULL || filtered == NULL || candidate == NULL || in_row == NULL || tile_rows == NULL || tiles == NULL || writer == NULL){
+        perror("malloc");
+        free(rows_buf);
+        free(filtered);
+        free(candidate);
+        free(in_row);
+        free(tile_rows);
+        free(tiles);
+        free(writer);
+        return -1;
+    }
+    if(png_writer_open(writer, file_path, &(layout->ihdr), level) != 0){
+        printf("StdError: could not create %s\n", file_path);
+        free(rows_buf);
+        free(filtered);
+        free(candidate);
+        free(in_row);
+        free(tile_rows);
+        free(tiles);
+        free(writer);
+        return -1;
+    }
+
+    U8 *out_row = rows_buf;
+    U8 *out_prior = rows_buf + row_bytes; // Zeros for the first row
+    int ret = 0;
+
+    for(int r = 0; r < layout->rows && ret == 0; r++){
+        // **Open the Images of this Grid Row, Prefetch the Next Row's**
+        for(int i = (r + 1) * cols; i < (r + 2) * cols && i < layout->num_files; i++) png_prefetch(layout->files[i]);
+        int num_open = 0;
+        int padded = 0; // 1 if some cell is not covered by its image, so the row has to be cleared first
+        for(int c = 0; c < cols; c++){
+            int i = r * cols + c;
+            png_tile_t *tile = tiles + c;
+            tile->is_open = 0;
+            if(i >= layout->num_files){
+                padded = 1;
+                continue;
+            }
+            if(png_reader_open(&(tile->reader), layout->files[i]) != 0){
+                printf("%s: failed to get png\n", layout->files[i]);
+                ret = -1;
+                break;
+            }
+            tile->is_open = 1;
+            num_open = c + 1;
+            tile->row_bytes = png_row_bytes(layout->tiles + i);
+            tile->cur = tile_rows + 2 * max_tile_bytes * c;
+            tile->prior = tile->cur + max_tile_bytes;
+            memset(tile->prior, 0, tile->row_bytes);
+            if(tile->row_bytes != layout->col_offset[c + 1] - layout->col_offset[c] || layout->tiles[i].height != layout->row_height[r]) padded = 1;
+        }
+
+        // **Build each Output Scanline from the Images' Scanlines, then Re-filter and Deflate it**
+        for(U32 y = 0; y < layout->row_height[r] && ret == 0; y++){
+            if(padded) memset(out_row, 0, row_bytes);
+            for(int c = 0; c < num_open && ret == 0; c++){
+                png_tile_t *tile = tiles + c;
+                int i = r * cols + c;
+                if(!tile->is_open || y >= layout->tiles[i].height) continue;
+
+                if(png_reader_read(&(tile->reader), in_row, tile->row_bytes + 1) != (long)(tile->row_bytes + 1) ||
+                   png_unfilter_row(in_row[0], tile->cur, in_row + 1, tile->prior, tile->row_bytes, bpp) != 0){
+                    printf("%s: failed to inflate\n", layout->files[i]);
+                    ret = -1;
+                    break;
+                }
+                memcpy(out_row + layout->col_offset[c], tile->cur, tile->row_bytes);
+                U8 *swap = tile->prior;
+                tile->prior = tile->cur;
+                tile->cur = swap;
+            }
+            if(ret != 0) break;
+
+            png_filter_select_row(filtered, out_row, out_prior, row_bytes, bpp, mode, candidate);
+            if(png_writer_write(writer, filtered, row_bytes + 1) != 0){
+                printf("StdError: could not write %s\n", file_path);
+                ret = -1;
+            }
+            U8 *swap = out_prior;
+            out_prior = out_row;
+            out_row = swap;
+        }
+
+        for(int c = 0; c < num_open; c++){
+            if(tiles[c].is_open) png_reader_close(&(tiles[c].reader));
+        }
+    }
+
+    if(png_writer_close(writer) != 0 && ret == 0){
+        printf("StdError: could not write %s\n", file_path);
+        ret = -1;
+    }
+    free(rows_buf);
+    free(filtered);
+    free(candidate);
+    free(in_row);
+    free(tile_rows);
+    free(tiles);
+    free(writer);
+    return ret;
+}
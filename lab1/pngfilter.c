@@ -0,0 +1,263 @@
+/**
+ * @brief: Decodes a PNG to raw pixels (inflate + reverse the row filters) and benchmarks the unfilter kernels.
+ *         With -b, every filter type is run over the image's rows with each kernel set the CPU supports,
+ *         the throughput is printed and the output is checked against the scalar reference.
+ *         With -e, the pixels are re-encoded with a fixed filter (none, sub, up, average, paeth) or the best filter
+ *         per row (adaptive) and written to -w. With -c, every filter mode is compared by size and time.
+ * EXAMPLE: ./pngfilter -b 200 -o WEEF_1.rgba WEEF_1.png
+ *          ./pngfilter -e adaptive -w WEEF_1_adaptive.png WEEF_1.png
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "helpers.c"
+#include "./png_util/crc.c"
+#include "./png_util/zutil.c"
+#include "png_filter.c"
+
+// Returns a monotonic time in seconds
+double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+// Unfilters every row of the image as the given filter type, passes times, with the current kernel set.
+// Returns the seconds taken.
+double time_unfilter(int type, U8 *out, U8 *filtered, U8 *zero_row, U32 height, U64 row_bytes, int bpp, int passes){
+    double start = now_seconds();
+    for(int pass = 0; pass < passes; pass++){
+        const U8 *prior = zero_row;
+        for(U32 y = 0; y < height; y++){
+            png_unfilter_row(type, out + y * row_bytes, filtered + y * (row_bytes + 1) + 1, prior, row_bytes, bpp);
+            prior = out + y * row_bytes;
+        }
+    }
+    return now_seconds() - start;
+}
+
+// Prints the throughput of every filter type with every kernel set, checking each against the scalar reference
+// Return values:
+// -1: Error (or a kernel disagrees with the reference)
+// 0: Success
+int benchmark_filters(U8 *filtered, U32 height, U64 row_bytes, int bpp, int passes){
+    U64 size = height * row_bytes;
+    U8 *ref = (U8 *) malloc(size);
+    U8 *out = (U8 *) malloc(size);
+    U8 *zero_row = (U8 *) calloc(row_bytes, 1);
+    if(ref == NULL || out == NULL || zero_row == NULL){
+        perror("malloc");
+        free(ref);
+        free(out);
+        free(zero_row);
+        return -1;
+    }
+
+    int best = png_simd_detect();
+    int result = 0;
+    printf("%-8s %-7s %12s\n", "filter", "kernels", "MB/s");
+    for(int type = 0; type < PNG_NUM_FILTERS; type++){
+        png_simd_level = PNG_SIMD_SCALAR;
+        time_unfilter(type, ref, filtered, zero_row, height, row_bytes, bpp, 1);
+
+        for(int level = PNG_SIMD_SCALAR; level <= best; level++){
+            png_simd_level = level;
+            memset(out, 0, size);
+            double seconds = time_unfilter(type, out, filtered, zero_row, height, row_bytes, bpp, passes);
+            int same = memcmp(out, ref, size) == 0;
+            if(!same) result = -1;
+            printf("%-8s %-7s %12.1lf%s\n", png_filter_names[type], png_simd_names[level], seconds > 0 ? (double)size * passes / seconds / 1000000.0 : 0.0, same ? "" : "  MISMATCH");
+        }
+    }
+
+    png_simd_level = PNG_SIMD_AUTO;
+    free(ref);
+    free(out);
+    free(zero_row);
+    return result;
+}
+
+// Re-encodes the pixels with every filter mode and prints the IDAT size, the filter time and the deflate time of each
+// Return values:
+// -1: Error
+// 0: Success
+int compare_encoders(U8 *pixels, data_IHDR_p ihdr, U32 original_len){
+    U64 row_bytes = png_row_bytes(ihdr);
+    U64 filtered_len = ihdr->height * (row_bytes + 1);
+    uLongf bound = compressBound(filtered_len);
+    U8 *filtered = (U8 *) malloc(filtered_len);
+    U8 *deflated = (U8 *) malloc(bound);
+    if(filtered == NULL || deflated == NULL){
+        perror("malloc");
+        free(filtered);
+        free(deflated);
+        return -1;
+    }
+
+    printf("%-9s %10s %10s %10s  %s\n", "filter", "IDAT bytes", "filter ms", "deflate ms", "rows none/sub/up/average/paeth");
+    printf("%-9s %10u\n", "original", original_len);
+    for(int mode = 0; mode <= PNG_FILTER_ADAPTIVE; mode++){
+        long counts[PNG_NUM_FILTERS] = {0};
+        double start = now_seconds();
+        png_filter_image(filtered, pixels, ihdr->height, row_bytes, png_bytes_per_pixel(ihdr), mode, counts);
+        double filter_time = now_seconds() - start;
+
+        uLongf def_len = bound;
+        start = now_seconds();
+        int ret = compress2(deflated, &def_len, filtered, filtered_len, Z_DEFAULT_COMPRESSION);
+        double deflate_time = now_seconds() - start;
+        if(ret != Z_OK){
+            printf("%s: deflate failed\n", png_filter_names[mode]);
+            continue;
+        }
+        printf("%-9s %10lu %10.3lf %10.3lf  %ld/%ld/%ld/%ld/%ld\n", png_filter_names[mode], def_len, filter_time * 1000.0, deflate_time * 1000.0, counts[0], counts[1], counts[2], counts[3], counts[4]);
+    }
+
+    free(filtered);
+    free(deflated);
+    return 0;
+}
+
+// Re-encodes the pixels with a filter mode and writes them as a PNG with the source's IHDR and IEND
+// Return values:
+// -1: Error
+// 0: Success
+int write_encoded(char *file_path, simple_PNG_p src, U8 *pixels, data_IHDR_p ihdr, int mode){
+    struct chunk idat;
+    U64 idat_len = 0;
+    if(png_encode(&idat.p_data, &idat_len, pixels, ihdr, mode, Z_DEFAULT_COMPRESSION) != 0) return -1;
+    idat.length = (U32) idat_len;
+    memcpy(idat.type, "IDAT", CHUNK_TYPE_SIZE);
+    idat.crc = 0; // write_png_file fills in the right CRC
+
+    struct simple_PNG out;
+    out.p_IHDR = src->p_IHDR;
+    out.p_IDAT = &idat;
+    out.p_IEND = src->p_IEND;
+    int result = write_png_file(file_path, &out);
+    printf("%s: %lu IDAT bytes (%s filter, was %u)\n", file_path, idat_len, png_filter_names[mode], src->p_IDAT->length);
+
+    free(idat.p_data);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+
+    char *out_file = NULL;
+    char *png_out_file = NULL;
+    int passes = 0;
+    int encode_mode = PNG_FILTER_ADAPTIVE;
+    int compare = 0;
+
+    int c;
+    while ((c = getopt (argc, argv, "s:o:b:e:w:c")) != -1) {
+        switch (c) {
+        case 's':
+            if (strcmp(optarg, "scalar") == 0) png_simd_level = PNG_SIMD_SCALAR;
+            else if (strcmp(optarg, "sse2") == 0) png_simd_level = PNG_SIMD_SSE2;
+            else if (strcmp(optarg, "avx2") == 0) png_simd_level = PNG_SIMD_AVX2;
+            else {
+                printf("kernels must be scalar, sse2 or avx2 -- 's'\n");
+                return -1;
+            }
+            break;
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'b':
+            passes = strtoul(optarg, NULL, 10);
+            if (passes < 1) {
+                printf("number of benchmark passes must be 1 or more -- 'b'\n");
+                return -1;
+            }
+            break;
+        case 'e':
+            encode_mode = -1;
+            for (int mode = 0; mode <= PNG_FILTER_ADAPTIVE; mode++) {
+                if (strcmp(optarg, png_filter_names[mode]) == 0) encode_mode = mode;
+            }
+            if (encode_mode < 0) {
+                printf("filter must be none, sub, up, average, paeth or adaptive -- 'e'\n");
+                return -1;
+            }
+            break;
+        case 'w':
+            png_out_file = optarg;
+            break;
+        case 'c':
+            compare = 1;
+            break;
+        default:
+            printf("Usage example: ./pngfilter -s avx2 -b 200 -o WEEF_1.rgba WEEF_1.png\n");
+            return -1;
+        }
+    }
+    if (optind != argc - 1) {
+        printf("Usage example: ./pngfilter -s avx2 -b 200 -o WEEF_1.rgba WEEF_1.png\n");
+        return -1;
+    }
+    char *file_path = argv[optind];
+
+    // **Read the PNG and its Header**
+    simple_PNG_p png = (simple_PNG_p) malloc(sizeof(struct simple_PNG));
+    if (get_png(file_path, png) != 0) {
+        printf("%s: Not a PNG file\n", file_path);
+        free(png);
+        return -1;
+    }
+    struct data_IHDR ihdr;
+    get_data_IHDR((char *) png->p_IHDR->p_data, &ihdr);
+
+    // **Decode**
+    U8 *pixels = NULL;
+    U64 size = 0;
+    double start = now_seconds();
+    if (png_decode(&pixels, &size, &ihdr, png->p_IDAT) != 0) {
+        printf("%s: failed to decode\n", file_path);
+        free_png(png);
+        return -1;
+    }
+    double seconds = now_seconds() - start;
+    printf("%s: %u x %u, %lu bytes of pixels decoded in %.6lf seconds (%s kernels)\n", file_path, ihdr.width, ihdr.height, size, seconds, png_simd_names[png_simd_active()]);
+
+    int result = 0;
+    if (out_file != NULL) {
+        FILE *fp = fopen(out_file, "wb+");
+        if (fp == NULL || fwrite(pixels, 1, size, fp) != size) {
+            printf("%s: could not write the pixels\n", out_file);
+            result = -1;
+        }
+        if (fp != NULL) fclose(fp);
+    }
+
+    // **Re-encode**
+    if (png_out_file != NULL && result == 0) {
+        if (write_encoded(png_out_file, png, pixels, &ihdr, encode_mode) != 0) {
+            printf("%s: could not encode\n", png_out_file);
+            result = -1;
+        }
+    }
+    if (compare && result == 0) result = compare_encoders(pixels, &ihdr, png->p_IDAT->length);
+
+    // **Benchmark each Filter Type on the Image's Rows**
+    if (passes > 0 && result == 0) {
+        U64 row_bytes = png_row_bytes(&ihdr);
+        U8 *filtered = (U8 *) malloc(ihdr.height * (row_bytes + 1));
+        uLongf len_inf = ihdr.height * (row_bytes + 1);
+        if (filtered == NULL || uncompress(filtered, &len_inf, png->p_IDAT->p_data, png->p_IDAT->length) != Z_OK) {
+            printf("%s: failed to inflate\n", file_path);
+            result = -1;
+        } else {
+            result = benchmark_filters(filtered, ihdr.height, row_bytes, png_bytes_per_pixel(&ihdr), passes);
+        }
+        free(filtered);
+    }
+
+    free(pixels);
+    free_png(png);
+    return result;
+}
@@ -2,105 +2,413 @@
  * @brief: Prints the dimensions of a valid PNG file or prints an error message. 
  *          If the input file is a PNG, but contains CRC errors, use the same 
  *          output as the pngcheck command.
+ *          Batch mode checks many files at once on a pool of threads (-t) and prints one CSV row or JSON
+ *          object per file (-f). The files come from a directory tree (-r), the command line, or stdin
+ *          (one path per line, "-" as the file). Only the signature and IHDR are read unless -c asks for
+ *          every chunk's CRC to be verified, which streams the file and never holds its IDAT in memory.
+ *          Batch output is in no particular order.
  * EXAMPLE: ./pnginfo WEEF_1.png
+ *          ./pnginfo -r ./images -c -t 8 -f json
+ *          find . -name "*.png" | ./pnginfo -f csv -
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include "helpers.c"
+#include "png_check.c"
 #include "./starter/png_util/crc.c"
 
+#define FORMAT_CSV 0
+#define FORMAT_JSON 1 // One object per line (JSON Lines)
 
-// Checks if the file is a png
+#define PATH_QUEUE_SZ 1024 // Paths waiting for a worker, the producer blocks when it is full
+#define LINE_BUF_SZ 32768 // Room for one output line, even with every byte of a long path escaped
+#define OUT_BUF_SZ 65536 // stdout buffer in batch mode
+
+/**
+ * Bounded queue of paths between the thread finding the files and the workers checking them
+ */
+typedef struct path_queue {
+	char *paths[PATH_QUEUE_SZ]; // Ring buffer, owned by the queue until popped
+	int head; // Index of the oldest path
+	int count;
+	int closed; // 1 once no more paths will be pushed
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} path_queue_t;
+
+/**
+ * Shared by the batch worker threads
+ */
+typedef struct batch {
+	path_queue_t queue;
+	int verify_crc; // 1 to verify every chunk's CRC
+	int format; // FORMAT_CSV or FORMAT_JSON
+	pthread_mutex_t out_lock; // Held while a whole line is written to stdout
+} batch_t;
+
+// Checks if the file is a png and prints its dimensions, and the first CRC error if there is one
+// The file is streamed, only the IHDR is kept in memory
 // Return Code:
 // 0: Is a PNG
 // -1: Error
 // 1: Not a PNG
 // 2: CRC Error
-int get_png_info(char* file_path, struct simple_PNG* png_file) {
+int get_png_info(char* file_path) {
 
-	unsigned long crcflag = 0;
-
-	// Decode PNG file into struct
-	int get_png_status = get_png(file_path, png_file);
+	png_check_t check;
+	int status = png_check_file(file_path, 1, &check);
 
 	// Check for Error Cases
-	if (get_png_status != 0) {
+	if (status == PNG_CHECK_READ_ERROR || status == PNG_CHECK_NOT_PNG || status == PNG_CHECK_TRUNCATED) {
 		printf("%s: Not a PNG file\n", file_path);
+		return (status == PNG_CHECK_READ_ERROR) ? -1 : 1;
+	}
 
-    	return get_png_status;
+	printf("%s: %u x %u\n", file_path, check.ihdr.width, check.ihdr.height);
+
+	// **First Chunk with a Bad CRC**
+	if (status == PNG_CHECK_CRC_ERROR) {
+		printf("%.4s chunk CRC error: computed %x, expected %x\n", check.bad_type, check.computed_crc, check.expected_crc);
+		return 2;
 	}
 
-	// Format the Header Data
-	data_IHDR_p IHDR_data = (data_IHDR_p)malloc(sizeof(struct data_IHDR));
-	int get_data_IHDR_status = get_data_IHDR((char*) png_file->p_IHDR->p_data, IHDR_data);
-	if (get_data_IHDR_status != 0) {
-		printf("%s: Not a PNG file\n", file_path);
-		free(IHDR_data);
-    	return get_png_status;
+	// PNG looks fine
+	return 0;
+}
+
+// Appends n bytes of s to line at *pos, quoted for the output format
+// Stops early (the line is cut short) rather than overflow size
+void append_escaped(char *line, size_t size, size_t *pos, const char *s, size_t n, int format) {
+	const char *hex = "0123456789abcdef";
+	for (size_t i=0; i<n && *pos + 7 < size; i++) {
+		unsigned char c = (unsigned char) s[i];
+		if (format == FORMAT_CSV) {
+			if (c == '"') line[(*pos)++] = '"'; // CSV doubles quotes inside a quoted field
+			line[(*pos)++] = c;
+		} else if (c == '"' || c == '\\') {
+			line[(*pos)++] = '\\';
+			line[(*pos)++] = c;
+		} else if (c < 0x20) {
+			*pos += sprintf(line + *pos, "\\u00%c%c", hex[c >> 4], hex[c & 0xF]);
+		} else {
+			line[(*pos)++] = c;
+		}
 	}
+	line[*pos] = '\0';
+}
 
-	// **CRC Check for IHDR**
-	crcflag = crccheck(png_file->p_IHDR);
-	if (crcflag !=0){
-		printf("%s: %u x %u\n", file_path, IHDR_data->width, IHDR_data->height);
-		printf("IHDR chunk CRC error: computed %lx, expected %x\n", crcflag, png_file->p_IHDR->crc);
-		free(IHDR_data);
-		return 2;
+// Writes the result of checking one file as one CSV row or JSON object, newline included
+// Returns the length of the line
+size_t format_result(char *line, size_t size, char *file_path, png_check_t *check, int format) {
+	size_t pos = 0;
+	int has_header = (check->status != PNG_CHECK_READ_ERROR && check->status != PNG_CHECK_NOT_PNG);
+	const char *status = png_check_status_name(check->status);
+	data_IHDR_p ihdr = &(check->ihdr);
+
+	if (format == FORMAT_CSV) {
+		line[pos++] = '"';
+		append_escaped(line, size, &pos, file_path, strlen(file_path), format);
+		pos += snprintf(line + pos, size - pos, "\",%s,", status);
+		if (has_header) {
+			pos += snprintf(line + pos, size - pos, "%u,%u,%u,%u,%u,", ihdr->width, ihdr->height, ihdr->bit_depth, ihdr->color_type, ihdr->interlace);
+		} else {
+			pos += snprintf(line + pos, size - pos, ",,,,,");
+		}
+		pos += snprintf(line + pos, size - pos, "%d,", check->crc_checked);
+		if (check->status == PNG_CHECK_CRC_ERROR) {
+			line[pos++] = '"';
+			append_escaped(line, size, &pos, (char *) check->bad_type, CHUNK_TYPE_SIZE, format);
+			pos += snprintf(line + pos, size - pos, "\",%08x,%08x\n", check->computed_crc, check->expected_crc);
+		} else {
+			pos += snprintf(line + pos, size - pos, ",,\n");
+		}
+	} else {
+		pos += snprintf(line, size, "{\"path\":\"");
+		append_escaped(line, size, &pos, file_path, strlen(file_path), format);
+		pos += snprintf(line + pos, size - pos, "\",\"status\":\"%s\"", status);
+		if (has_header) {
+			pos += snprintf(line + pos, size - pos, ",\"width\":%u,\"height\":%u,\"bit_depth\":%u,\"color_type\":%u,\"interlace\":%u", ihdr->width, ihdr->height, ihdr->bit_depth, ihdr->color_type, ihdr->interlace);
+		}
+		pos += snprintf(line + pos, size - pos, ",\"crc_checked\":%s", check->crc_checked ? "true" : "false");
+		if (check->status == PNG_CHECK_CRC_ERROR) {
+			pos += snprintf(line + pos, size - pos, ",\"bad_chunk\":\"");
+			append_escaped(line, size, &pos, (char *) check->bad_type, CHUNK_TYPE_SIZE, format);
+			pos += snprintf(line + pos, size - pos, "\",\"computed_crc\":\"%08x\",\"expected_crc\":\"%08x\"", check->computed_crc, check->expected_crc);
+		}
+		pos += snprintf(line + pos, size - pos, "}\n");
 	}
+	return (pos < size) ? pos : size - 1;
+}
 
-	// **CRC Check for IDAT**
-	crcflag = crccheck(png_file->p_IDAT);
-	if (crcflag !=0){
-		printf("%s: %u x %u\n", file_path, IHDR_data->width, IHDR_data->height);
-		printf("IDAT chunk CRC error: computed %lx, expected %x\n", crcflag, png_file->p_IDAT->crc);
-		free(IHDR_data);
-		return 2;
+// Adds a path to the queue, waiting while it is full. The queue takes ownership of path.
+void queue_push(path_queue_t *queue, char *path) {
+	pthread_mutex_lock(&(queue->lock));
+	while (queue->count == PATH_QUEUE_SZ) {
+		pthread_cond_wait(&(queue->not_full), &(queue->lock));
 	}
+	queue->paths[(queue->head + queue->count) % PATH_QUEUE_SZ] = path;
+	queue->count++;
+	pthread_cond_signal(&(queue->not_empty));
+	pthread_mutex_unlock(&(queue->lock));
+}
 
-	// **CRC Check for IEND**
-	crcflag = crccheck(png_file->p_IEND);
-	if (crcflag !=0){
-		printf("%s: %u x %u\n", file_path, IHDR_data->width, IHDR_data->height);
-		printf("IEND chunk CRC error: computed %lx, expected %x\n", crcflag, png_file->p_IEND->crc);
-		free(IHDR_data);
-		return 2;
+// Takes the oldest path off the queue, waiting while it is empty
+// Returns NULL once the queue is closed and empty
+char *queue_pop(path_queue_t *queue) {
+	char *path = NULL;
+	pthread_mutex_lock(&(queue->lock));
+	while (queue->count == 0 && !queue->closed) {
+		pthread_cond_wait(&(queue->not_empty), &(queue->lock));
 	}
+	if (queue->count > 0) {
+		path = queue->paths[queue->head];
+		queue->head = (queue->head + 1) % PATH_QUEUE_SZ;
+		queue->count--;
+		pthread_cond_signal(&(queue->not_full));
+	}
+	pthread_mutex_unlock(&(queue->lock));
+	return path;
+}
 
-	// PNG looks fine
-	printf("%s: %u x %u\n", file_path, IHDR_data->width, IHDR_data->height);
-	free(IHDR_data);
+// Tells the workers no more paths are coming
+void queue_close(path_queue_t *queue) {
+	pthread_mutex_lock(&(queue->lock));
+	queue->closed = 1;
+	pthread_cond_broadcast(&(queue->not_empty));
+	pthread_mutex_unlock(&(queue->lock));
+}
+
+// Thread function for batch mode: checks paths until the queue is closed, one output line each
+void *batch_worker(void *arg) {
+	batch_t *batch = (batch_t *) arg;
+	char *line = (char *) malloc(LINE_BUF_SZ);
+	png_check_t check;
+	char *path;
+
+	while ((path = queue_pop(&(batch->queue))) != NULL) {
+		png_check_file(path, batch->verify_crc, &check);
+		if (line != NULL) {
+			size_t len = format_result(line, LINE_BUF_SZ, path, &check, batch->format);
+			pthread_mutex_lock(&(batch->out_lock));
+			fwrite(line, 1, len, stdout);
+			pthread_mutex_unlock(&(batch->out_lock));
+		}
+		free(path);
+	}
+
+	free(line);
+	return NULL;
+}
+
+// Queues a copy of a path
+// Return values:
+// -1: Error
+// 0: Success
+int push_copy(path_queue_t *queue, const char *path) {
+	char *copy = strdup(path);
+	if (copy == NULL) {
+		perror("strdup");
+		return -1;
+	}
+	queue_push(queue, copy);
 	return 0;
 }
 
+// Queues every regular file under a directory, recursively, skipping hidden entries like findpng does
+// Return values:
+// -1: Error: Could not open a directory (the rest of the tree is still walked)
+// 0: Success
+int queue_dir(char* curr_dir, path_queue_t *queue) {
+	int result = 0;
+	struct dirent *dir_entry;
+	struct stat stats;
+
+	DIR *this_dir = opendir(curr_dir);
+	if (this_dir == NULL) {
+		printf("%s: could not open directory\n", curr_dir);
+		return -1;
+	}
+
+	size_t dir_len = strlen(curr_dir);
+	while ((dir_entry = readdir(this_dir)) != NULL) {
+		if (dir_entry->d_name[0] == '.') continue;
+
+		char *relative_path = malloc(dir_len + strlen(dir_entry->d_name) + 2);
+		if (relative_path == NULL) {
+			perror("malloc");
+			result = -1;
+			break;
+		}
+		strcpy(relative_path, curr_dir);
+		if (dir_len == 0 || curr_dir[dir_len - 1] != '/') strcat(relative_path, "/");
+		strcat(relative_path, dir_entry->d_name);
+
+		// The entry's type usually comes with it, only stat when the filesystem does not say
+		int type = dir_entry->d_type;
+		if (type == DT_UNKNOWN || type == DT_LNK) {
+			type = DT_UNKNOWN;
+			if (stat(relative_path, &stats) == 0) {
+				if (S_ISDIR(stats.st_mode)) type = DT_DIR;
+				else if (S_ISREG(stats.st_mode)) type = DT_REG;
+			}
+		}
+
+		if (type == DT_DIR) {
+			if (queue_dir(relative_path, queue) != 0) result = -1;
+			free(relative_path);
+		} else if (type == DT_REG) {
+			queue_push(queue, relative_path);
+		} else {
+			free(relative_path);
+		}
+	}
+
+	closedir(this_dir);
+	return result;
+}
+
+// Queues the paths read from stdin, one per line (blank lines are skipped)
+// Return values:
+// -1: Error
+// 0: Success
+int queue_stdin(path_queue_t *queue) {
+	char *line = NULL;
+	size_t capacity = 0;
+	ssize_t len;
+	int result = 0;
+
+	while (result == 0 && (len = getline(&line, &capacity, stdin)) != -1) {
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+		if (len > 0) result = push_copy(queue, line);
+	}
+
+	free(line);
+	return result;
+}
+
+// Checks every file given (directory tree, stdin or argument list) on num_threads threads
+// Return values:
+// -1: Error (some files may still have been checked)
+// 0: Success
+int pnginfo_batch(char *dir, char **files, int num_files, int num_threads, int verify_crc, int format) {
+	batch_t batch;
+	memset(&batch, 0, sizeof(batch_t));
+	batch.verify_crc = verify_crc;
+	batch.format = format;
+	pthread_mutex_init(&(batch.queue.lock), NULL);
+	pthread_cond_init(&(batch.queue.not_empty), NULL);
+	pthread_cond_init(&(batch.queue.not_full), NULL);
+	pthread_mutex_init(&(batch.out_lock), NULL);
+
+	// The CRC table is filled in lazily, do it before any thread can race on it
+	make_crc_table();
+	setvbuf(stdout, NULL, _IOFBF, OUT_BUF_SZ);
+	if (format == FORMAT_CSV) {
+		printf("path,status,width,height,bit_depth,color_type,interlace,crc_checked,bad_chunk,computed_crc,expected_crc\n");
+	}
+
+	// **Workers Check Files while this Thread Finds Them**
+	pthread_t threads[num_threads];
+	int started = 0;
+	for (; started<num_threads; started++) {
+		if (pthread_create(threads + started, NULL, batch_worker, &batch) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+	if (started == 0) {
+		pthread_mutex_destroy(&(batch.queue.lock));
+		pthread_cond_destroy(&(batch.queue.not_empty));
+		pthread_cond_destroy(&(batch.queue.not_full));
+		pthread_mutex_destroy(&(batch.out_lock));
+		return -1;
+	}
+
+	int result = 0;
+	if (dir != NULL) {
+		result = queue_dir(dir, &(batch.queue));
+	}
+	for (int i=0; i<num_files && result == 0; i++) {
+		if (strcmp(files[i], "-") == 0) result = queue_stdin(&(batch.queue));
+		else result = push_copy(&(batch.queue), files[i]);
+	}
+	queue_close(&(batch.queue));
+
+	for (int i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	fflush(stdout);
+
+	pthread_mutex_destroy(&(batch.queue.lock));
+	pthread_cond_destroy(&(batch.queue.not_empty));
+	pthread_cond_destroy(&(batch.queue.not_full));
+	pthread_mutex_destroy(&(batch.out_lock));
+	return result;
+}
+
 int main(int argc, char *argv[]) {
-	
-    if(argc != 2) {
-        printf("Usage example: ./pnginfo WEEF_1.png\n");
-        return -1;
-    }
-	
-	//Declare png "object"
-	simple_PNG_p png_file = (simple_PNG_p) malloc(sizeof(struct simple_PNG));
-	
-	// Format the png
-    int png_info_status = get_png_info(argv[1], png_file);
-
-	if (png_info_status == 0 || png_info_status == 2){
-		// Info was fine, and thus still has memory allocated
-		free(png_file->p_IHDR->p_data);
-		free(png_file->p_IHDR);
-		free(png_file->p_IDAT->p_data);
-		free(png_file->p_IDAT);
-		free(png_file->p_IEND->p_data);
-		free(png_file->p_IEND);
-	}
-
-	// Deallocate Memory
-	free(png_file);
+
+	char *dir = NULL;
+	int num_threads = 1;
+	int verify_crc = 0;
+	int format = FORMAT_CSV;
+	int batch = 0;
+
+	int c;
+	while ((c = getopt (argc, argv, "r:t:cf:")) != -1) {
+		batch = 1;
+		switch (c) {
+		case 'r':
+			dir = optarg;
+			break;
+		case 't':
+			num_threads = strtoul(optarg, NULL, 10);
+			if (num_threads < 1) {
+				printf("number of threads must be 1 or more -- 't'\n");
+				return -1;
+			}
+			break;
+		case 'c':
+			verify_crc = 1;
+			break;
+		case 'f':
+			if (strcmp(optarg, "csv") == 0) format = FORMAT_CSV;
+			else if (strcmp(optarg, "json") == 0) format = FORMAT_JSON;
+			else {
+				printf("format must be csv or json -- 'f'\n");
+				return -1;
+			}
+			break;
+		default:
+			printf("Usage example: ./pnginfo WEEF_1.png\n");
+			printf("               ./pnginfo [-c] [-t 8] [-f csv|json] [-r dir] [file ... | -]\n");
+			return -1;
+		}
+	}
+	if (argc - optind > 1 || (optind < argc && strcmp(argv[optind], "-") == 0)) batch = 1;
+
+	if (batch) {
+		if (dir == NULL && optind == argc) {
+			printf("Usage example: ./pnginfo -r ./images -f csv\n");
+			return -1;
+		}
+		return pnginfo_batch(dir, argv + optind, argc - optind, num_threads, verify_crc, format) == 0 ? 0 : -1;
+	}
+
+	if (argc - optind != 1) {
+		printf("Usage example: ./pnginfo WEEF_1.png\n");
+		return -1;
+	}
+
+	get_png_info(argv[optind]);
 
 	return 0;
 }
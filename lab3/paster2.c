@@ -10,11 +10,13 @@
 #include <sys/time.h> // USleep function
 #include <sys/shm.h> // Shared Memory
 #include <semaphore.h> // Semaphores
+#include <getopt.h> // Long options
 
 #include "utils/file_utils/file_fns.c" // File input/output functions
 #include "utils/png_utils/png_fns.c" // PNG functions
 #include "utils/util.c" // Basic functions
 #include "utils/cURL/curl_fns.c" // curl functions
+#include "utils/cache/strip_cache.c" // On-disk strip cache
 
 #define BUF_SIZE 1048576  /* 1024*1024 = 1M */
 
@@ -132,29 +134,63 @@ char *createTargetURL(int server_num, int image_num, int part_num){
     return result;
 }
 
-int producer (int img_rec_buff, int num_images_received, int shmid_sems, int picnum, int numserv, int queuesize);
+int producer (int img_rec_buff, int num_images_received, int shmid_sems, int picnum, int numserv, int queuesize, strip_cache_t *cache);
 int consumer (int csleeptime, int shmid_sems, int img_rec_buff, int processed_img_buff);
 
 int main(int argc, char *argv[]) {
     /** Input Validation and Setup **/
+        // Cache Options
+    static struct option long_options[] = {
+        {"cache-dir", required_argument, NULL, 'd'},
+        {"cache-size", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}
+    };
+    char *cache_dir = NULL;
+    unsigned long cache_mb = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'd':
+            cache_dir = optarg;
+            break;
+        case 's':
+            cache_mb = strtoul(optarg, NULL, 10);
+            if (cache_mb < 1) {
+                printf("%s: cache size must be 1 MB or more -- 'cache-size'\n", argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            printf("Usage example: ./paster2 [--cache-dir DIR] [--cache-size MB] 2 1 3 10 1\n");
+            return -1;
+        }
+    }
+
         // Check Inputs
-    if(argc != 6){
-        printf("Usage example: ./paster2 2 1 3 10 1\n");
+    if(argc - optind != 5){
+        printf("Usage example: ./paster2 [--cache-dir DIR] [--cache-size MB] 2 1 3 10 1\n");
         return -1;
     }
 
         //Input Variables
-	const int queuesize = atoi(argv[1]);
-	const int numproducers = atoi(argv[2]);
-	const int numconsumers = atoi(argv[3]);	
-	const int csleeptime = atoi(argv[4]);
-	const int picnum = atoi(argv[5]);
+	const int queuesize = atoi(argv[optind]);
+	const int numproducers = atoi(argv[optind + 1]);
+	const int numconsumers = atoi(argv[optind + 2]);	
+	const int csleeptime = atoi(argv[optind + 3]);
+	const int picnum = atoi(argv[optind + 4]);
 
 	if (queuesize <1 || numproducers <1 || csleeptime < 0 || picnum <1 || picnum > NUM_IMAGES){ //numconsumers<1 || 
 		printf("invalid arguments\n");
 		return -1;
 	}
 
+        // Strip Cache, shared by the producers
+    strip_cache_t cache;
+    if (cache_dir != NULL && strip_cache_init(&cache, cache_dir, cache_mb) != 0) {
+        printf("%s: could not use cache directory %s\n", argv[0], cache_dir);
+        return -1;
+    }
+
         //Process Variables
 	pid_t pid = 0;
     pid_t cpids[numconsumers];
@@ -237,7 +273,7 @@ int main(int argc, char *argv[]) {
             if ( pid > 0 ) {        /* parent proc */
                 ppids[i] = pid;
             } else if ( pid == 0 ) { /* child proc */
-                producer(img_rec_buff, num_images_received, shmid_sems, picnum, (i % NUM_SERVERS) + 1, queuesize);
+                producer(img_rec_buff, num_images_received, shmid_sems, picnum, (i % NUM_SERVERS) + 1, queuesize, (cache_dir != NULL) ? &cache : NULL);
                 break;
             } else {
                 perror("fork producers");
@@ -305,14 +341,8 @@ int main(int argc, char *argv[]) {
 
         /** Write PNG struct to output file **/
 
-        unsigned long png_data_size = 0;
-        void *png_data;
-        if(fill_png_data(&png_data, &png_data_size, resulting_png) != 0){
-            perror("fill_png_data");
-            return -1;
-        }
-        if(write_mem_to_file(png_data, png_data_size, RESULT_PNG_NAME) != 0){
-            perror("write_mem_to_file");
+        if(write_png_to_file(RESULT_PNG_NAME, resulting_png) != 0){
+            perror("write_png_to_file");
             return -1;
         }
 
@@ -324,7 +354,6 @@ int main(int argc, char *argv[]) {
         /** Cleanup **/
         
         free_simple_PNG(resulting_png);
-        free(png_data);
     }
 
     /** Cleanup **/
@@ -360,9 +389,65 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
+/**
+ * @brief: Downloads one image part from a server
+ * @params:
+ * recv_buf: receives the image part, from shm_recv_buf_init
+ * numserv: The server to request the picture number from.
+ * picnum: The picture number to request
+ * part: The part to request
+ * @return:
+ * -1: Error, the request did not return the image part (the data may still be used, as before caching)
+ * 0: Success
+ */
+int fetch_strip (RECV_BUF *recv_buf, int numserv, int picnum, int part){
+    CURL *curl_handle;
+    CURLcode res;
+    long response_code = 0;
+    char* url;
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    curl_handle = curl_easy_init();
+
+    if (curl_handle == NULL) {
+        perror("curl_easy_init");
+        abort();
+    }
+
+        /* Create URL */
+    url = createTargetURL(numserv, picnum, part);
+        /* specify URL to get */
+    curl_easy_setopt(curl_handle, CURLOPT_URL, url);
+        /* register write call back function to process received data */
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_cb_curl); 
+        /* user defined data structure passed to the call back function */
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)recv_buf);
+        /* register header call back function to process received header data */
+    curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, header_cb_curl); 
+        /* user defined data structure passed to the call back function */
+    curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *)recv_buf);
+        /* some servers requires a user-agent field */
+    curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+        /* request and download data */
+    res = curl_easy_perform(curl_handle);
+
+    if(res != CURLE_OK) {
+        perror("curl_easy_perform()");
+        abort();
+    }
+    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
+
+    /** Clean-Up **/
+    free(url);
+    curl_easy_cleanup(curl_handle);
+    curl_global_cleanup();
+
+    return (response_code == 200 && recv_buf->size > 0 && recv_buf->size <= MAX_STRIP_SIZE) ? 0 : -1;
+}
+
 /**
  * @brief: Function to Run the Producer Portion.
- * This includes receiving image data from the server, and the placing the image data into the received images buffer.
+ * This includes receiving image data from the server (or the strip cache), and the placing the image data into the received images buffer.
  * Once all images are received, the producer stops running.
  * Made so that many producers can be run concurrently to speed up the data-recollection. 
  * @params:
@@ -372,23 +457,24 @@ int main(int argc, char *argv[]) {
  * picnum: The picture number to request
  * numserv: The server to request the picture number from.
  * queuesize: The maximum stack size of the img_rec_buffer.
+ * cache: Strip cache to look in before downloading and to store downloads in, NULL for none.
  * @return:
  * -1: Error
  * 0: Success
  */
-int producer (int img_rec_buff, int num_images_received, int shmid_sems, int picnum, int numserv, int queuesize){
+int producer (int img_rec_buff, int num_images_received, int shmid_sems, int picnum, int numserv, int queuesize, strip_cache_t *cache){
 
    	/** Setup **/
         //Local Variables
    	int received = 0;
-    CURL *curl_handle;
-    CURLcode res;
     RECV_BUF *recv_buf;
     int num_in_buffer = 0;
     short filled_in_queue = 0;
     unsigned long element_siz = 0;
     unsigned long element_num = 0;
-    char* url;
+    void *strip_data; // The image part, in recv_buf or mapped from the cache
+    size_t strip_size;
+    int cache_hit;
 
         //Attaching The Shared Memory
     void* shbuf = shmat(img_rec_buff, NULL, 0);
@@ -405,45 +491,27 @@ int producer (int img_rec_buff, int num_images_received, int shmid_sems, int pic
     	sem_post(&sems[1]);
 
     	if (received < IMAGE_PARTS){
-            /** cURL Setup **/
-            recv_buf = (RECV_BUF *) malloc(sizeof_shm_recv_buf(MAX_STRIP_SIZE));
-                    //Initialize GET buffer and cURL
-            shm_recv_buf_init(recv_buf, MAX_STRIP_SIZE);
-            curl_global_init(CURL_GLOBAL_DEFAULT);
-            curl_handle = curl_easy_init();
-
-            if (curl_handle == NULL) {
-                perror("curl_easy_init");
-                abort();
+            recv_buf = NULL;
+
+            /** Look in the Cache First **/
+            cache_hit = (cache != NULL && strip_cache_get(cache, picnum, received, &strip_data, &strip_size) == 0);
+
+            /** Otherwise Download Image **/
+            if (!cache_hit) {
+                recv_buf = (RECV_BUF *) malloc(sizeof_shm_recv_buf(MAX_STRIP_SIZE));
+                    //Initialize GET buffer
+                shm_recv_buf_init(recv_buf, MAX_STRIP_SIZE);
+                if (fetch_strip(recv_buf, numserv, picnum, received) == 0 && cache != NULL) {
+                    strip_cache_put(cache, picnum, received, recv_buf->buf, recv_buf->size); // Not caching it only costs a download next run
+                }
+                strip_data = recv_buf->buf;
+                strip_size = recv_buf->size;
             }
-            
-    		/** Download Image **/
-                /* Create URL */
-    		url = createTargetURL(numserv, picnum, received);
-		        /* specify URL to get */
-            curl_easy_setopt(curl_handle, CURLOPT_URL, url);
-                /* register write call back function to process received data */
-            curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_cb_curl); 
-                /* user defined data structure passed to the call back function */
-            curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)recv_buf);
-                /* register header call back function to process received header data */
-            curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, header_cb_curl); 
-                /* user defined data structure passed to the call back function */
-            curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *)recv_buf);
-                /* some servers requires a user-agent field */
-            curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
-                /* request and download data */
-	        res = curl_easy_perform(curl_handle);
-
-	        if(res != CURLE_OK) {
-	            perror("curl_easy_perform()");
-                abort();
-	        }
 
             /** @critical_section: Wait For Open Spot in Queue to Copy Memory in (Busy Waiting) **/
             filled_in_queue = 0;
             element_num = (unsigned long) received;
-            element_siz = (unsigned long) (recv_buf->size > MAX_STRIP_SIZE ? MAX_STRIP_SIZE : recv_buf->size);
+            element_siz = (unsigned long) (strip_size > MAX_STRIP_SIZE ? MAX_STRIP_SIZE : strip_size);
         	do {
 		    	sem_wait(&sems[0]);
 		        num_in_buffer = *(short *)shbuf;
@@ -453,16 +521,17 @@ int producer (int img_rec_buff, int num_images_received, int shmid_sems, int pic
                     //Copy over the Data
                     memcpy((void *)(shbuf + sizeof(short) + (num_in_buffer) * RECV_BUFF_ELEMENT_SZ ), (void *) &element_siz, sizeof(unsigned long));
 	                memcpy((void *)(shbuf + sizeof(short) + (num_in_buffer) * RECV_BUFF_ELEMENT_SZ + sizeof(unsigned long)), (void *) &element_num, sizeof(unsigned long));
-	                memcpy((void *)(shbuf + sizeof(short) + (num_in_buffer) * RECV_BUFF_ELEMENT_SZ + (2 * sizeof(unsigned long))), (void *) recv_buf->buf, element_siz);
+	                memcpy((void *)(shbuf + sizeof(short) + (num_in_buffer) * RECV_BUFF_ELEMENT_SZ + (2 * sizeof(unsigned long))), strip_data, element_siz);
                 }
 		        sem_post(&sems[0]);
 		    } while (!filled_in_queue);
 
             /** Clean-Up **/
-            free(url);
-            curl_easy_cleanup(curl_handle);
-            curl_global_cleanup();
-            free(recv_buf);
+            if (cache_hit) {
+                strip_cache_release(strip_data, strip_size);
+            } else {
+                free(recv_buf);
+            }
     	}
     }
     return 0;
@@ -490,6 +559,8 @@ int consumer (int csleeptime, int shmid_sems, int img_rec_buff, int processed_im
     simple_PNG_p part_png;
     U64 len_inf;
     U8* catbuf = (U8 *) malloc(PROC_BUFF_ELEMENT_SZ);
+    png_arena_t arena; // Holds the strip being processed, reset after each one
+    png_arena_init(&arena, 2 * RECV_BUFF_ELEMENT_SZ);
 
     sem_t *sems = shmat(shmid_sems, NULL, 0);
     void *rec_buff = shmat(img_rec_buff, NULL, 0);
@@ -505,9 +576,10 @@ int consumer (int csleeptime, int shmid_sems, int img_rec_buff, int processed_im
         if(num_in_buffer != 0){ //There was an element in the buffer, copying out of the buffer
             (*(short *)rec_buff)--; //Decrement number of elements in the buffer
             part_size = *(unsigned long *)(rec_buff + sizeof(short) + (num_in_buffer - 1) * RECV_BUFF_ELEMENT_SZ);
-            part_data = malloc(part_size);
+            part_data = png_arena_alloc(&arena, part_size);
             part_number = *(unsigned short *)(rec_buff + sizeof(short) + (num_in_buffer - 1) * RECV_BUFF_ELEMENT_SZ + sizeof(unsigned long));
-            memcpy(part_data, (void *)(rec_buff + sizeof(short) + ((num_in_buffer - 1) * RECV_BUFF_ELEMENT_SZ) + (2 * sizeof(unsigned long))), part_size);
+            // Out of arena memory: the part is dropped below, after the buffer is released
+            if(part_data != NULL) memcpy(part_data, (void *)(rec_buff + sizeof(short) + ((num_in_buffer - 1) * RECV_BUFF_ELEMENT_SZ) + (2 * sizeof(unsigned long))), part_size);
         }
         sem_post(&sems[0]);
 
@@ -521,8 +593,7 @@ int consumer (int csleeptime, int shmid_sems, int img_rec_buff, int processed_im
         }else {
 
             /** Format Into PNG **/
-            part_png = (simple_PNG_p) malloc(sizeof(struct simple_PNG));
-            if(fill_png_struct(part_png, part_data, part_size) != 0){
+            if(part_data == NULL || fill_png_struct_arena(&part_png, &arena, part_data, part_size) != 0){
                 /**
                  * @alert: This section just prevents the code from failing. If an error occurs with the image, it replaces that section with an empty PDF instead of causing the entire process to fail.
                  * Can be taken out, but should be left in for now to stop the process from terminating or hanging.
@@ -548,15 +619,14 @@ int consumer (int csleeptime, int shmid_sems, int img_rec_buff, int processed_im
                 num_recv = *(short *)proc_buff;
                 memcpy((void *)(proc_buff + sizeof(short) + (part_number * PROC_BUFF_ELEMENT_SZ)), (void *)catbuf, len_inf);
                 sem_post(&sems[2]);
-
-                free_simple_PNG(part_png);
             }
 
-            /** Clean-up **/
-            free(part_data);
+            /** Clean-up: the received data and the PNG parsed from it, all at once **/
+            png_arena_reset(&arena);
         }
     }
     
+    png_arena_free(&arena);
     free(catbuf);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+/**
+ * @brief: Benchmarks parsing PNG strips the way the paster2 consumers do, once with a malloc per object
+ *         (fill_png_struct / free_simple_PNG) and once from an arena reset after every strip (fill_png_struct_arena).
+ *         Prints the mallocs and frees per strip, counted by wrapping malloc and free at link time, and the time per strip.
+ * EXAMPLE: ./png_bench -n 100000 all.png
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "utils/file_utils/file_fns.c" // File input/output functions
+#include "utils/png_utils/png_fns.c" // PNG functions
+
+/** Allocation counters, see the -Wl,--wrap flags in the Makefile **/
+unsigned long num_mallocs = 0;
+unsigned long num_frees = 0;
+
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size){
+    num_mallocs++;
+    return __real_malloc(size);
+}
+
+void __wrap_free(void *ptr){
+    if(ptr != NULL) num_frees++;
+    __real_free(ptr);
+}
+
+/**
+ * @return: the current time in seconds
+ */
+double now_seconds(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/**
+ * @brief: Prints one line of results
+ * @params:
+ * name: the allocation strategy
+ * iterations: strips parsed
+ * mallocs, frees: allocation calls made while parsing them
+ * seconds: time taken
+ */
+void print_result(const char *name, int iterations, unsigned long mallocs, unsigned long frees, double seconds){
+    printf("%-8s %14.2lf %14.2lf %14.1lf\n", name, (double) mallocs / iterations, (double) frees / iterations, seconds * 1000000000.0 / iterations);
+}
+
+int main(int argc, char *argv[]){
+
+    int iterations = 100000;
+
+    int c;
+    while ((c = getopt (argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            if (iterations < 1) {
+                printf("number of iterations must be 1 or more -- 'n'\n");
+                return -1;
+            }
+            break;
+        default:
+            printf("Usage example: ./png_bench -n 100000 all.png\n");
+            return -1;
+        }
+    }
+    if (optind != argc - 1) {
+        printf("Usage example: ./png_bench -n 100000 all.png\n");
+        return -1;
+    }
+
+    /** Load the Strip **/
+    void *file_data;
+    unsigned long file_len = 0;
+    if(write_file_to_mem(&file_data, &file_len, argv[optind]) != 0){
+        printf("%s: could not read the file\n", argv[optind]);
+        return -1;
+    }
+
+    printf("%-8s %14s %14s %14s\n", "alloc", "mallocs/strip", "frees/strip", "ns/strip");
+
+    /** malloc: Copy out of the Receive Buffer, Parse, Free each Object **/
+    unsigned long mallocs = num_mallocs;
+    unsigned long frees = num_frees;
+    double start = now_seconds();
+    for(int i = 0; i < iterations; i++){
+        void *part_data = malloc(file_len);
+        memcpy(part_data, file_data, file_len);
+        simple_PNG_p part_png = (simple_PNG_p) malloc(sizeof(struct simple_PNG));
+        if(fill_png_struct(part_png, part_data, file_len) != 0){
+            printf("%s: not a PNG\n", argv[optind]);
+            free(part_png);
+            free(part_data);
+            free(file_data);
+            return -1;
+        }
+        free_simple_PNG(part_png);
+        free(part_data);
+    }
+    print_result("malloc", iterations, num_mallocs - mallocs, num_frees - frees, now_seconds() - start);
+
+    /** Arena: the Same Work, Released with One Reset per Strip **/
+    png_arena_t arena;
+    png_arena_init(&arena, 0);
+    mallocs = num_mallocs;
+    frees = num_frees;
+    start = now_seconds();
+    for(int i = 0; i < iterations; i++){
+        void *part_data = png_arena_alloc(&arena, file_len);
+        simple_PNG_p part_png;
+        if(part_data == NULL){
+            perror("png_arena_alloc");
+            png_arena_free(&arena);
+            free(file_data);
+            return -1;
+        }
+        memcpy(part_data, file_data, file_len);
+        if(fill_png_struct_arena(&part_png, &arena, part_data, file_len) != 0){
+            printf("%s: not a PNG\n", argv[optind]);
+            png_arena_free(&arena);
+            free(file_data);
+            return -1;
+        }
+        png_arena_reset(&arena);
+    }
+    double seconds = now_seconds() - start;
+    png_arena_free(&arena);
+    print_result("arena", iterations, num_mallocs - mallocs, num_frees - frees, seconds);
+    printf("arena blocks: %lu, allocations: %lu\n", arena.num_blocks, arena.num_allocs);
+
+    free(file_data);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/********************************************************************
+ * @file: sha256.c
+ * @brief: SHA-256 message digest, used to name and verify cached strips
+ * Reference: FIPS 180-4, Secure Hash Standard, section 6.2
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#pragma once
+
+#define SHA256_BLOCK_SIZE 64 // Bytes hashed at a time
+#define SHA256_DIGEST_SIZE 32 // Bytes in a digest
+#define SHA256_HEX_SIZE (2 * SHA256_DIGEST_SIZE + 1) // A digest as lower case hex, with the null terminator
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Running state of a digest */
+typedef struct sha256_ctx {
+    unsigned int state[8];
+    unsigned long long num_bytes; /* Bytes hashed so far */
+    unsigned char block[SHA256_BLOCK_SIZE]; /* Bytes waiting for a full block */
+    unsigned int block_len;
+} sha256_ctx_t;
+
+/* First 32 bits of the fractional parts of the cube roots of the first 64 primes */
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Start a new digest */
+void sha256_init(sha256_ctx_t *ctx)
+{
+    static const unsigned int initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->num_bytes = 0;
+    ctx->block_len = 0;
+}
+
+/* Hash one 64 byte block into the state */
+void sha256_transform(sha256_ctx_t *ctx, const unsigned char *block)
+{
+    unsigned int w[64];
+    unsigned int a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((unsigned int) block[4 * i] << 24) | ((unsigned int) block[4 * i + 1] << 16) |
+               ((unsigned int) block[4 * i + 2] << 8) | (unsigned int) block[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        unsigned int s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned int s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+
+    for (i = 0; i < 64; i++) {
+        unsigned int s1 = SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25);
+        unsigned int ch = (e & f) ^ (~e & g);
+        unsigned int t1 = h + s1 + ch + sha256_k[i] + w[i];
+        unsigned int s0 = SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22);
+        unsigned int maj = (a & b) ^ (a & c) ^ (b & c);
+        unsigned int t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+/* Add the bytes buf[0..len-1] to the digest */
+void sha256_update(sha256_ctx_t *ctx, const unsigned char *buf, size_t len)
+{
+    ctx->num_bytes += len;
+
+    /* Finish the block left over from the last call */
+    if (ctx->block_len > 0) {
+        size_t take = SHA256_BLOCK_SIZE - ctx->block_len;
+        if (take > len) take = len;
+        memcpy(ctx->block + ctx->block_len, buf, take);
+        ctx->block_len += take;
+        buf += take;
+        len -= take;
+        if (ctx->block_len < SHA256_BLOCK_SIZE) return;
+        sha256_transform(ctx, ctx->block);
+        ctx->block_len = 0;
+    }
+
+    /* Whole blocks straight from the input */
+    while (len >= SHA256_BLOCK_SIZE) {
+        sha256_transform(ctx, buf);
+        buf += SHA256_BLOCK_SIZE;
+        len -= SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->block, buf, len);
+    ctx->block_len = len;
+}
+
+/* Pad the message and write the digest */
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+    unsigned long long num_bits = ctx->num_bytes * 8;
+    unsigned char pad[SHA256_BLOCK_SIZE + 8];
+    size_t pad_len = (ctx->block_len < 56) ? 56 - ctx->block_len : 120 - ctx->block_len;
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++) {
+        pad[pad_len + i] = (unsigned char) (num_bits >> (56 - 8 * i));
+    }
+    sha256_update(ctx, pad, pad_len + 8);
+
+    for (i = 0; i < 8; i++) {
+        digest[4 * i] = (unsigned char) (ctx->state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char) (ctx->state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char) (ctx->state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char) ctx->state[i];
+    }
+}
+
+/* Write the digest of the bytes buf[0..len-1] into hex, as a null terminated string */
+void sha256_hex(const unsigned char *buf, size_t len, char hex[SHA256_HEX_SIZE])
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t ctx;
+    int i;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, buf, len);
+    sha256_final(&ctx, digest);
+
+    for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0x0f];
+    }
+    hex[2 * SHA256_DIGEST_SIZE] = '\0';
+}
@@ -0,0 +1,285 @@
+/**
+ * @brief: On-disk cache of downloaded image strips, so repeated runs only fetch the strips they have not seen.
+ *         Strips are content addressed: each one is stored once as <dir>/<sha256>.png, and a small key file
+ *         <dir>/img<N>_part<P> holds the digest of the strip served for that image and part.
+ *         A hit memory maps the strip and checks its SHA-256 against its name, a strip that does not match is
+ *         removed and treated as a miss. Hits touch the strip's mtime, and when the strips outgrow the size limit
+ *         the least recently used ones are removed first.
+ *         Files are written under a temporary name and renamed into place, so the producer processes can share
+ *         one cache directory and never see a partly written strip.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h> // For PATH_MAX
+#include <fcntl.h> // For open
+#include <unistd.h> // For close, unlink
+#include <sys/stat.h> // For mkdir, fstat, futimens
+#include <sys/mman.h> // For mmap
+
+#include "sha256.c" // Content digests
+
+#pragma once
+
+#define STRIP_CACHE_DEFAULT_MB 64 // Size limit when none is given
+#define STRIP_CACHE_EXT ".png" // Extension of the strip files, key files have none
+#define STRIP_CACHE_DIR_MAX (PATH_MAX - 128) // Longest directory path, leaving room for the file names in it
+
+typedef struct strip_cache {
+    char dir[STRIP_CACHE_DIR_MAX]; // Cache directory
+    unsigned long max_bytes; // Strips are evicted once their total size is over this
+} strip_cache_t;
+
+/**
+ * One strip file, for eviction
+ */
+typedef struct strip_cache_entry {
+    char name[SHA256_HEX_SIZE + sizeof(STRIP_CACHE_EXT)];
+    off_t size;
+    struct timespec used; // mtime, set when the strip was stored or last hit
+} strip_cache_entry_t;
+
+/**
+ * @brief: Opens the cache, creating its directory if it does not exist
+ * @params:
+ * cache: filled by the function
+ * dir: the cache directory
+ * max_mb: size limit of the strips in megabytes, 0 for STRIP_CACHE_DEFAULT_MB
+ * @return:
+ * -1: Error (the directory could not be created, or its path is too long)
+ * 0: Success
+ */
+int strip_cache_init(strip_cache_t *cache, char *dir, unsigned long max_mb){
+    memset(cache, 0, sizeof(strip_cache_t));
+    if(dir == NULL || strlen(dir) >= STRIP_CACHE_DIR_MAX) return -1;
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST) return -1;
+
+    struct stat st;
+    if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return -1;
+
+    strcpy(cache->dir, dir);
+    cache->max_bytes = ((max_mb > 0) ? max_mb : STRIP_CACHE_DEFAULT_MB) * 1024 * 1024;
+    return 0;
+}
+
+/**
+ * @brief: Reads the digest a key file points to
+ * @params:
+ * key_path: the key file
+ * hex: out, the digest
+ * @return:
+ * -1: No key file, or it does not hold a digest
+ * 0: Success
+ */
+int strip_cache_read_key(char *key_path, char hex[SHA256_HEX_SIZE]){
+    int fd = open(key_path, O_RDONLY);
+    if(fd < 0) return -1;
+    ssize_t got = read(fd, hex, SHA256_HEX_SIZE - 1);
+    close(fd);
+    if(got != SHA256_HEX_SIZE - 1) return -1;
+    hex[SHA256_HEX_SIZE - 1] = '\0';
+    for(int i = 0; i < SHA256_HEX_SIZE - 1; i++){
+        if(!((hex[i] >= '0' && hex[i] <= '9') || (hex[i] >= 'a' && hex[i] <= 'f'))) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief: Looks a strip up in the cache
+ * @params:
+ * cache: from strip_cache_init
+ * image, part: which strip
+ * data: out, the strip, memory mapped read only. Release it with strip_cache_release.
+ * len: out, its size in bytes
+ * @return:
+ * 0: Hit
+ * 1: Miss (including a strip that failed its SHA-256 check, which is removed)
+ */
+int strip_cache_get(strip_cache_t *cache, int image, int part, void **data, size_t *len){
+    char key_path[PATH_MAX];
+    char strip_path[PATH_MAX];
+    char hex[SHA256_HEX_SIZE];
+    char check[SHA256_HEX_SIZE];
+
+    snprintf(key_path, PATH_MAX, "%s/img%d_part%d", cache->dir, image, part);
+    if(strip_cache_read_key(key_path, hex) != 0) return 1;
+    snprintf(strip_path, PATH_MAX, "%s/%s%s", cache->dir, hex, STRIP_CACHE_EXT);
+
+    /** Map the Strip **/
+    int fd = open(strip_path, O_RDONLY);
+    if(fd < 0){
+        unlink(key_path); // The strip was evicted
+        return 1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0){
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+        close(fd);
+        return 1;
+    }
+
+    /** Verify it is the Strip it is Named after **/
+    sha256_hex((unsigned char *) map, st.st_size, check);
+    if(strcmp(check, hex) != 0){
+        munmap(map, st.st_size);
+        close(fd);
+        unlink(strip_path);
+        unlink(key_path);
+        return 1;
+    }
+
+    /** Mark it as Recently Used **/
+    futimens(fd, NULL);
+    close(fd);
+
+    *data = map;
+    *len = st.st_size;
+    return 0;
+}
+
+/**
+ * @brief: Releases a strip returned by strip_cache_get
+ */
+void strip_cache_release(void *data, size_t len){
+    munmap(data, len);
+}
+
+/**
+ * @brief: Writes a file under a temporary name in the cache directory, then renames it to its path
+ * @return:
+ * -1: Error (nothing is left behind)
+ * 0: Success
+ */
+int strip_cache_write_file(strip_cache_t *cache, char *path, const void *data, size_t len){
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, PATH_MAX, "%s/.tmp.%d", cache->dir, (int) getpid());
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0) return -1;
+    const char *pos = (const char *) data;
+    while(len > 0){
+        ssize_t written = write(fd, pos, len);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            close(fd);
+            unlink(temp_path);
+            return -1;
+        }
+        pos += written;
+        len -= written;
+    }
+    if(close(fd) != 0 || rename(temp_path, path) != 0){
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @return: comparison of two strips by last use, oldest first, for qsort
+ */
+int strip_cache_compare_used(const void *a, const void *b){
+    const struct timespec *used_a = &(((const strip_cache_entry_t *) a)->used);
+    const struct timespec *used_b = &(((const strip_cache_entry_t *) b)->used);
+    if(used_a->tv_sec != used_b->tv_sec) return (used_a->tv_sec < used_b->tv_sec) ? -1 : 1;
+    if(used_a->tv_nsec != used_b->tv_nsec) return (used_a->tv_nsec < used_b->tv_nsec) ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief: Removes the least recently used strips until the rest fit in the size limit.
+ *         Their key files are left, and removed by strip_cache_get when it finds them dangling.
+ * @return:
+ * -1: Error reading the directory
+ * 0: Success
+ */
+int strip_cache_evict(strip_cache_t *cache){
+    DIR *dir = opendir(cache->dir);
+    if(dir == NULL) return -1;
+
+    strip_cache_entry_t *entries = NULL;
+    size_t num_entries = 0;
+    size_t max_entries = 0;
+    unsigned long total = 0;
+    char path[PATH_MAX];
+
+    /** List the Strips **/
+    struct dirent *ent;
+    while((ent = readdir(dir)) != NULL){
+        size_t name_len = strlen(ent->d_name);
+        if(name_len != SHA256_HEX_SIZE - 1 + strlen(STRIP_CACHE_EXT) || strcmp(ent->d_name + SHA256_HEX_SIZE - 1, STRIP_CACHE_EXT) != 0) continue;
+
+        struct stat st;
+        snprintf(path, PATH_MAX, "%s/%s", cache->dir, ent->d_name);
+        if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        if(num_entries == max_entries){
+            max_entries = (max_entries > 0) ? 2 * max_entries : 64;
+            strip_cache_entry_t *grown = (strip_cache_entry_t *) realloc(entries, max_entries * sizeof(strip_cache_entry_t));
+            if(grown == NULL){
+                free(entries);
+                closedir(dir);
+                return -1;
+            }
+            entries = grown;
+        }
+        strcpy(entries[num_entries].name, ent->d_name);
+        entries[num_entries].size = st.st_size;
+        entries[num_entries].used = st.st_mtim;
+        num_entries++;
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    /** Remove the Oldest until Under the Limit **/
+    if(total > cache->max_bytes){
+        qsort(entries, num_entries, sizeof(strip_cache_entry_t), strip_cache_compare_used);
+        for(size_t i = 0; i < num_entries && total > cache->max_bytes; i++){
+            snprintf(path, PATH_MAX, "%s/%s", cache->dir, entries[i].name);
+            if(unlink(path) == 0 || errno == ENOENT) total -= entries[i].size; // Another process may have removed it
+        }
+    }
+
+    free(entries);
+    return 0;
+}
+
+/**
+ * @brief: Stores a downloaded strip, then evicts strips if the cache is over its size limit
+ * @params:
+ * cache: from strip_cache_init
+ * image, part: which strip
+ * data, len: the strip
+ * @return:
+ * -1: Error (the strip is not cached)
+ * 0: Success
+ */
+int strip_cache_put(strip_cache_t *cache, int image, int part, const void *data, size_t len){
+    char key_path[PATH_MAX];
+    char strip_path[PATH_MAX];
+    char hex[SHA256_HEX_SIZE];
+
+    if(data == NULL || len == 0) return -1;
+    sha256_hex((const unsigned char *) data, len, hex);
+    snprintf(strip_path, PATH_MAX, "%s/%s%s", cache->dir, hex, STRIP_CACHE_EXT);
+    snprintf(key_path, PATH_MAX, "%s/img%d_part%d", cache->dir, image, part);
+
+    /** The Strip First, so a Key never Points at a Missing Strip it was just Written for **/
+    struct stat st;
+    if(stat(strip_path, &st) == 0 && st.st_size == (off_t) len){
+        utimensat(AT_FDCWD, strip_path, NULL, 0); // Already stored under another key
+    }else if(strip_cache_write_file(cache, strip_path, data, len) != 0){
+        return -1;
+    }
+    if(strip_cache_write_file(cache, key_path, hex, SHA256_HEX_SIZE - 1) != 0) return -1;
+
+    return strip_cache_evict(cache);
+}
@@ -9,6 +9,9 @@
 #include <errno.h>
 #include <dirent.h>
 #include <sys/stat.h> // For stat function on a file
+#include <fcntl.h> // For open
+#include <unistd.h> // For close
+#include <sys/uio.h> // For writev
 
 #pragma once
 
@@ -133,3 +136,43 @@ int write_mem_to_file(void* result, unsigned long length, char *file_path){
 
     return 0;
 }
+
+/**
+ * @brief: Writes a list of buffers to a file, in order, with as few writev calls as the kernel allows (one, unless it writes short).
+ * @params:
+ * iov: the buffers. Updated as they are written, so it cannot be reused afterwards.
+ * iovcnt: number of buffers, at most IOV_MAX
+ * file_path: the file to write, created or truncated
+ * @return:
+ * -1: Error in writing to file
+ * 0: success
+ */
+int write_iov_to_file(struct iovec *iov, int iovcnt, char *file_path){
+    if(file_path == NULL) return -1;
+
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0) return -1;
+
+    int result = 0;
+    while(iovcnt > 0){
+        ssize_t written = writev(fd, iov, iovcnt);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        /** Skip what was written, which may end part way through a buffer **/
+        while(iovcnt > 0 && (size_t) written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    if(close(fd) != 0) result = -1;
+    return result;
+}
@@ -0,0 +1,112 @@
+/**
+ * @brief: Arena (region) allocator for PNG objects. Structs, chunks and chunk data are carved out of a few large
+ *         blocks instead of being malloced one by one, and all of them are released at once by resetting the arena.
+ *         A reset keeps the blocks, so parsing strip after strip through the same arena stops calling malloc once
+ *         the first strip has sized it.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma once
+
+#define PNG_ARENA_BLOCK_SZ 65536 // Default block size
+#define PNG_ARENA_ALIGN 16 // Every allocation starts on this boundary
+#define PNG_ARENA_ROUND(n) (((n) + PNG_ARENA_ALIGN - 1) & ~((size_t) PNG_ARENA_ALIGN - 1))
+
+/**
+ * A block of memory allocations are carved from. The data follows the header.
+ */
+typedef struct png_arena_block {
+    struct png_arena_block *next;
+    size_t size; // Bytes of data in the block
+    size_t used; // Bytes handed out so far
+} png_arena_block_t;
+
+typedef struct png_arena {
+    png_arena_block_t *head; // First block, the list is kept across resets
+    png_arena_block_t *current; // Block allocations are taken from (the ones after it are empty)
+    size_t block_size; // Size of new blocks, unless an allocation needs a bigger one
+    unsigned long num_blocks; // Blocks malloced over the arena's life
+    unsigned long num_allocs; // Allocations handed out over the arena's life
+} png_arena_t;
+
+/**
+ * @brief: Initializes an empty arena. No memory is allocated until the first png_arena_alloc.
+ * @params:
+ * arena: the arena to initialize
+ * block_size: size of each block, 0 for PNG_ARENA_BLOCK_SZ
+ */
+void png_arena_init(png_arena_t *arena, size_t block_size){
+    memset(arena, 0, sizeof(png_arena_t));
+    arena->block_size = (block_size > 0) ? block_size : PNG_ARENA_BLOCK_SZ;
+}
+
+/**
+ * @brief: Allocates memory from the arena. It is only released by png_arena_reset or png_arena_free.
+ * @params:
+ * arena: the arena to allocate from
+ * size: number of bytes
+ * @return: the memory (aligned to PNG_ARENA_ALIGN), NULL on error
+ */
+void *png_arena_alloc(png_arena_t *arena, size_t size){
+    size_t rounded = PNG_ARENA_ROUND(size);
+    if(rounded == 0) rounded = PNG_ARENA_ALIGN;
+
+    /** Use the current block, or the next emptied block big enough **/
+    png_arena_block_t *block = arena->current;
+    while(block != NULL && block->size - block->used < rounded){
+        block = block->next;
+    }
+
+    /** Otherwise add a new block to the end of the list **/
+    if(block == NULL){
+        size_t size_block = (rounded > arena->block_size) ? rounded : arena->block_size;
+        block = (png_arena_block_t *) malloc(PNG_ARENA_ROUND(sizeof(png_arena_block_t)) + size_block);
+        if(block == NULL) return NULL;
+        block->next = NULL;
+        block->size = size_block;
+        block->used = 0;
+        arena->num_blocks++;
+
+        if(arena->head == NULL){
+            arena->head = block;
+        }else{
+            png_arena_block_t *last = (arena->current != NULL) ? arena->current : arena->head;
+            while(last->next != NULL) last = last->next;
+            last->next = block;
+        }
+    }
+
+    arena->current = block;
+    void *result = (char *) block + PNG_ARENA_ROUND(sizeof(png_arena_block_t)) + block->used;
+    block->used += rounded;
+    arena->num_allocs++;
+    return result;
+}
+
+/**
+ * @brief: Releases everything allocated from the arena at once. The blocks are kept for the next allocations.
+ */
+void png_arena_reset(png_arena_t *arena){
+    for(png_arena_block_t *block = arena->head; block != NULL; block = block->next){
+        block->used = 0;
+    }
+    arena->current = arena->head;
+}
+
+/**
+ * @brief: Releases everything allocated from the arena and the blocks themselves. The arena can be used again after.
+ */
+void png_arena_free(png_arena_t *arena){
+    png_arena_block_t *block = arena->head;
+    while(block != NULL){
+        png_arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->current = NULL;
+}
@@ -12,6 +12,8 @@
 #include "png.h" // For png structs and data
 #include "crc/crc.c" // For crc generator function
 #include "zutil/zutil.c" //For data compression and decompression
+#include "../file_utils/file_fns.c" // For write_iov_to_file
+#include "png_arena.c" // For allocating whole PNGs from one block
 
 #pragma once
 
@@ -43,17 +45,27 @@ unsigned long crc_generator(chunk_p data){
 }
 
 /**
- * @brief: Fills a chunk with data from the data pointer. Updates the offset.
+ * @brief: Allocates memory from an arena, or with malloc when there is no arena.
  * @params:
- * out: allocated memory for the chunk struct (p_data should not be allocated). Will be filled by the function.
- * data: pointer to the beginning of the data to fill the chunk from.
- * offset: pointer to the current offset within the data. This value will be updated as the chunk is filled.
- * @note: de-allocating the memory where data and offset are stored is up to the user.
+ * arena: the arena, or NULL for malloc
+ * size: number of bytes
+ * @return: the memory, NULL on error
+ */
+void *png_alloc(png_arena_t *arena, size_t size){
+    if(arena != NULL) return png_arena_alloc(arena, size);
+    return malloc(size);
+}
+
+/**
+ * @brief: fill_chunk, with the chunk data allocated from an arena.
+ * @params:
+ * arena: where out->p_data is allocated. NULL for malloc.
+ * out, data, offset, data_len: see fill_chunk
  * @return:
  * -1: Error in reading data
  * 0: got chunk
  */
-int fill_chunk(chunk_p out, void* data, unsigned long *offset, unsigned long data_len){
+int fill_chunk_arena(chunk_p out, png_arena_t *arena, void* data, unsigned long *offset, unsigned long data_len){
     //Read Length Field
     if(data_len != 0 && data_len < *offset + CHUNK_LEN_SIZE) return -1;
     memcpy((void *)(&(out->length)), (void *)(data + *offset), CHUNK_LEN_SIZE);
@@ -67,7 +79,8 @@ int fill_chunk(chunk_p out, void* data, unsigned long *offset, unsigned long dat
 
     //Read Data Field
     if(data_len != 0 && data_len < *offset + out->length) return -1;
-    out->p_data = malloc(out->length);
+    out->p_data = png_alloc(arena, out->length);
+    if(out->p_data == NULL) return -1;
     memcpy((void *)(out->p_data), (void *)(data + *offset), out->length);
     *offset += out->length;
 
@@ -80,6 +93,21 @@ int fill_chunk(chunk_p out, void* data, unsigned long *offset, unsigned long dat
     return 0;
 }
 
+/**
+ * @brief: Fills a chunk with data from the data pointer. Updates the offset.
+ * @params:
+ * out: allocated memory for the chunk struct (p_data should not be allocated). Will be filled by the function.
+ * data: pointer to the beginning of the data to fill the chunk from.
+ * offset: pointer to the current offset within the data. This value will be updated as the chunk is filled.
+ * @note: de-allocating the memory where data and offset are stored is up to the user.
+ * @return:
+ * -1: Error in reading data
+ * 0: got chunk
+ */
+int fill_chunk(chunk_p out, void* data, unsigned long *offset, unsigned long data_len){
+    return fill_chunk_arena(out, NULL, data, offset, data_len);
+}
+
 /**
  * @brief: Fills the target_png with the data from the data pointer.
  * @params:
@@ -119,6 +147,76 @@ int fill_png_struct(simple_PNG_p target_png, void* data, unsigned long data_len)
     return 0;
 }
 
+/**
+ * @brief: Parses PNG data into a simple_png allocated entirely from an arena: the struct, the three chunks and their data.
+ *         Nothing has to be freed one by one, resetting (or freeing) the arena releases the whole image.
+ * @params:
+ * target_png: set to the new simple_png
+ * arena: the arena to allocate from
+ * data: pointer to the memory containing all the data for a valid PNG file. It can be in the same arena.
+ * data_len: see fill_png_struct
+ * @note: on error the memory already taken stays in the arena until it is reset.
+ * @return:
+ * -1: Error in reading data
+ * 0: Success
+ */
+int fill_png_struct_arena(simple_PNG_p *target_png, png_arena_t *arena, void* data, unsigned long data_len){
+
+    unsigned long offset = 0; //Current offset in the data pointer
+
+    /** One allocation for the struct and the three chunks **/
+    struct png_arena_image {
+        struct simple_PNG png;
+        struct chunk chunks[3];
+    } *image = (struct png_arena_image *) png_arena_alloc(arena, sizeof(struct png_arena_image));
+    if(image == NULL) return -1;
+
+    simple_PNG_p png = &(image->png);
+    png->p_IHDR = &(image->chunks[0]);
+    png->p_IDAT = &(image->chunks[1]);
+    png->p_IEND = &(image->chunks[2]);
+
+    // Copy the header
+    if(data_len != 0 && data_len < offset + PNG_HDR_SIZE * sizeof(U8)) return -1;
+    memcpy((void *)png->png_hdr, data, PNG_HDR_SIZE * sizeof(U8));
+    offset += PNG_HDR_SIZE * sizeof(U8);
+
+    /** Fill the chunks with data **/
+    if(fill_chunk_arena(png->p_IHDR, arena, data, &offset, data_len) != 0) return -1;
+    if(fill_chunk_arena(png->p_IDAT, arena, data, &offset, data_len) != 0) return -1;
+    if(fill_chunk_arena(png->p_IEND, arena, data, &offset, data_len) != 0) return -1;
+
+    *target_png = png;
+    return 0;
+}
+
+/**
+ * @brief: Writes a chunk to memory, in the format required for a png.
+ * @params:
+ * target: where to write it, at least CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + chunk->length + CHUNK_CRC_SIZE bytes
+ * chunk: pointer to the chunk data struct where the data is to be taken from.
+ * @return: the number of bytes written
+ */
+unsigned long chunk_to_mem(void *target, chunk_p chunk){
+    unsigned long offset = 0;
+
+    U32 chunk_data_len = htonl(chunk->length);
+    memcpy((void *)(target + offset), (void *)(&(chunk_data_len)), sizeof(U32));
+    offset += sizeof(U32);
+
+    memcpy((void *)(target + offset), chunk->type, CHUNK_TYPE_SIZE * sizeof(U8));
+    offset += CHUNK_TYPE_SIZE * sizeof(U8);
+
+    memcpy((void *)(target + offset), chunk->p_data, chunk->length);
+    offset += chunk->length;
+
+    U32 chunk_crc = htonl(chunk->crc);
+    memcpy((void *)(target + offset), (void *)(&(chunk_crc)), sizeof(U32));
+    offset += sizeof(U32);
+
+    return offset;
+}
+
 /**
  * @brief: Transfers data inside of a chunk to memory, in the format required for a png.
  * @params:
@@ -133,25 +231,13 @@ int fill_png_struct(simple_PNG_p target_png, void* data, unsigned long data_len)
 int chunk_to_data(void **target, unsigned long* size, chunk_p chunk){
     /** Determine size **/
     *size = CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + CHUNK_CRC_SIZE + chunk->length;
-    unsigned int offset = 0;
 
     /** Allocate memory **/
     *target = (void *) malloc(*size);
+    if(*target == NULL) return -1;
 
     /** Copy data over **/
-    U32 chunk_data_len = ntohl(chunk->length);
-    memcpy((void *)(*target + offset), (void *)(&(chunk_data_len)), sizeof(U32));
-    offset += sizeof(U32);
-
-    memcpy((void *)(*target + offset), chunk->type, CHUNK_TYPE_SIZE * sizeof(U8));
-    offset += CHUNK_TYPE_SIZE * sizeof(U8);
-
-    memcpy((void *)(*target + offset), chunk->p_data, chunk->length);
-    offset += chunk->length;
-
-    U32 chunk_crc = ntohl(chunk->crc);
-    memcpy((void *)(*target + offset), (void *)(&(chunk_crc)), sizeof(U32));
-    offset += sizeof(U32);
+    chunk_to_mem(*target, chunk);
 
     return 0;
 }
@@ -162,54 +248,68 @@ int chunk_to_data(void **target, unsigned long* size, chunk_p chunk){
  * data: pointer to a pointer. Data will point to a pointer to where the data is stored. The actual data will be allocated by this function.
  * size: pointer to a size variable. Size will be set to the number of bytes of data pointed to by *data.
  * png_data: pointer to the simple_png struct to take the data from.
- * @note: de-allocating the memory where png_data is stored is up to the user.
+ * @note: de-allocating the memory where png_data is stored is up to the user. To write a file, write_png_to_file does not need the copy.
  * @return:
  * -1: Error in transferring data
  * 0: success in transfering data
  */
 int fill_png_data(void** data, unsigned long* size, simple_PNG_p png_data){
 
-    /** Move chunks to memory **/
-    unsigned long size_IHDR = 0;
-    void *data_IHDR;
-    chunk_to_data(&data_IHDR, &size_IHDR, png_data->p_IHDR);
-
-    unsigned long size_IDAT = 0;
-    void *data_IDAT;
-    chunk_to_data(&data_IDAT, &size_IDAT, png_data->p_IDAT);
-
-    unsigned long size_IEND = 0;
-    void *data_IEND;
-    chunk_to_data(&data_IEND, &size_IEND, png_data->p_IEND);
-
     /** Allocate new memory **/
-
-    *size = PNG_HDR_SIZE + size_IHDR + size_IDAT + size_IEND;
+    unsigned long chunk_fields = CHUNK_LEN_SIZE + CHUNK_TYPE_SIZE + CHUNK_CRC_SIZE;
+    *size = PNG_HDR_SIZE + 3 * chunk_fields + png_data->p_IHDR->length + png_data->p_IDAT->length + png_data->p_IEND->length;
 
     *data = malloc(*size);
+    if(*data == NULL) return -1;
 
-    unsigned int offset = 0;
-
-    /** Copy data over **/
+    /** Copy data over, each chunk straight into place **/
+    unsigned long offset = 0;
 
     memcpy((void *)(*data + offset), (void *)(png_data->png_hdr), PNG_HDR_SIZE);
     offset += PNG_HDR_SIZE;
 
-    memcpy((void *)(*data + offset), data_IHDR, size_IHDR);
-    offset += size_IHDR;
+    offset += chunk_to_mem(*data + offset, png_data->p_IHDR);
+    offset += chunk_to_mem(*data + offset, png_data->p_IDAT);
+    offset += chunk_to_mem(*data + offset, png_data->p_IEND);
 
-    memcpy((void *)(*data + offset), data_IDAT, size_IDAT);
-    offset += size_IDAT;
-
-    memcpy((void *)(*data + offset), data_IEND, size_IEND);
-    offset += size_IEND;
+    return 0;
+}
 
-    /** Clean-up **/
-    free(data_IHDR);
-    free(data_IDAT);
-    free(data_IEND);
+/**
+ * @brief: Writes a simple_png to a file with a single writev: the header, the length, type and CRC fields of each chunk,
+ *         and the chunk data where it already is in memory. Nothing is copied.
+ * @params:
+ * file_path: the file to write, created or truncated
+ * png_data: pointer to the simple_png struct to write. The CRCs are written as they are, they are not recomputed.
+ * @return:
+ * -1: Error in writing to file
+ * 0: success
+ */
+int write_png_to_file(char *file_path, simple_PNG_p png_data){
+    chunk_p chunks[3] = {png_data->p_IHDR, png_data->p_IDAT, png_data->p_IEND};
+    U32 lengths[3]; // Big endian
+    U32 crcs[3]; // Big endian
+    struct iovec iov[1 + 4 * 3];
+    int n = 0;
+
+    iov[n].iov_base = (void *) png_data->png_hdr;
+    iov[n++].iov_len = PNG_HDR_SIZE;
+
+    /** Length, type, data and CRC of each chunk **/
+    for(int i = 0; i < 3; i++){
+        lengths[i] = htonl(chunks[i]->length);
+        crcs[i] = htonl(chunks[i]->crc);
+        iov[n].iov_base = (void *) &(lengths[i]);
+        iov[n++].iov_len = CHUNK_LEN_SIZE;
+        iov[n].iov_base = (void *) chunks[i]->type;
+        iov[n++].iov_len = CHUNK_TYPE_SIZE;
+        iov[n].iov_base = (void *) chunks[i]->p_data;
+        iov[n++].iov_len = chunks[i]->length;
+        iov[n].iov_base = (void *) &(crcs[i]);
+        iov[n++].iov_len = CHUNK_CRC_SIZE;
+    }
 
-    return 0;
+    return write_iov_to_file(iov, n, file_path);
 }
 
 
@@ -398,29 +498,19 @@ int combine_pngs(simple_PNG_p out, simple_PNG_p png1, simple_PNG_p png2){
     /** Initial Setup **/
         /** Find IHDR Data **/
     int fill_IHDR_status = 0;
-    data_IHDR_p png1_IHDR = (data_IHDR_p) malloc(sizeof(struct data_IHDR));
-    data_IHDR_p png2_IHDR = (data_IHDR_p) malloc(sizeof(struct data_IHDR));
+    struct data_IHDR png1_IHDR_data; // Temporaries, on the stack rather than malloced
+    struct data_IHDR png2_IHDR_data;
+    data_IHDR_p png1_IHDR = &png1_IHDR_data;
+    data_IHDR_p png2_IHDR = &png2_IHDR_data;
 
     fill_IHDR_status = fill_IHDR_data(png1_IHDR, png1->p_IHDR);
-    if(fill_IHDR_status != 0){
-        free_data_IHDR(png1_IHDR);
-        free_data_IHDR(png2_IHDR);
-        return -1;
-    }
+    if(fill_IHDR_status != 0) return -1;
 
     fill_IHDR_status = fill_IHDR_data(png2_IHDR, png2->p_IHDR);
-    if(fill_IHDR_status != 0){
-        free_data_IHDR(png1_IHDR);
-        free_data_IHDR(png2_IHDR);
-        return -1;
-    }
+    if(fill_IHDR_status != 0) return -1;
 
         /** Ensure Same Width **/
-    if(png1_IHDR->width != png2_IHDR->width){
-        free_data_IHDR(png1_IHDR);
-        free_data_IHDR(png2_IHDR);
-        return -1;
-    }
+    if(png1_IHDR->width != png2_IHDR->width) return -1;
 
     /** Inflation Section **/
     U32 combined_height = png1_IHDR->height + png2_IHDR->height;
@@ -435,8 +525,6 @@ int combine_pngs(simple_PNG_p out, simple_PNG_p png1, simple_PNG_p png2){
     
     if (ret !=0){
         /** Error in inflating data **/
-        free_data_IHDR(png1_IHDR);
-        free_data_IHDR(png2_IHDR);
         free(catbuf);
         return -1;
     }
@@ -450,8 +538,6 @@ int combine_pngs(simple_PNG_p out, simple_PNG_p png1, simple_PNG_p png2){
     
     if (ret !=0){
         /** Error in inflating data **/
-        free_data_IHDR(png1_IHDR);
-        free_data_IHDR(png2_IHDR);
         free(catbuf);
         return -1;
     }
@@ -463,8 +549,6 @@ int combine_pngs(simple_PNG_p out, simple_PNG_p png1, simple_PNG_p png2){
     ret = mem_def(defbuf, &len_inf, catbuf, data_size, Z_DEFAULT_COMPRESSION);
     if (ret !=0){
         /** Error in deflating data **/
-        free_data_IHDR(png1_IHDR);
-        free_data_IHDR(png2_IHDR);
         free(catbuf);
         free(defbuf);
         return -1;
@@ -491,8 +575,6 @@ int combine_pngs(simple_PNG_p out, simple_PNG_p png1, simple_PNG_p png2){
 
 
     /** Cleanup **/
-    free_data_IHDR(png1_IHDR);
-    free_data_IHDR(png2_IHDR);
     free(catbuf);
         //Note: don't deallocate defbuf since it is used in the out png.
 
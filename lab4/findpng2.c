@@ -19,7 +19,11 @@
 
 //Included Utility Code
 #include "./utils/linkedList.c"
+#include "./utils/frontier.c"
 #include "./utils/cURL/curl_xml_fns.c"
+#include "./utils/cURL/curl_share.c"
+#include "./utils/bloom_filter.c"
+#include "./utils/log_buffer.c"
 
 #define SEED_URL "http://ece252-1.uwaterloo.ca/lab4/"
 #define ECE252_HEADER "X-Ece252-Fragment: "
@@ -40,18 +44,18 @@
  * Data Type For Input Parameters into the Thread Function
  */
 typedef struct web_crawler_input {
-    Node_t **png_urls; // The urls of valid PNGs.
-    Node_t **to_visit; // A list (stack) of the next URLs to Visit.
-    Node_t **log; // A log of every URL visited in order
+    log_buffer_t *png_urls; // This thread's urls of valid PNGs (no lock, merged at exit)
+    frontier_t *to_visit; // Work-stealing frontier of the next URLs to Visit (one deque per thread).
+    log_buffer_t *log; // This thread's log of every URL it visited (no lock, merged at exit)
+    unsigned long *log_seq; // Visit order shared by every thread's png_urls and log. Atomic.
     struct hsearch_data *visited_urls; // Hash Table for all URLs
-    int *numpicture; // Total Number of Pictures Left to Acquire
-    int *num_waiting; // The number of threads currently waiting for a URL to process
-    pthread_cond_t *to_visit_threshold_cv; // Conditional Variable for Signalling
-    pthread_mutex_t *to_visit_m; // Access Control for to_visit
-    pthread_mutex_t *png_urls_m; // Access Control for png_urls
-    pthread_mutex_t *log_m; // Access Control for log
+    bloom_filter_t *seen_filter; // Bloom filter of the URLs in visited_urls, tested without the lock first
+    int *numpicture; // Total Number of Pictures Left to Acquire. Atomic.
     pthread_rwlock_t *hashtable_m; // Access Control for hashtable of all urls.
-    int total_threads;
+    curl_share_data_t *share; // DNS cache, connection cache and cookies shared by every thread's easy handle
+    long *num_pages; // Number of transfers performed (all threads). Atomic.
+    long *num_connects; // Number of new connections opened (all threads). Atomic.
+    int thread_id; // Index of this thread's deque in the frontier
 } web_crawler_input_t;
 
 /**
@@ -63,7 +67,7 @@ void *web_crawler(void *arg);
  * @brief: Function To Retrieve the information from the specified URL. Thread-safe
  * See more below.
  */
-int fetch_information(Node_t **to_visit, Node_t** png_urls, char* url);
+int fetch_information(CURL **curl_handle, RECV_BUF *recv_buf, curl_share_data_t *share, Node_t **to_visit, Node_t** png_urls, char* url, long *num_connects);
 
 /**
  * Main Function to create and run the functions
@@ -88,13 +92,17 @@ int main(int argc, char *argv[]) {
 
     int numpicture = DEFAULT_PNG_NUM;
 
+    double bloom_fp_rate = BLOOM_DEFAULT_FP_RATE;
+
+    int log_order = LOG_ORDER_VISIT;
+
     char* logfile = (char *) malloc(DEFAULT_STRING_SZ * sizeof(char));
     strcpy(logfile, DEFAULT_LOG_FILE);
 
 
         // Fill Inputs
 	int c;
-    while ((c = getopt (argc, argv, "t:m:v:")) != -1) {
+    while ((c = getopt (argc, argv, "t:m:v:p:h:b:c:l:")) != -1) {
         switch (c) {
         case 't':
             numthreads = strtoul(optarg, NULL, 10);
@@ -113,21 +121,65 @@ int main(int argc, char *argv[]) {
         case 'v':
             strcpy(logfile, optarg);
             break;
+        case 'p':
+            if (strcmp(optarg, "stream") == 0) {
+                href_parser = HREF_PARSER_STREAM;
+            } else if (strcmp(optarg, "xml") == 0) {
+                href_parser = HREF_PARSER_XML;
+            } else {
+                perror("href parser must be xml or stream -- 'p'\n");
+                return -1;
+            }
+            break;
+        case 'h':
+            http_mode = http_mode_from_name(optarg);
+            if (http_mode < 0) {
+                perror("HTTP version must be 1.1, 2 or h2c -- 'h'\n");
+                return -1;
+            }
+            break;
+        case 'b':
+            bloom_fp_rate = strtod(optarg, NULL);
+            if (bloom_fp_rate <= 0.0 || bloom_fp_rate >= 1.0) {
+                perror("bloom filter false positive rate must be between 0 and 1 -- 'b'\n");
+                return -1;
+            }
+            break;
+        case 'c':
+            if (strcmp(optarg, "canonical") == 0) {
+                url_canonical = 1;
+            } else if (strcmp(optarg, "raw") == 0) {
+                url_canonical = 0;
+            } else {
+                perror("url form must be canonical or raw -- 'c'\n");
+                return -1;
+            }
+            break;
+        case 'l':
+            if (strcmp(optarg, "visit") == 0) {
+                log_order = LOG_ORDER_VISIT;
+            } else if (strcmp(optarg, "thread") == 0) {
+                log_order = LOG_ORDER_THREAD;
+            } else {
+                perror("log order must be visit or thread -- 'l'\n");
+                return -1;
+            }
+            break;
         default:
-            perror("Usage example: ./findpng2 -t 10 -m 50 -v log.txt\n");
+            perror("Usage example: ./findpng2 -t 10 -m 50 -v log.txt -p stream -h 2 -b 0.01 -c canonical -l visit\n");
             free(logfile);
             free(seed_url);
             return -1;
         }
     }
 
+        // Same form as the links found on pages, so the seed dedups with them
+    seed_url = url_canonicalize(seed_url);
+
         // Semaphores, Mutexes, and Thread Control
-    pthread_cond_t to_visit_threshold_cv; // Conditional Variable for Signalling
-    pthread_mutex_t to_visit_m; // Access Control for to_visit
-    pthread_mutex_t png_urls_m; // Access Control for png_urls
-    pthread_mutex_t log_m; // Access Control for log
     pthread_rwlock_t hashtable_m; // Access Control for hashtable of all urls.
-    if (pthread_cond_init(&to_visit_threshold_cv, NULL) != 0 || pthread_mutex_init(&to_visit_m, NULL) != 0 || pthread_mutex_init(&png_urls_m, NULL) != 0 || pthread_mutex_init(&log_m, NULL) != 0 || pthread_rwlock_init(&hashtable_m, NULL) != 0) {
+    frontier_t to_visit; // Work-stealing frontier of the next URLs to Visit. After pop need to ensure the URL has not been checked before (but also check before putting in to save memory)
+    if (frontier_init(&to_visit, numthreads) != 0 || pthread_rwlock_init(&hashtable_m, NULL) != 0) {
         perror("sem_init(sem)\n");
         free(logfile);
         free(seed_url);
@@ -135,9 +187,11 @@ int main(int argc, char *argv[]) {
     }
 
         // Program Variables
-    Node_t *png_urls = NULL; // The resulting png urls (of valid PNGs)
-    Node_t *to_visit = NULL; // A list (stack) of the next URLs to Visit. After pop need to ensure the URL has not been checked before (but also check before putting in to save memory)
-    Node_t *log = NULL; // A log of every URL visited in order
+    log_buffer_t png_urls[numthreads]; // The resulting png urls (of valid PNGs), one buffer per thread
+    log_buffer_t log[numthreads]; // A log of every URL visited, one buffer per thread
+    memset(png_urls, 0, sizeof(png_urls));
+    memset(log, 0, sizeof(log));
+    unsigned long log_seq = 0; // Next position in the visit order
     struct hsearch_data *visited_urls = calloc(1, sizeof(struct hsearch_data));
     if(hcreate_r(MAX_HTABLE_SZ, visited_urls) == 0){
         perror("Error: insufficient space to create hashtable\n");
@@ -146,35 +200,55 @@ int main(int argc, char *argv[]) {
         free(visited_urls);
         return -1;
     }
+        // Sized for a full hash table: no more URLs than that can be visited
+    bloom_filter_t seen_filter;
+    if(bloom_init(&seen_filter, MAX_HTABLE_SZ, bloom_fp_rate) != 0){
+        free(logfile);
+        free(seed_url);
+        hdestroy_r(visited_urls);
+        free(visited_urls);
+        return -1;
+    }
+
+    curl_share_data_t share; // Shared DNS, connections and cookies
+    long num_pages = 0; // Transfers performed
+    long num_connects = 0; // New connections opened
 
-    int num_waiting = 0; // Track the number of threads waiting for a URL to process
-
-    web_crawler_input_t crawler_params;
-    crawler_params.png_urls = &png_urls;
-    crawler_params.to_visit = &to_visit;
-    crawler_params.log = &log;
-    crawler_params.visited_urls = visited_urls;
-    crawler_params.numpicture = &numpicture;
-    crawler_params.num_waiting = &num_waiting;
-    crawler_params.to_visit_threshold_cv = &to_visit_threshold_cv;
-    crawler_params.to_visit_m = &to_visit_m;
-    crawler_params.png_urls_m = &png_urls_m;
-    crawler_params.log_m = &log_m;
-    crawler_params.hashtable_m = &hashtable_m;
-    crawler_params.total_threads = numthreads;
+    web_crawler_input_t crawler_params[numthreads];
+    for(int i=0; i<numthreads; i++){
+        crawler_params[i].png_urls = png_urls + i;
+        crawler_params[i].to_visit = &to_visit;
+        crawler_params[i].log = log + i;
+        crawler_params[i].log_seq = &log_seq;
+        crawler_params[i].visited_urls = visited_urls;
+        crawler_params[i].seen_filter = &seen_filter;
+        crawler_params[i].numpicture = &numpicture;
+        crawler_params[i].hashtable_m = &hashtable_m;
+        crawler_params[i].share = &share;
+        crawler_params[i].num_pages = &num_pages;
+        crawler_params[i].num_connects = &num_connects;
+        crawler_params[i].thread_id = i;
+    }
 
     pthread_t pthread_ids[numthreads];
 
     /** @main_section: Start Main Part of the Program **/
 
         // Push Initial Seed URL
-    push(&to_visit, seed_url);
+    Node_t *seed = NULL;
+    push(&seed, seed_url);
+    frontier_push_batch(&to_visit, 0, &seed);
 
-        // Initialize cURL
+        // Initialize cURL and libxml2 (once, before any thread parses)
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    xmlInitParser();
+    if(share_handle_init(&share, numthreads) != 0){
+        perror("Error: could not create cURL share handle\n");
+        return -1;
+    }
         // Create Threads
     for(int i=0; i<numthreads; i++){
-        pthread_create(pthread_ids + i, NULL, web_crawler, (void *)(&crawler_params));
+        pthread_create(pthread_ids + i, NULL, web_crawler, (void *)(crawler_params + i));
     }
 
         // Join Threads
@@ -185,32 +259,41 @@ int main(int argc, char *argv[]) {
     /** @output_section: Output Timing Result **/
 
         // Output to logfile if applicable
-    if(strcmp(logfile, DEFAULT_LOG_FILE) != 0) linkedlist_to_file(log, logfile);
+    if(strcmp(logfile, DEFAULT_LOG_FILE) != 0) log_buffers_write(log, numthreads, logfile, log_order);
 
         // Output valid PNG urls to file
-    linkedlist_to_file(png_urls, OUTPUT_FILE);
+    log_buffers_write(png_urls, numthreads, OUTPUT_FILE, log_order);
 
         // Print Timing
     gettimeofday(&program_end, NULL);
-    printf("findpng2 execution time: %.6lf seconds\n", (double)((double)(program_end.tv_sec - program_start.tv_sec) + (((double)(program_end.tv_usec - program_start.tv_usec)) / 1000000.0)));
+    double run_time = (double)((double)(program_end.tv_sec - program_start.tv_sec) + (((double)(program_end.tv_usec - program_start.tv_usec)) / 1000000.0));
+        // Print Crawl Statistics (stderr so the timing stays the last line of stdout)
+    fprintf(stderr, "findpng2 connections: %ld connects / %ld pages = %.3lf connects per page (HTTP %s)\n", num_connects, num_pages, num_pages > 0 ? (double)num_connects / (double)num_pages : 0.0, http_mode_name(http_mode));
+    fprintf(stderr, "findpng2 throughput: %.1lf pages per second (%s href parser)\n", run_time > 0 ? (double)num_pages / run_time : 0.0, href_parser == HREF_PARSER_STREAM ? "stream" : "xml");
+    fprintf(stderr, "findpng2 memory: peak RSS %ld KB, %ld receive buffer mallocs / %ld pages = %.3lf allocations per page (%ld pool requests)\n", peak_rss_kb(), buf_pool_stats.mallocs, num_pages, num_pages > 0 ? (double)buf_pool_stats.mallocs / (double)num_pages : 0.0, buf_pool_stats.requests);
+    fprintf(stderr, "findpng2 bloom filter: %ld lookups, %ld definitely new (%.1lf%% skipped the hashtable lock), %ld false positives (%.1lf bits per key, %d hashes per key, %lu blocks)\n", seen_filter.lookups, seen_filter.definitely_new, seen_filter.lookups > 0 ? 100.0 * (double)seen_filter.definitely_new / (double)seen_filter.lookups : 0.0, seen_filter.false_positives, bloom_bits_per_key(&seen_filter), seen_filter.num_hashes, (unsigned long)seen_filter.num_blocks);
+    fprintf(stderr, "findpng2 urls: %ld links rewritten to canonical form (%s urls)\n", url_canon_rewritten, url_canonical ? "canonical" : "raw");
+    printf("findpng2 execution time: %.6lf seconds\n", run_time);
 
     /** @final_section: Cleanup **/
 
         //Destroy Semaphores and mutexes
-    pthread_cond_destroy(&to_visit_threshold_cv);
-    pthread_mutex_destroy(&to_visit_m);
-    pthread_mutex_destroy(&png_urls_m);
-    pthread_mutex_destroy(&log_m);
+    frontier_destroy(&to_visit);
     pthread_rwlock_destroy(&hashtable_m);
 
         //Free Memory
     hdestroy_r(visited_urls);
     free(visited_urls);
+    bloom_destroy(&seen_filter);
     free(logfile);
-    freeMemory(png_urls);
-    freeMemory(to_visit);
-    freeMemory(log);
+    for(int i=0; i<numthreads; i++){
+        log_buffer_free(png_urls + i);
+        log_buffer_free(log + i);
+    }
 
+    share_handle_cleanup(&share);
+    buf_pool_destroy();
+    xmlCleanupParser();
     curl_global_cleanup();
 
     return 0;
@@ -232,126 +315,125 @@ void *web_crawler(void *arg){
     int visited = 0;
     Node_t *png_urls = NULL;
     Node_t *to_visit = NULL;
+    Node_t *new_urls = NULL; // URLs found on the page that are not in the hashtable yet
     int inserted = 0;
+    CURL *curl_handle = NULL; // This thread's easy handle, reused for every URL
+    RECV_BUF recv_buf; // This thread's receive buffer, reused for every URL
+    long connects = 0;
 
 
     while(findMorePNGs){
-        /** @critical_section: Waiting For A URL, otherwise take a URL **/
-        pthread_mutex_lock(input_data->to_visit_m);
-            // If no URLs available, wait for one
-        if((*(input_data->to_visit)) == NULL){
-            (*(input_data->num_waiting))++;
-            if(*(input_data->num_waiting) < input_data->total_threads){
-                pthread_cond_wait(input_data->to_visit_threshold_cv, input_data->to_visit_m);
-            }
-            if(*(input_data->num_waiting) == input_data->total_threads && (*(input_data->to_visit)) == NULL){
-                pthread_cond_broadcast(input_data->to_visit_threshold_cv);
-                findMorePNGs = 0;
-                pthread_mutex_unlock(input_data->to_visit_m);
-                continue;
-            }
-            (*(input_data->num_waiting))--;
+        /** Take a URL from this thread's deque (or steal one), NULL once there is no work left anywhere **/
+        url = frontier_pop(input_data->to_visit, input_data->thread_id);
+        if(url == NULL){
+            findMorePNGs = 0;
+            continue;
         }
-        url = pop(input_data->to_visit);
-        pthread_mutex_unlock(input_data->to_visit_m);
-        /** @end_critical_section: **/
 
-        if(url != NULL){
-            url_entry.key = url;
+        url_entry.key = url;
 
-            /** @critical_section: see if the url is in the hashtable **/
-            pthread_rwlock_wrlock(input_data->hashtable_m);
-            hsearch_r(url_entry, FIND, &ret_entry, input_data->visited_urls);
+        /** @critical_section: see if the url is in the hashtable **/
+        pthread_rwlock_wrlock(input_data->hashtable_m);
+        hsearch_r(url_entry, FIND, &ret_entry, input_data->visited_urls);
+        if(ret_entry == NULL){
+            hsearch_r(url_entry, ENTER, &ret_entry, input_data->visited_urls);
+            visited = 1;
             if(ret_entry == NULL){
-                hsearch_r(url_entry, ENTER, &ret_entry, input_data->visited_urls);
-                visited = 1;
-                if(ret_entry == NULL){
-                    perror("Error: Hashtable is full\n");
-                    pthread_rwlock_unlock(input_data->hashtable_m);
-                    free(url);
-                    abort();
-                }
+                perror("Error: Hashtable is full\n");
+                pthread_rwlock_unlock(input_data->hashtable_m);
+                free(url);
+                abort();
             }
-            pthread_rwlock_unlock(input_data->hashtable_m);
-            /** @end_critical_section: **/
+            bloom_add(input_data->seen_filter, url);
         }
+        pthread_rwlock_unlock(input_data->hashtable_m);
+        /** @end_critical_section: **/
 
         // Perform Request if URL has not been visited
         if(visited){
-            /** @critical_section: insert into log **/
-            pthread_mutex_lock(input_data->log_m);
-            push(input_data->log, url);
-            pthread_mutex_unlock(input_data->log_m);
-            /** @end_critical_section: **/
+            // Own buffer, no lock. The log takes url (it is also the hashtable's key, so it lives until exit)
+            log_buffer_append(input_data->log, input_data->log_seq, url);
 
             //Perform cURL Request and Retrieve Data
-            if(fetch_information(&to_visit, &png_urls, url) == 0){
+            int fetch_status = fetch_information(&curl_handle, &recv_buf, input_data->share, &to_visit, &png_urls, url, &connects);
+            if(curl_handle != NULL){
+                __atomic_add_fetch(input_data->num_pages, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(input_data->num_connects, connects, __ATOMIC_RELAXED);
+            }
+            if(fetch_status == 0){
                 if(png_urls != NULL){
                     while(png_urls != NULL){
                         inserted = 0;
                         // Make Copy of String
                         url_cpy = pop(&png_urls);
-                        /** @critical_section: insert into png_urls **/
-                        pthread_mutex_lock(input_data->png_urls_m);
-                        if(*(input_data->numpicture) > 0){
+                        // Claim one of the pictures left: exactly numpicture claims succeed, no lock
+                        int left = __atomic_sub_fetch(input_data->numpicture, 1, __ATOMIC_RELAXED);
+                        if(left >= 0 && log_buffer_append(input_data->png_urls, input_data->log_seq, url_cpy) == 0){
                             inserted = 1;
-                            (*(input_data->numpicture))--;
-                            push(input_data->png_urls, url_cpy);
                         }
-                        if(*(input_data->numpicture) <= 0){
+                        if(left <= 0){
                             findMorePNGs = 0;
+                            cancel_transfers(); // Other threads drop their fetch instead of finishing it
                             freeMemory(png_urls);
                             png_urls = NULL;
                         }
-                        pthread_mutex_unlock(input_data->png_urls_m);
-                        /** @end_critical_section: **/
 
                         if(inserted == 0) free(url_cpy);
                     }
                 }else if(to_visit != NULL){
-                    /** @critical_section: add URLs to visit (after checking if already searched) **/
-                    pthread_rwlock_rdlock(input_data->hashtable_m); // only a read lock since just reading
+                    // URLs the Bloom filter has never seen are new without asking the hashtable (no lock).
+                    // Only the "maybe seen" ones are looked up, and the lock is only taken if there are any.
+                    // A URL added to the hashtable meanwhile is still caught when it is popped.
+                    int locked = 0;
                     while(to_visit != NULL){
                         url_entry.key = pop(&to_visit);
+                        if(url_entry.key == NULL) continue;
+                        if(!bloom_maybe_contains(input_data->seen_filter, url_entry.key)){
+                            push(&new_urls, url_entry.key);
+                            continue;
+                        }
+                        /** @critical_section: filter out URLs already searched **/
+                        if(!locked){
+                            pthread_rwlock_rdlock(input_data->hashtable_m); // only a read lock since just reading
+                            locked = 1;
+                        }
                         hsearch_r(url_entry, FIND, &ret_entry, input_data->visited_urls);
-                        if(ret_entry == NULL && url_entry.key != NULL){
-                            /** @critical_section: inner critical section for pushing to the linked list and signalling push **/
-                            pthread_mutex_lock(input_data->to_visit_m);
-                            push(input_data->to_visit, url_entry.key);
-                            pthread_cond_signal(input_data->to_visit_threshold_cv);
-                            pthread_mutex_unlock(input_data->to_visit_m);
-                            /** @end_critical_section: **/
+                        if(ret_entry == NULL){
+                            bloom_false_positive(input_data->seen_filter);
+                            push(&new_urls, url_entry.key);
                         }else{
                             free(url_entry.key);
                         }
                     }
-                    pthread_rwlock_unlock(input_data->hashtable_m);
+                    if(locked) pthread_rwlock_unlock(input_data->hashtable_m);
                     /** @end_critical_section: **/
+
+                    // Push every new URL from the page at once (wakes idle threads so they can steal)
+                    frontier_push_batch(input_data->to_visit, input_data->thread_id, &new_urls);
                 }
             }
         }else{
             free(url);
         }
 
+        // Done with this URL. Its links are already in the frontier, so pending cannot hit 0 early.
+        frontier_task_done(input_data->to_visit);
+
         if(findMorePNGs){
-            /** @critical_section: check to see if end condition met **/
-            pthread_mutex_lock(input_data->png_urls_m);
-            if(*(input_data->numpicture) <= 0){
+            // Check to see if end condition met
+            if(__atomic_load_n(input_data->numpicture, __ATOMIC_RELAXED) <= 0){
                 findMorePNGs = 0;
             }
-            pthread_mutex_unlock(input_data->png_urls_m);
-            /** @end_critical_section: **/
         }
 
         visited = 0;
     }
 
-    /** @critical_section: Ensure Other Threads Exit If PNG Limit Reached **/
-    pthread_mutex_lock(input_data->to_visit_m);
-    (*(input_data->num_waiting)) = input_data->total_threads;
-    pthread_cond_broadcast(input_data->to_visit_threshold_cv);
-    pthread_mutex_unlock(input_data->to_visit_m);
-    /** @end_critical_section: **/
+    /** Ensure Other Threads Exit If PNG Limit Reached **/
+    frontier_stop(input_data->to_visit);
+
+    if(curl_handle != NULL) cleanup(curl_handle, &recv_buf);
+    buf_pool_thread_flush();
 
     return NULL;
 }
@@ -359,45 +441,49 @@ void *web_crawler(void *arg){
 /**
  * @brief: Function To Retrieve the information from the specified URL. Thread-safe
  * @params:
+ * curl_handle: pointer to the calling thread's easy handle. If it points to NULL, a handle is created (attached to the share handle) and kept for the next call.
+ * recv_buf: the calling thread's receive buffer, owned by the easy handle. Cleaned up with the handle by the caller.
+ * share: share handle for DNS, connections and cookies. Attached to newly created handles.
  * to_visit: pointer to an empty linked list. Use push function to add urls to visit into the list.
  * png_urls: pointer to an empty linked list. Use push function to add png urls into the list.
  * url: pointer to a url. Perform cURL on this url.
+ * num_connects: set to the number of new connections the transfer had to open (0 when a cached connection was reused).
  * @return:
  * 0: success
  * 1: error
  * @note: for the linked lists, declare the data values on the heap. Will be deallocated by caller.
  * @note: if to_visit or png_urls are empty, they should be left as passed in. Only call push when adding a value.
  */
-int fetch_information(Node_t **to_visit, Node_t** png_urls, char* url){
-    CURL *curl_handle;
+int fetch_information(CURL **curl_handle, RECV_BUF *recv_buf, curl_share_data_t *share, Node_t **to_visit, Node_t** png_urls, char* url, long *num_connects){
     CURLcode res;
-    RECV_BUF recv_buf;
-    curl_handle = easy_handle_init(&recv_buf, url);
+    *num_connects = 0;
 
-    if ( curl_handle == NULL ) {
-        //fprintf(stderr, "Curl initialization failed. Exiting...\n");
-        curl_global_cleanup();
+    if ( *curl_handle == NULL ) {
+        *curl_handle = easy_handle_init(recv_buf, url);
+        if ( *curl_handle == NULL ) {
+            //fprintf(stderr, "Curl initialization failed. Exiting...\n");
+            return 1;
+        }
+        share_handle_attach(*curl_handle, share);
+    } else if ( easy_handle_reuse(*curl_handle, recv_buf, url) != 0 ) {
         return 1;
     }
     /* get it! */
-    res = curl_easy_perform(curl_handle);
+    res = curl_easy_perform(*curl_handle);
+    curl_easy_getinfo(*curl_handle, CURLINFO_NUM_CONNECTS, num_connects);
 
-    if( res != CURLE_OK) {
+    if( !recv_buf_complete(res, recv_buf) ) {
         //fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-        cleanup(curl_handle, &recv_buf);
         return 1;
     } else {
         //For Logging and Debugging if needed
-        //printf("%lu bytes received in memory %p, seq=%d.\n", recv_buf.size, recv_buf.buf, recv_buf.seq);
+        //printf("%lu bytes received in memory %p, seq=%d.\n", recv_buf->size, recv_buf->buf, recv_buf->seq);
     }
 
     /* process the download data */
-    if (process_data(curl_handle, &recv_buf, to_visit, png_urls) != 0){
-        cleanup(curl_handle, &recv_buf);
+    if (process_data(*curl_handle, recv_buf, to_visit, png_urls) != 0){
         return 1;
     }
 
-    /* cleaning up */
-    cleanup(curl_handle, &recv_buf);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,234 @@
+/**
+ * @brief: Lock-free blocked Bloom filter over strings, used in front of the visited-URL hash table.
+ *         Each key sets (and tests) its bits inside a single 64 byte block, so a lookup touches one cache line.
+ *         Blocking costs some accuracy, so the filter is sized with the blocked false positive rate, not the plain one.
+ *         Bits are only ever set, with atomic ORs, so any number of threads can add and test at once without a lock.
+ *         A "no" is exact (the key was never added), a "maybe" still has to be checked against the exact set.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#pragma once
+
+#define BLOOM_BLOCK_WORDS 8 // 64 bit words per block (one 64 byte cache line)
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_MAX_HASHES 16 // Bits set per key, at most
+#define BLOOM_BIT_INDEX_BITS 9 // Hash bits per bit position (log2 of BLOOM_BLOCK_BITS)
+#define BLOOM_BITS_PER_HASH (64 / BLOOM_BIT_INDEX_BITS) // Bit positions taken from one 64 bit hash
+#define BLOOM_DEFAULT_FP_RATE 0.01 // False positive rate when nothing else is asked for
+
+typedef struct bloom_filter {
+    uint64_t *blocks; // num_blocks * BLOOM_BLOCK_WORDS words, 64 byte aligned. Atomic.
+    uint64_t num_blocks; // Number of blocks
+    int num_hashes; // Bits set per key
+    size_t expected_items; // Keys the filter was sized for
+    double fp_rate; // False positive rate it was sized for
+    long lookups; // Calls to bloom_maybe_contains. Atomic.
+    long definitely_new; // Lookups answered "never added". Atomic.
+    long false_positives; // "Maybe" answers the exact set then disproved (reported by the caller). Atomic.
+} bloom_filter_t;
+
+/**
+ * @brief: 64 bit hash of a string (FNV-1a, then a finalizer so every bit depends on every byte).
+ */
+uint64_t bloom_hash(const char *key){
+    uint64_t hash = 14695981039346656037ull;
+    for(const unsigned char *p = (const unsigned char *) key; *p != '\0'; p++){
+        hash = (hash ^ *p) * 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * @brief: Mixes a hash again (splitmix64 step), for bit positions that do not depend on the block or on each other.
+ */
+uint64_t bloom_rehash(uint64_t hash){
+    hash += 0x9e3779b97f4a7c15ull;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * @brief: Finds a key's block. It comes from the top 32 bits of the hash (scaled to num_blocks rather than taken modulo it).
+ * @params:
+ * hash: out, the key's hash, to draw its bit positions from with bloom_next_bit
+ */
+uint64_t *bloom_locate(bloom_filter_t *bf, const char *key, uint64_t *hash_out){
+    uint64_t hash = bloom_hash(key);
+    *hash_out = hash;
+    return bf->blocks + (((hash >> 32) * bf->num_blocks) >> 32) * BLOOM_BLOCK_WORDS;
+}
+
+/**
+ * @brief: The i-th bit position of a key in its block. Positions are 9 bit slices of re-mixed hashes, a fresh one
+ *         every BLOOM_BITS_PER_HASH positions, so they are independent of the block and of each other
+ *         (double hashing inside a 512 bit block only makes about 2^17 different patterns, too few for low rates).
+ * @params:
+ * hash: from bloom_locate
+ * bits: the positions not used yet, updated
+ * i: the position wanted, called for 0, 1, 2... in order
+ */
+uint32_t bloom_next_bit(uint64_t hash, uint64_t *bits, int i){
+    if(i % BLOOM_BITS_PER_HASH == 0) *bits = bloom_rehash(hash + i); // splitmix64 outputs for different inputs are unrelated
+    uint32_t bit = (uint32_t) (*bits % BLOOM_BLOCK_BITS);
+    *bits >>= BLOOM_BIT_INDEX_BITS;
+    return bit;
+}
+
+/**
+ * @brief: Expected false positive rate of a blocked filter. Unlike the plain formula it counts the blocks that get
+ *         more than their share of keys: keys per block are Poisson distributed, and a crowded block answers "maybe" far
+ *         more often than an average one.
+ * @params:
+ * keys_per_block: expected_items / num_blocks
+ * num_hashes: bits set per key
+ */
+double bloom_blocked_fp_rate(double keys_per_block, int num_hashes){
+    double spread = 12.0 * sqrt(keys_per_block) + 20.0; // The Poisson terms past this are negligible
+    long first = (keys_per_block > spread) ? (long) (keys_per_block - spread) : 0;
+    long last = (long) (keys_per_block + spread);
+    double rate = 0.0;
+    for(long j = first; j <= last; j++){
+        double weight = exp(-keys_per_block + j * log(keys_per_block) - lgamma(j + 1.0)); // P(j keys in the block)
+        double bit_set = 1.0 - pow(1.0 - 1.0 / BLOOM_BLOCK_BITS, (double) num_hashes * j);
+        rate += weight * pow(bit_set, num_hashes);
+    }
+    return rate;
+}
+
+/**
+ * @brief: Sizes and allocates an empty filter.
+ * @params:
+ * bf: pointer to an allocated struct. Will be filled by the function.
+ * expected_items: number of keys the filter should hold at the given false positive rate
+ * fp_rate: wanted false positive rate, between 0 and 1 (exclusive)
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int bloom_init(bloom_filter_t *bf, size_t expected_items, double fp_rate){
+    if(expected_items < 1) expected_items = 1;
+    if(fp_rate <= 0.0 || fp_rate >= 1.0) fp_rate = BLOOM_DEFAULT_FP_RATE;
+    bf->expected_items = expected_items;
+    bf->fp_rate = fp_rate;
+
+        // Start from the unblocked optimum m = -n ln(p) / ln(2)^2 bits, then grow it until the blocked filter
+        // (with its best k) reaches the rate, which takes roughly 10-25% more bits
+    double bits = -(double) expected_items * log(fp_rate) / (M_LN2 * M_LN2);
+    bf->num_blocks = (uint64_t) ceil(bits / BLOOM_BLOCK_BITS);
+    if(bf->num_blocks < 1) bf->num_blocks = 1;
+    while(1){
+        double keys_per_block = (double) expected_items / (double) bf->num_blocks;
+        double best_rate = 2.0;
+        for(int k = 1; k <= BLOOM_MAX_HASHES; k++){
+            double rate = bloom_blocked_fp_rate(keys_per_block, k);
+            if(rate < best_rate){
+                best_rate = rate;
+                bf->num_hashes = k;
+            }
+        }
+        if(best_rate <= fp_rate) break;
+        bf->num_blocks += bf->num_blocks / 32 + 1;
+    }
+
+    bf->blocks = aligned_alloc(64, bf->num_blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    if(bf->blocks == NULL){
+        perror("aligned_alloc");
+        return -1;
+    }
+    for(uint64_t i = 0; i < bf->num_blocks * BLOOM_BLOCK_WORDS; i++) bf->blocks[i] = 0;
+
+    bf->lookups = 0;
+    bf->definitely_new = 0;
+    bf->false_positives = 0;
+    return 0;
+}
+
+/**
+ * @return: bits of filter per key it was sized for (m / n)
+ */
+double bloom_bits_per_key(bloom_filter_t *bf){
+    return (double) bf->num_blocks * BLOOM_BLOCK_BITS / (double) bf->expected_items;
+}
+
+/**
+ * @brief: Adds a key. Thread-safe, lock-free.
+ */
+void bloom_add(bloom_filter_t *bf, const char *key){
+    uint64_t hash, bits = 0;
+    uint64_t *block = bloom_locate(bf, key, &hash);
+
+    for(int i = 0; i < bf->num_hashes; i++){
+        uint32_t bit = bloom_next_bit(hash, &bits, i);
+        __atomic_fetch_or(block + bit / 64, 1ull << (bit % 64), __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief: Tests a key. Thread-safe, lock-free.
+ * @return:
+ * 0: the key was never added (definitely new)
+ * 1: the key was probably added (check the exact set)
+ */
+int bloom_maybe_contains(bloom_filter_t *bf, const char *key){
+    uint64_t hash, bits = 0;
+    uint64_t *block = bloom_locate(bf, key, &hash);
+
+    __atomic_add_fetch(&(bf->lookups), 1, __ATOMIC_RELAXED);
+    for(int i = 0; i < bf->num_hashes; i++){
+        uint32_t bit = bloom_next_bit(hash, &bits, i);
+        if((__atomic_load_n(block + bit / 64, __ATOMIC_RELAXED) & (1ull << (bit % 64))) == 0){
+            __atomic_add_fetch(&(bf->definitely_new), 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief: Records that a "maybe" from bloom_maybe_contains was not in the exact set. Thread-safe.
+ */
+void bloom_false_positive(bloom_filter_t *bf){
+    __atomic_add_fetch(&(bf->false_positives), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief: Frees the filter's bits.
+ */
+void bloom_destroy(bloom_filter_t *bf){
+    free(bf->blocks);
+    bf->blocks = NULL;
+}
+
+/**
+ * @brief: Replaces the filter with an empty one sized for more keys, at the same false positive rate.
+ *         The caller adds its keys again. Not thread-safe: nothing else may use the filter meanwhile.
+ *         The lookup counters carry over.
+ * @params:
+ * bf: filter from bloom_init
+ * expected_items: number of keys the new filter should hold
+ * @return:
+ * -1: Error (the old filter is left as it was)
+ * 0: Success
+ */
+int bloom_resize(bloom_filter_t *bf, size_t expected_items){
+    bloom_filter_t grown;
+    if(bloom_init(&grown, expected_items, bf->fp_rate) != 0) return -1;
+
+    grown.lookups = bf->lookups;
+    grown.definitely_new = bf->definitely_new;
+    grown.false_positives = bf->false_positives;
+    bloom_destroy(bf);
+    *bf = grown;
+    return 0;
+}
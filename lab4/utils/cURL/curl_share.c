@@ -0,0 +1,94 @@
+/**
+ * @brief: cURL share object so that every crawler thread uses the same DNS cache, connection cache and cookies.
+ * @see https://curl.se/libcurl/c/libcurl-share.html
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+#pragma once
+
+/**
+ * Share handle together with one mutex per type of shared data.
+ */
+typedef struct curl_share_data {
+    CURLSH *share; // Share handle to attach to every easy handle with CURLOPT_SHARE
+    long max_connects; // Size of the shared connection cache
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST]; // Access Control for each curl_lock_data type
+} curl_share_data_t;
+
+/**
+ * @brief: Lock callback for the share handle. Called by libcurl before touching shared data.
+ */
+void share_lock_cb(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr){
+    curl_share_data_t *share_data = (curl_share_data_t *) userptr;
+    pthread_mutex_lock(&(share_data->locks[data]));
+}
+
+/**
+ * @brief: Unlock callback for the share handle. Called by libcurl after touching shared data.
+ */
+void share_unlock_cb(CURL *handle, curl_lock_data data, void *userptr){
+    curl_share_data_t *share_data = (curl_share_data_t *) userptr;
+    pthread_mutex_unlock(&(share_data->locks[data]));
+}
+
+/**
+ * @brief: Creates a share handle for DNS, connections and cookies.
+ * @params:
+ * share_data: pointer to an allocated struct. Will be filled by the function.
+ * max_connects: number of idle connections the shared cache may keep open (use the number of threads).
+ * @note: call after curl_global_init. Clean up with share_handle_cleanup once no easy handle uses it anymore.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int share_handle_init(curl_share_data_t *share_data, long max_connects){
+    if(share_data == NULL) return -1;
+
+    share_data->max_connects = max_connects;
+
+    for(int i = 0; i < CURL_LOCK_DATA_LAST; i++){
+        if(pthread_mutex_init(&(share_data->locks[i]), NULL) != 0) return -1;
+    }
+
+    share_data->share = curl_share_init();
+    if(share_data->share == NULL) return -1;
+
+    curl_share_setopt(share_data->share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+    curl_share_setopt(share_data->share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+    curl_share_setopt(share_data->share, CURLSHOPT_USERDATA, (void *)share_data);
+
+    curl_share_setopt(share_data->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_data->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share_data->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+
+    return 0;
+}
+
+/**
+ * @brief: Attaches an easy handle to the share handle.
+ * The connection cache size is a per-handle option, so it is set here too. The default (5) would make
+ * the shared cache close connections as soon as more than 5 threads are crawling.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int share_handle_attach(CURL *curl_handle, curl_share_data_t *share_data){
+    if(curl_easy_setopt(curl_handle, CURLOPT_SHARE, share_data->share) != CURLE_OK) return -1;
+    if(curl_easy_setopt(curl_handle, CURLOPT_MAXCONNECTS, share_data->max_connects) != CURLE_OK) return -1;
+    return 0;
+}
+
+/**
+ * @brief: Cleans up the share handle and its mutexes.
+ */
+void share_handle_cleanup(curl_share_data_t *share_data){
+    curl_share_cleanup(share_data->share);
+    for(int i = 0; i < CURL_LOCK_DATA_LAST; i++){
+        pthread_mutex_destroy(&(share_data->locks[i]));
+    }
+}
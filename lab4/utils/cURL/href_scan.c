@@ -0,0 +1,543 @@
+/**
+ * @brief: Streaming extractor for <a href="..."> links. A lighter alternative to building a libxml2 DOM and
+ *         running the //a/@href XPath on every page: the received buffer is scanned once, in place, and
+ *         relative links are resolved with a small RFC 3986 (section 5.2) resolver instead of xmlBuildURI.
+ *         Keeps no global state, so it is safe to call from many threads at once.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // For strncasecmp
+#include <ctype.h>
+#include "../linkedList.c"
+
+#pragma once
+
+/**
+ * One component of a URL as a pointer into the original string plus a length.
+ * defined is 0 when the component is absent (which is different from present but empty, e.g. "http://a/b?").
+ */
+typedef struct url_part {
+    const char *str;
+    size_t len;
+    int defined;
+} url_part_t;
+
+/**
+ * A URL split into the five RFC 3986 components.
+ */
+typedef struct url_parts {
+    url_part_t scheme;
+    url_part_t authority;
+    url_part_t path;
+    url_part_t query;
+    url_part_t fragment;
+} url_parts_t;
+
+/**
+ * @brief: Splits a URL reference into its components (RFC 3986 appendix B). Does not copy anything.
+ * @params:
+ * out: the components, pointing into url.
+ * url: the URL reference (does not need to be null terminated).
+ * len: length of url in bytes.
+ */
+void url_split(url_parts_t *out, const char *url, size_t len){
+    size_t i = 0, start;
+    memset(out, 0, sizeof(url_parts_t));
+
+    /** Scheme: ALPHA *( ALPHA / DIGIT / "+" / "-" / "." ) ":" **/
+    if(len > 0 && isalpha((unsigned char)url[0])){
+        for(i = 1; i < len && (isalnum((unsigned char)url[i]) || url[i] == '+' || url[i] == '-' || url[i] == '.'); i++);
+        if(i < len && url[i] == ':'){
+            out->scheme.str = url;
+            out->scheme.len = i;
+            out->scheme.defined = 1;
+            i++;
+        }else{
+            i = 0;
+        }
+    }
+
+    /** Authority: "//" up to the next "/", "?" or "#" **/
+    if(i + 1 < len && url[i] == '/' && url[i+1] == '/'){
+        start = i + 2;
+        for(i = start; i < len && url[i] != '/' && url[i] != '?' && url[i] != '#'; i++);
+        out->authority.str = url + start;
+        out->authority.len = i - start;
+        out->authority.defined = 1;
+    }
+
+    /** Path: always defined, may be empty **/
+    start = i;
+    for(; i < len && url[i] != '?' && url[i] != '#'; i++);
+    out->path.str = url + start;
+    out->path.len = i - start;
+    out->path.defined = 1;
+
+    /** Query **/
+    if(i < len && url[i] == '?'){
+        start = ++i;
+        for(; i < len && url[i] != '#'; i++);
+        out->query.str = url + start;
+        out->query.len = i - start;
+        out->query.defined = 1;
+    }
+
+    /** Fragment **/
+    if(i < len && url[i] == '#'){
+        start = ++i;
+        out->fragment.str = url + start;
+        out->fragment.len = len - start;
+        out->fragment.defined = 1;
+    }
+}
+
+/**
+ * @brief: Removes "." and ".." segments from a path (RFC 3986 section 5.2.4).
+ * @params:
+ * out: memory for the result, at least len bytes. Not null terminated.
+ * path: the input path.
+ * len: length of the input path.
+ * @return: the length of the result.
+ */
+size_t url_remove_dot_segments(char *out, const char *path, size_t len){
+    size_t i = 0, out_len = 0, seg_end;
+
+    while(i < len){
+        /** A. Remove prefix "../" or "./" **/
+        if(len - i >= 3 && strncmp(path + i, "../", 3) == 0){ i += 3; continue; }
+        if(len - i >= 2 && strncmp(path + i, "./", 2) == 0){ i += 2; continue; }
+
+        /** B. Replace prefix "/./" or "/." (complete segment) with "/" **/
+        if(len - i >= 3 && strncmp(path + i, "/./", 3) == 0){ i += 2; continue; }
+        if(len - i == 2 && strncmp(path + i, "/.", 2) == 0){ out[out_len++] = '/'; i += 2; continue; }
+
+        /** C. Replace prefix "/../" or "/.." (complete segment) with "/" and drop the last output segment **/
+        if((len - i >= 4 && strncmp(path + i, "/../", 4) == 0) || (len - i == 3 && strncmp(path + i, "/..", 3) == 0)){
+            while(out_len > 0 && out[out_len - 1] != '/') out_len--;
+            if(out_len > 0) out_len--;
+            if(len - i == 3){
+                out[out_len++] = '/';
+                i += 3;
+            }else{
+                i += 3; // Leaves the trailing "/" as the start of the next segment
+            }
+            continue;
+        }
+
+        /** D. A lone "." or ".." is removed **/
+        if((len - i == 1 && path[i] == '.') || (len - i == 2 && strncmp(path + i, "..", 2) == 0)) break;
+
+        /** E. Move the first segment (with its leading "/") to the output **/
+        seg_end = i + 1;
+        while(seg_end < len && path[seg_end] != '/') seg_end++;
+        memcpy(out + out_len, path + i, seg_end - i);
+        out_len += seg_end - i;
+        i = seg_end;
+    }
+
+    return out_len;
+}
+
+/**
+ * @brief: Resolves a (possibly relative) reference against an absolute base URL (RFC 3986 section 5.2.2).
+ * @params:
+ * base: absolute, null terminated base URL (e.g. the effective URL of the page).
+ * ref: the reference found on the page (does not need to be null terminated).
+ * ref_len: length of ref in bytes.
+ * @return: heap allocated, null terminated target URL (caller frees), NULL on error.
+ */
+char *url_resolve(const char *base, const char *ref, size_t ref_len){
+    url_parts_t b, r;
+    url_split(&b, base, strlen(base));
+    url_split(&r, ref, ref_len);
+
+    const url_part_t *scheme, *authority, *query;
+    const char *path_src; // Path before dot segment removal
+    size_t path_src_len;
+    char *merged = NULL;
+
+    if(r.scheme.defined){
+        scheme = &r.scheme; authority = &r.authority; query = &r.query;
+        path_src = r.path.str; path_src_len = r.path.len;
+    }else{
+        scheme = &b.scheme;
+        if(r.authority.defined){
+            authority = &r.authority; query = &r.query;
+            path_src = r.path.str; path_src_len = r.path.len;
+        }else{
+            authority = &b.authority;
+            if(r.path.len == 0){
+                path_src = b.path.str; path_src_len = b.path.len;
+                query = r.query.defined ? &r.query : &b.query;
+            }else{
+                query = &r.query;
+                if(r.path.str[0] == '/'){
+                    path_src = r.path.str; path_src_len = r.path.len;
+                }else{
+                    /** Merge: base path up to (and including) its last "/" followed by the reference path **/
+                    size_t keep = b.path.len;
+                    while(keep > 0 && b.path.str[keep - 1] != '/') keep--;
+                    int add_slash = (b.authority.defined && b.path.len == 0);
+                    merged = (char *) malloc(keep + add_slash + r.path.len + 1);
+                    if(merged == NULL) return NULL;
+                    if(add_slash) merged[0] = '/';
+                    memcpy(merged + add_slash, b.path.str, keep);
+                    memcpy(merged + add_slash + keep, r.path.str, r.path.len);
+                    path_src = merged;
+                    path_src_len = keep + add_slash + r.path.len;
+                }
+            }
+        }
+    }
+
+    /** Assemble scheme ":" "//" authority path "?" query "#" fragment **/
+    size_t max_len = scheme->len + 1 + 2 + authority->len + path_src_len + 1 + query->len + 1 + r.fragment.len + 1;
+    char *result = (char *) malloc(max_len);
+    if(result == NULL){
+        free(merged);
+        return NULL;
+    }
+    size_t offset = 0;
+
+    if(scheme->defined){
+        memcpy(result + offset, scheme->str, scheme->len);
+        offset += scheme->len;
+        result[offset++] = ':';
+    }
+    if(authority->defined){
+        result[offset++] = '/';
+        result[offset++] = '/';
+        memcpy(result + offset, authority->str, authority->len);
+        offset += authority->len;
+    }
+    offset += url_remove_dot_segments(result + offset, path_src, path_src_len);
+    if(query->defined){
+        result[offset++] = '?';
+        memcpy(result + offset, query->str, query->len);
+        offset += query->len;
+    }
+    if(r.fragment.defined){
+        result[offset++] = '#';
+        memcpy(result + offset, r.fragment.str, r.fragment.len);
+        offset += r.fragment.len;
+    }
+    result[offset] = '\0';
+
+    free(merged);
+    return result;
+}
+
+/** 0 to keep links exactly as the pages wrote them (to measure what canonicalization saves). Set once by main **/
+int url_canonical = 1;
+
+/** Links whose canonical form differs from how the page wrote them (all threads). Atomic. **/
+long url_canon_rewritten = 0;
+
+/**
+ * @brief: Value of a hex digit, -1 if c is not one.
+ */
+int hex_value(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief: Normalizes the percent-encoding of a path or query (RFC 3986 section 6.2.2.2): escapes of unreserved
+ *         characters (ALPHA / DIGIT / "-" / "." / "_" / "~") are decoded, the hex digits of the others are uppercased.
+ * @params:
+ * out: memory for the result, at least len bytes. Not null terminated.
+ * in: the component.
+ * len: its length.
+ * @return: the length of the result.
+ */
+size_t url_normalize_percent(char *out, const char *in, size_t len){
+    size_t i = 0, out_len = 0;
+    int hi, lo;
+
+    while(i < len){
+        if(in[i] == '%' && i + 2 < len && (hi = hex_value(in[i+1])) >= 0 && (lo = hex_value(in[i+2])) >= 0){
+            char c = (char)(hi * 16 + lo);
+            if(isalnum((unsigned char)c) || c == '-' || c == '.' || c == '_' || c == '~'){
+                out[out_len++] = c;
+            }else{
+                out[out_len++] = '%';
+                out[out_len++] = toupper((unsigned char)in[i+1]);
+                out[out_len++] = toupper((unsigned char)in[i+2]);
+            }
+            i += 3;
+        }else{
+            out[out_len++] = in[i++];
+        }
+    }
+    return out_len;
+}
+
+/**
+ * @brief: Rewrites an absolute http(s) URL in its canonical form (RFC 3986 section 6.2.2 and 6.2.3), so that
+ *         spellings of the same resource dedup to one string: lowercase scheme and host, no default port,
+ *         "/" for an empty path, no dot segments, normalized percent-encoding and no fragment.
+ *         A trailing "/" is kept as is: "/lab4" and "/lab4/" are different resources to the server.
+ * @params:
+ * url: heap allocated, null terminated URL. Consumed: freed if a rewritten copy is returned instead.
+ *      Returned as is if it is already canonical, not an http(s) URL or url_canonical is 0.
+ * @return: heap allocated canonical URL (caller frees).
+ */
+char *url_canonicalize(char *url){
+    if(!url_canonical) return url;
+
+    size_t len = strlen(url);
+    url_parts_t parts;
+    url_split(&parts, url, len);
+
+    if(!parts.scheme.defined || !parts.authority.defined) return url;
+    int https;
+    if(parts.scheme.len == 4 && strncasecmp(parts.scheme.str, "http", 4) == 0) https = 0;
+    else if(parts.scheme.len == 5 && strncasecmp(parts.scheme.str, "https", 5) == 0) https = 1;
+    else return url;
+
+        // Every step keeps or shortens its part, except the "/" an empty path gets: len + 1 bytes and the terminating 0.
+        // The rest is scratch space for the percent normalized path.
+    char *result = (char *) malloc(2 * len + 3);
+    if(result == NULL) return url;
+    char *path = result + len + 2;
+    size_t offset = 0;
+
+    /** Scheme: lowercase **/
+    memcpy(result, https ? "https://" : "http://", https ? 8 : 7);
+    offset = https ? 8 : 7;
+
+    /** Authority: userinfo kept as is, host lowercase, default (or empty) port dropped **/
+    const char *auth = parts.authority.str;
+    size_t auth_len = parts.authority.len;
+    const char *at = memchr(auth, '@', auth_len);
+    size_t host_start = (at != NULL) ? (size_t)(at - auth) + 1 : 0;
+    size_t host_end = auth_len;
+    for(size_t i = auth_len; i > host_start; i--){
+        if(auth[i - 1] == ']') break; // IPv6 literal, no port after it
+        if(auth[i - 1] == ':'){
+            const char *port = auth + i;
+            size_t port_len = auth_len - i;
+            size_t digits = 0;
+            while(digits < port_len && isdigit((unsigned char)port[digits])) digits++;
+            if(digits == port_len){
+                long value = (port_len > 0) ? strtol(port, NULL, 10) : -1;
+                if(port_len == 0 || value == (https ? 443 : 80)) auth_len = i - 1;
+            }
+            host_end = i - 1;
+            break;
+        }
+    }
+    memcpy(result + offset, auth, host_start);
+    offset += host_start;
+    for(size_t i = host_start; i < host_end; i++) result[offset++] = tolower((unsigned char)auth[i]);
+    if(auth_len > host_end){
+        memcpy(result + offset, auth + host_end, auth_len - host_end);
+        offset += auth_len - host_end;
+    }
+
+    /** Path: percent-encoding first (an escaped "." is a dot segment too), then dot segments, "/" if empty **/
+    size_t path_len = url_normalize_percent(path, parts.path.str, parts.path.len);
+    size_t path_out = url_remove_dot_segments(result + offset, path, path_len);
+    if(path_out == 0) result[offset + path_out++] = '/';
+    offset += path_out;
+
+    /** Query: percent-encoding only. The fragment never reaches the server, so it is dropped **/
+    if(parts.query.defined){
+        result[offset++] = '?';
+        offset += url_normalize_percent(result + offset, parts.query.str, parts.query.len);
+    }
+    result[offset] = '\0';
+
+    if(offset == len && memcmp(result, url, len) == 0){
+        free(result);
+        return url;
+    }
+    __atomic_add_fetch(&url_canon_rewritten, 1, __ATOMIC_RELAXED);
+    free(url);
+    return result;
+}
+
+/**
+ * @brief: Decodes the HTML character references in an attribute value (&amp; &lt; &gt; &quot; &apos; &#N; &#xN;)
+ *         and strips surrounding whitespace, like libxml2 does before the value reaches xmlBuildURI.
+ * @params:
+ * out: memory for the result, at least len bytes. Not null terminated.
+ * value: the raw attribute value.
+ * len: length of value in bytes.
+ * @return: the length of the result.
+ */
+size_t html_attr_decode(char *out, const char *value, size_t len){
+    size_t i = 0, out_len = 0;
+
+    while(len > 0 && isspace((unsigned char)value[len - 1])) len--;
+    while(i < len && isspace((unsigned char)value[i])) i++;
+
+    while(i < len){
+        if(value[i] != '&'){
+            out[out_len++] = value[i++];
+            continue;
+        }
+
+        const char *p = value + i + 1;
+        size_t rest = len - i - 1;
+        if(rest >= 4 && strncmp(p, "amp;", 4) == 0){ out[out_len++] = '&'; i += 5; }
+        else if(rest >= 3 && strncmp(p, "lt;", 3) == 0){ out[out_len++] = '<'; i += 4; }
+        else if(rest >= 3 && strncmp(p, "gt;", 3) == 0){ out[out_len++] = '>'; i += 4; }
+        else if(rest >= 5 && strncmp(p, "quot;", 5) == 0){ out[out_len++] = '"'; i += 6; }
+        else if(rest >= 5 && strncmp(p, "apos;", 5) == 0){ out[out_len++] = '\''; i += 6; }
+        else if(rest >= 2 && p[0] == '#'){
+            /** Numeric reference, written out as UTF-8 (never longer than the reference itself) **/
+            char *end;
+            unsigned long code = (p[1] == 'x' || p[1] == 'X') ? strtoul(p + 2, &end, 16) : strtoul(p + 1, &end, 10);
+            if(end == p + 1 || end == p + 2 || (size_t)(end - value) >= len || *end != ';' || code == 0 || code > 0x10FFFF){
+                out[out_len++] = value[i++];
+                continue;
+            }
+            if(code < 0x80){
+                out[out_len++] = (char) code;
+            }else if(code < 0x800){
+                out[out_len++] = (char) (0xC0 | (code >> 6));
+                out[out_len++] = (char) (0x80 | (code & 0x3F));
+            }else if(code < 0x10000){
+                out[out_len++] = (char) (0xE0 | (code >> 12));
+                out[out_len++] = (char) (0x80 | ((code >> 6) & 0x3F));
+                out[out_len++] = (char) (0x80 | (code & 0x3F));
+            }else{
+                out[out_len++] = (char) (0xF0 | (code >> 18));
+                out[out_len++] = (char) (0x80 | ((code >> 12) & 0x3F));
+                out[out_len++] = (char) (0x80 | ((code >> 6) & 0x3F));
+                out[out_len++] = (char) (0x80 | (code & 0x3F));
+            }
+            i = (end - value) + 1;
+        }
+        else{
+            out[out_len++] = value[i++];
+        }
+    }
+
+    return out_len;
+}
+
+/**
+ * @brief: Returns a pointer just past the end of a raw text element (<script> or <style>), or end if it is never closed.
+ */
+const char *skip_raw_text(const char *p, const char *end, const char *tag, size_t tag_len){
+    while((p = memchr(p, '<', end - p)) != NULL){
+        if((size_t)(end - p) > tag_len + 1 && p[1] == '/' && strncasecmp(p + 2, tag, tag_len) == 0) return p + 2 + tag_len;
+        p++;
+    }
+    return end;
+}
+
+/**
+ * @brief: Finds every <a href="..."> in an HTML buffer and pushes the resulting http(s) URLs to to_visit.
+ * Drop-in replacement for the libxml2 based find_http. Comments, <script> and <style> contents are skipped.
+ * @params:
+ * buf: the received HTML. Is not modified.
+ * size: number of bytes in buf.
+ * follow_relative_links: if 1, links are resolved against base_url.
+ * base_url: the effective URL of the page.
+ * to_visit: linked list the found URLs are pushed to (heap allocated, freed by the caller).
+ * @return:
+ * 0: Success
+ * 1: Error (no buffer)
+ */
+int find_http_stream(char *buf, int size, int follow_relative_links, const char *base_url, Node_t **to_visit){
+    if(buf == NULL) return 1;
+
+    const char *p = buf;
+    const char *end = buf + size;
+    char *decoded = NULL;
+    size_t decoded_sz = 0;
+
+    /** memchr is vectorized in glibc, so the text between tags is skipped 16-32 bytes at a time **/
+    while(p < end && (p = memchr(p, '<', end - p)) != NULL){
+        p++;
+        if(p >= end) break;
+
+        /** Skip comments, scripts and styles where "<a" is not a tag **/
+        if(end - p >= 3 && strncmp(p, "!--", 3) == 0){
+            const char *close = memmem(p + 3, end - p - 3, "-->", 3);
+            p = close == NULL ? end : close + 3;
+            continue;
+        }
+        if(end - p > 6 && strncasecmp(p, "script", 6) == 0 && !isalnum((unsigned char)p[6])){
+            p = skip_raw_text(p + 6, end, "script", 6);
+            continue;
+        }
+        if(end - p > 5 && strncasecmp(p, "style", 5) == 0 && !isalnum((unsigned char)p[5])){
+            p = skip_raw_text(p + 5, end, "style", 5);
+            continue;
+        }
+
+        /** Only interested in the <a> tag **/
+        if(end - p < 2 || (p[0] != 'a' && p[0] != 'A') || !(isspace((unsigned char)p[1]) || p[1] == '>' || p[1] == '/')) continue;
+        p++;
+
+        /** Walk the attributes until the closing ">" **/
+        while(p < end && *p != '>'){
+            if(isspace((unsigned char)*p) || *p == '/'){ p++; continue; }
+
+            const char *name = p;
+            while(p < end && !isspace((unsigned char)*p) && *p != '=' && *p != '>' && *p != '/') p++;
+            size_t name_len = p - name;
+
+            while(p < end && isspace((unsigned char)*p)) p++;
+            if(p >= end || *p != '=') continue; // Attribute without a value
+
+            p++;
+            while(p < end && isspace((unsigned char)*p)) p++;
+            if(p >= end) break;
+
+            const char *value;
+            size_t value_len;
+            if(*p == '"' || *p == '\''){
+                char quote = *p++;
+                value = p;
+                const char *close = memchr(p, quote, end - p);
+                if(close == NULL) close = end;
+                value_len = close - value;
+                p = close < end ? close + 1 : end;
+            }else{
+                value = p;
+                while(p < end && !isspace((unsigned char)*p) && *p != '>') p++;
+                value_len = p - value;
+            }
+
+            if(name_len != 4 || strncasecmp(name, "href", 4) != 0) continue;
+
+            /** Decode the value and resolve it **/
+            if(value_len + 1 > decoded_sz){
+                decoded_sz = value_len + 1;
+                char *tmp = realloc(decoded, decoded_sz);
+                if(tmp == NULL) break;
+                decoded = tmp;
+            }
+            size_t href_len = html_attr_decode(decoded, value, value_len);
+            char *href;
+            if(follow_relative_links){
+                href = url_resolve(base_url, decoded, href_len);
+            }else{
+                href = (char *) malloc(href_len + 1);
+                if(href != NULL){
+                    memcpy(href, decoded, href_len);
+                    href[href_len] = '\0';
+                }
+            }
+
+            if(href != NULL && !strncmp(href, "http", 4)){
+                push(to_visit, url_canonicalize(href));
+            }else{
+                free(href);
+            }
+        }
+    }
+
+    free(decoded);
+    return 0;
+}
@@ -0,0 +1,306 @@
+/**
+ * @brief: Work-stealing frontier of URLs for the multi-threaded web crawler.
+ * Every worker thread owns a deque of URLs. The owner pushes and pops at the tail (stack order),
+ * idle workers steal half of another worker's deque from the head.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "linkedList.c"
+
+#pragma once
+
+#define DEQUE_INITIAL_SZ 64 // Initial capacity of each deque
+
+/**
+ * A circular buffer of URLs owned by one worker thread.
+ */
+typedef struct url_deque {
+    char **urls; // Circular buffer of heap allocated URLs
+    long head; // Index of the oldest URL (steal end)
+    long count; // Number of URLs currently in the deque. Written under lock with atomic stores, so thieves can peek at it without it.
+    long capacity; // Size of the urls buffer
+    pthread_mutex_t lock; // Access Control for the deque
+} url_deque_t;
+
+/**
+ * The shared frontier. Termination is detected with the pending counter (URLs queued plus URLs being processed),
+ * so no thread has to count how many other threads are waiting.
+ */
+typedef struct frontier {
+    url_deque_t *deques; // One deque per worker thread
+    int num_deques; // Number of worker threads
+    long pending; // URLs in any deque plus URLs popped but not yet finished. Atomic.
+    long queued; // URLs in any deque. Atomic.
+    int num_idle; // Number of workers sleeping on idle_cv. Atomic, only increased while holding idle_m.
+    int done; // 1 once the crawl is over (no work left or stopped). Atomic.
+    pthread_mutex_t idle_m; // Access Control for sleeping
+    pthread_cond_t idle_cv; // Signalled when new URLs are pushed or the crawl is over
+} frontier_t;
+
+/**
+ * @brief: Initializes a frontier with one deque per worker.
+ * @params:
+ * frontier: pointer to an allocated frontier struct. Will be filled by the function.
+ * num_workers: number of worker threads that will use the frontier.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int frontier_init(frontier_t *frontier, int num_workers){
+    if(frontier == NULL || num_workers < 1) return -1;
+
+    frontier->deques = (url_deque_t *) calloc(num_workers, sizeof(url_deque_t));
+    if(frontier->deques == NULL) return -1;
+    frontier->num_deques = num_workers;
+
+    for(int i = 0; i < num_workers; i++){
+        frontier->deques[i].urls = (char **) malloc(DEQUE_INITIAL_SZ * sizeof(char *));
+        frontier->deques[i].capacity = DEQUE_INITIAL_SZ;
+        if(frontier->deques[i].urls == NULL || pthread_mutex_init(&(frontier->deques[i].lock), NULL) != 0) return -1;
+    }
+
+    frontier->pending = 0;
+    frontier->queued = 0;
+    frontier->num_idle = 0;
+    frontier->done = 0;
+    if(pthread_mutex_init(&(frontier->idle_m), NULL) != 0 || pthread_cond_init(&(frontier->idle_cv), NULL) != 0) return -1;
+
+    return 0;
+}
+
+/**
+ * @brief: Frees the frontier, including any URLs that were never visited.
+ */
+void frontier_destroy(frontier_t *frontier){
+    for(int i = 0; i < frontier->num_deques; i++){
+        url_deque_t *deque = &(frontier->deques[i]);
+        for(long j = 0; j < deque->count; j++){
+            free(deque->urls[(deque->head + j) % deque->capacity]);
+        }
+        free(deque->urls);
+        pthread_mutex_destroy(&(deque->lock));
+    }
+    free(frontier->deques);
+    pthread_mutex_destroy(&(frontier->idle_m));
+    pthread_cond_destroy(&(frontier->idle_cv));
+}
+
+/**
+ * @brief: Doubles the capacity of the deque, keeping the URLs in order. Caller must hold the deque lock.
+ * @return:
+ * -1: Error (out of memory)
+ * 0: Success
+ */
+int deque_grow(url_deque_t *deque){
+    long new_capacity = deque->capacity * 2;
+    char **urls = (char **) malloc(new_capacity * sizeof(char *));
+    if(urls == NULL) return -1;
+
+    for(long i = 0; i < deque->count; i++){
+        urls[i] = deque->urls[(deque->head + i) % deque->capacity];
+    }
+
+    free(deque->urls);
+    deque->urls = urls;
+    deque->head = 0;
+    deque->capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * @brief: Wakes sleeping workers if there are any.
+ */
+void frontier_wake(frontier_t *frontier){
+    if(__atomic_load_n(&(frontier->num_idle), __ATOMIC_SEQ_CST) > 0){
+        pthread_mutex_lock(&(frontier->idle_m));
+        pthread_cond_broadcast(&(frontier->idle_cv));
+        pthread_mutex_unlock(&(frontier->idle_m));
+    }
+}
+
+/**
+ * @brief: Moves every URL in the linked list into the deque of the worker in a single critical section.
+ * @params:
+ * frontier: the shared frontier.
+ * worker_id: index of the calling worker's deque.
+ * urls: linked list of heap allocated URLs. Will be empty (NULL) after the call.
+ * @return: the number of URLs pushed.
+ */
+long frontier_push_batch(frontier_t *frontier, int worker_id, Node_t **urls){
+    url_deque_t *deque = &(frontier->deques[worker_id]);
+    long num_urls = 0;
+    long num_pushed = 0;
+    char *url;
+
+    if(*urls == NULL) return 0;
+    for(Node_t *node = *urls; node != NULL; node = node->next) num_urls++;
+
+    /** @critical_section: push all the URLs onto the tail of the deque **/
+    pthread_mutex_lock(&(deque->lock));
+    // Counted before any of them can be stolen and finished, otherwise pending and queued could reach 0 (or go negative)
+    // while URLs are still queued and the parent URL is still being processed
+    __atomic_add_fetch(&(frontier->pending), num_urls, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&(frontier->queued), num_urls, __ATOMIC_SEQ_CST);
+    while(*urls != NULL){
+        url = pop(urls);
+        if(url == NULL) continue;
+        if(deque->count == deque->capacity && deque_grow(deque) != 0){
+            perror("Error: frontier out of memory\n");
+            free(url);
+            continue;
+        }
+        deque->urls[(deque->head + deque->count) % deque->capacity] = url;
+        __atomic_store_n(&(deque->count), deque->count + 1, __ATOMIC_RELAXED);
+        num_pushed++;
+    }
+    // Uncount the URLs that were dropped (the parent URL still holds pending above 0)
+    __atomic_sub_fetch(&(frontier->pending), num_urls - num_pushed, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&(frontier->queued), num_urls - num_pushed, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(deque->lock));
+    /** @end_critical_section: **/
+
+    frontier_wake(frontier);
+
+    return num_pushed;
+}
+
+/**
+ * @brief: Pops the newest URL from the worker's own deque.
+ * @return: NULL if the deque is empty, otherwise a heap allocated URL.
+ */
+char *deque_pop_tail(url_deque_t *deque){
+    char *url = NULL;
+
+    pthread_mutex_lock(&(deque->lock));
+    if(deque->count > 0){
+        __atomic_store_n(&(deque->count), deque->count - 1, __ATOMIC_RELAXED);
+        url = deque->urls[(deque->head + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&(deque->lock));
+
+    return url;
+}
+
+/**
+ * @brief: Steals half of the URLs (the oldest ones) of another worker's deque.
+ * One stolen URL is returned, the rest are placed in the thief's own deque.
+ * @return: NULL if there was nothing to steal, otherwise a heap allocated URL.
+ */
+char *frontier_steal(frontier_t *frontier, int worker_id){
+    url_deque_t *own = &(frontier->deques[worker_id]);
+    url_deque_t *victim;
+    char **stolen;
+    long num_stolen;
+
+    for(int i = 1; i < frontier->num_deques; i++){
+        victim = &(frontier->deques[(worker_id + i) % frontier->num_deques]);
+        if(__atomic_load_n(&(victim->count), __ATOMIC_RELAXED) == 0) continue;
+
+        /** @critical_section: take half from the head of the victim's deque **/
+        pthread_mutex_lock(&(victim->lock));
+        num_stolen = (victim->count + 1) / 2;
+        stolen = num_stolen > 0 ? (char **) malloc(num_stolen * sizeof(char *)) : NULL;
+        if(stolen == NULL) num_stolen = 0;
+        for(long j = 0; j < num_stolen; j++){
+            stolen[j] = victim->urls[victim->head];
+            victim->head = (victim->head + 1) % victim->capacity;
+        }
+        __atomic_store_n(&(victim->count), victim->count - num_stolen, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&(victim->lock));
+        /** @end_critical_section: **/
+
+        if(num_stolen == 0) continue;
+
+        /** @critical_section: keep the rest in our own deque (never hold two deque locks at once) **/
+        // The stolen URLs stay counted in pending and queued while they move, only dropped ones are uncounted,
+        // under the lock like in frontier_push_batch (stolen[0] keeps pending above 0)
+        if(num_stolen > 1){
+            long num_dropped = 0;
+            pthread_mutex_lock(&(own->lock));
+            for(long j = 1; j < num_stolen; j++){
+                if(own->count == own->capacity && deque_grow(own) != 0){
+                    perror("Error: frontier out of memory\n");
+                    free(stolen[j]);
+                    num_dropped++;
+                    continue;
+                }
+                own->urls[(own->head + own->count) % own->capacity] = stolen[j];
+                __atomic_store_n(&(own->count), own->count + 1, __ATOMIC_RELAXED);
+            }
+            __atomic_sub_fetch(&(frontier->pending), num_dropped, __ATOMIC_SEQ_CST);
+            __atomic_sub_fetch(&(frontier->queued), num_dropped, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&(own->lock));
+        }
+        /** @end_critical_section: **/
+
+        char *url = stolen[0];
+        free(stolen);
+        return url;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief: Gets the next URL for the worker to process. Blocks while other workers still have work in progress.
+ * Every URL returned must be finished with frontier_task_done once its links have been pushed.
+ * @params:
+ * frontier: the shared frontier.
+ * worker_id: index of the calling worker's deque.
+ * @return: NULL once the crawl is over, otherwise a heap allocated URL.
+ */
+char *frontier_pop(frontier_t *frontier, int worker_id){
+    char *url;
+
+    while(!__atomic_load_n(&(frontier->done), __ATOMIC_SEQ_CST)){
+        url = deque_pop_tail(&(frontier->deques[worker_id]));
+        if(url == NULL) url = frontier_steal(frontier, worker_id);
+        if(url != NULL){
+            __atomic_sub_fetch(&(frontier->queued), 1, __ATOMIC_SEQ_CST);
+            return url;
+        }
+
+        /** @critical_section: sleep until something is pushed or all work is finished **/
+        pthread_mutex_lock(&(frontier->idle_m));
+        __atomic_add_fetch(&(frontier->num_idle), 1, __ATOMIC_SEQ_CST);
+        while(!__atomic_load_n(&(frontier->done), __ATOMIC_SEQ_CST) && __atomic_load_n(&(frontier->queued), __ATOMIC_SEQ_CST) == 0){
+            if(__atomic_load_n(&(frontier->pending), __ATOMIC_SEQ_CST) == 0){
+                // Nothing queued and nothing in progress, so no more URLs can ever appear
+                __atomic_store_n(&(frontier->done), 1, __ATOMIC_SEQ_CST);
+                pthread_cond_broadcast(&(frontier->idle_cv));
+                break;
+            }
+            pthread_cond_wait(&(frontier->idle_cv), &(frontier->idle_m));
+        }
+        __atomic_sub_fetch(&(frontier->num_idle), 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&(frontier->idle_m));
+        /** @end_critical_section: **/
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief: Marks a URL returned by frontier_pop as finished. Wakes sleeping workers if it was the last piece of work.
+ */
+void frontier_task_done(frontier_t *frontier){
+    if(__atomic_sub_fetch(&(frontier->pending), 1, __ATOMIC_SEQ_CST) == 0){
+        pthread_mutex_lock(&(frontier->idle_m));
+        pthread_cond_broadcast(&(frontier->idle_cv));
+        pthread_mutex_unlock(&(frontier->idle_m));
+    }
+}
+
+/**
+ * @brief: Ends the crawl early (e.g. once enough PNGs are found). Every worker will get NULL from frontier_pop.
+ */
+void frontier_stop(frontier_t *frontier){
+    pthread_mutex_lock(&(frontier->idle_m));
+    __atomic_store_n(&(frontier->done), 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&(frontier->idle_cv));
+    pthread_mutex_unlock(&(frontier->idle_m));
+}
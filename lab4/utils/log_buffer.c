@@ -0,0 +1,118 @@
+/**
+ * @brief: Per-thread append-only log buffers. Each crawler thread appends the URLs it visits (and the PNGs it finds)
+ *         to its own buffer, so logging takes no lock. Entries are stamped from a shared atomic counter, which lets
+ *         the buffers be merged back into one visit order at shutdown and written out through a single stdio buffer.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma once
+
+#define LOG_BUFFER_INIT_SZ 64 // Entries allocated on the first append
+#define LOG_WRITE_BUF_SZ 65536 // stdio buffer used when writing the merged log
+
+#define LOG_ORDER_VISIT 0 // Merge every buffer by sequence number (one global order)
+#define LOG_ORDER_THREAD 1 // Write the buffers one after the other (no merge)
+
+typedef struct log_entry {
+    unsigned long seq; // Position in the global order
+    char *line; // Owned by the buffer
+} log_entry_t;
+
+typedef struct log_buffer {
+    log_entry_t *entries; // Oldest first, so seq is increasing
+    size_t count;
+    size_t capacity;
+} log_buffer_t;
+
+/**
+ * @brief: Appends a line to a buffer. Only the owning thread may call it, no lock is taken.
+ * @params:
+ * buf: the thread's buffer (zero initialized before the first call)
+ * seq_counter: counter shared by every buffer that will be merged together. Atomic.
+ * line: malloced string, the buffer takes ownership
+ * @return:
+ * -1: Error (the caller keeps line)
+ * 0: Success
+ */
+int log_buffer_append(log_buffer_t *buf, unsigned long *seq_counter, char *line){
+    if(buf->count == buf->capacity){
+        size_t capacity = (buf->capacity > 0) ? 2 * buf->capacity : LOG_BUFFER_INIT_SZ;
+        log_entry_t *entries = (log_entry_t *) realloc(buf->entries, capacity * sizeof(log_entry_t));
+        if(entries == NULL){
+            perror("realloc");
+            return -1;
+        }
+        buf->entries = entries;
+        buf->capacity = capacity;
+    }
+    buf->entries[buf->count].seq = __atomic_fetch_add(seq_counter, 1, __ATOMIC_RELAXED);
+    buf->entries[buf->count].line = line;
+    buf->count++;
+    return 0;
+}
+
+/**
+ * @brief: Writes a set of buffers to a file, one line per entry, newest first (the order linkedlist_to_file gave the shared list).
+ *         Must only be called once every owning thread is done appending.
+ * @params:
+ * bufs: array of num_bufs buffers
+ * path: output file, truncated
+ * order: LOG_ORDER_VISIT to merge by sequence number, LOG_ORDER_THREAD to write each buffer in turn
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int log_buffers_write(log_buffer_t *bufs, int num_bufs, const char *path, int order){
+    FILE *fp = fopen(path, "wb+");
+    if(fp == NULL){
+        perror("fopen");
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, LOG_WRITE_BUF_SZ);
+
+        // Next entry to write from each buffer (counting down, 0 once drained)
+    size_t *left = (size_t *) malloc(num_bufs * sizeof(size_t));
+    if(left == NULL){
+        perror("malloc");
+        fclose(fp);
+        return -1;
+    }
+    for(int i = 0; i < num_bufs; i++) left[i] = bufs[i].count;
+
+    int result = 0;
+    int cur = 0;
+    while(result == 0){
+        if(order == LOG_ORDER_VISIT){
+            // Newest remaining entry over all buffers (few buffers, so a linear scan)
+            cur = -1;
+            for(int i = 0; i < num_bufs; i++){
+                if(left[i] > 0 && (cur < 0 || bufs[i].entries[left[i] - 1].seq > bufs[cur].entries[left[cur] - 1].seq)) cur = i;
+            }
+            if(cur < 0) break;
+        }else{
+            while(cur < num_bufs && left[cur] == 0) cur++;
+            if(cur == num_bufs) break;
+        }
+        char *line = bufs[cur].entries[--left[cur]].line;
+        if(fputs(line, fp) == EOF || putc('\n', fp) == EOF) result = -1;
+    }
+
+    free(left);
+    if(fclose(fp) != 0) result = -1;
+    return result;
+}
+
+/**
+ * @brief: Frees a buffer and every line in it.
+ */
+void log_buffer_free(log_buffer_t *buf){
+    for(size_t i = 0; i < buf->count; i++) free(buf->entries[i].line);
+    free(buf->entries);
+    buf->entries = NULL;
+    buf->count = 0;
+    buf->capacity = 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @brief: Checks that the Bloom filter in utils/bloom_filter.c keeps the false positive rate it was sized for.
+ *         Fills a filter with the number of URLs it was sized for, looks up CHECK_LOOKUPS URLs that were never added,
+ *         and fails if the share answered "maybe" is above the rate (allowing for sampling noise).
+ * EXAMPLE: ./bloom_check -b 0.001 -n 10000
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "./utils/bloom_filter.c"
+
+#define CHECK_LOOKUPS 1000000 // URLs that were never added, looked up per rate
+#define CHECK_SLACK 1.1 // Measured rates up to this times the target (plus noise) pass
+
+/**
+ * @brief: Measures one filter
+ * @params:
+ * fp_rate: rate the filter is sized for
+ * num_items: URLs it is sized for, and added to it
+ * @return:
+ * -1: Error, or the measured rate is too high
+ * 0: Success
+ */
+int check_rate(double fp_rate, size_t num_items){
+    bloom_filter_t bf;
+    char url[128];
+    long positives = 0;
+
+    if(bloom_init(&bf, num_items, fp_rate) != 0) return -1;
+    for(size_t i = 0; i < num_items; i++){
+        snprintf(url, sizeof(url), "http://ece252-1.uwaterloo.ca/lab5/page%zu.html", i);
+        bloom_add(&bf, url);
+    }
+    for(long i = 0; i < CHECK_LOOKUPS; i++){
+        snprintf(url, sizeof(url), "http://ece252-2.uwaterloo.ca/lab5/img%ld.png", i);
+        positives += bloom_maybe_contains(&bf, url);
+    }
+
+    double measured = (double) positives / CHECK_LOOKUPS;
+    double limit = fp_rate * CHECK_SLACK + 3.0 * sqrt(fp_rate / CHECK_LOOKUPS);
+    int passed = (measured <= limit);
+    printf("%-4s -b %-8g -n %-8zu %.1lf bits per key, %d hashes per key, %lu blocks: measured %.4lf%% (limit %.4lf%%)\n", passed ? "ok" : "FAIL",
+           fp_rate, num_items, bloom_bits_per_key(&bf), bf.num_hashes, (unsigned long) bf.num_blocks, 100.0 * measured, 100.0 * limit);
+    bloom_destroy(&bf);
+    return passed ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+
+    double fp_rate = 0.0; // 0 checks a range of rates
+    size_t num_items = 0; // 0 checks a range of sizes
+
+    int c;
+    while ((c = getopt (argc, argv, "b:n:")) != -1) {
+        switch (c) {
+        case 'b':
+            fp_rate = strtod(optarg, NULL);
+            if (fp_rate <= 0.0 || fp_rate >= 1.0) {
+                printf("false positive rate must be between 0 and 1 -- 'b'\n");
+                return -1;
+            }
+            break;
+        case 'n':
+            num_items = strtoul(optarg, NULL, 10);
+            if (num_items < 1) {
+                printf("number of items must be 1 or more -- 'n'\n");
+                return -1;
+            }
+            break;
+        default:
+            printf("Usage example: ./bloom_check -b 0.001 -n 10000\n");
+            return -1;
+        }
+    }
+
+    double rates[] = {0.1, 0.01, 0.001, 0.0001};
+    size_t sizes[] = {500, 10000, 100000};
+    int num_rates = (fp_rate > 0.0) ? 1 : sizeof(rates) / sizeof(rates[0]);
+    int num_sizes = (num_items > 0) ? 1 : sizeof(sizes) / sizeof(sizes[0]);
+
+    int result = 0;
+    for(int r = 0; r < num_rates; r++){
+        for(int s = 0; s < num_sizes; s++){
+            if(check_rate((fp_rate > 0.0) ? fp_rate : rates[r], (num_items > 0) ? num_items : sizes[s]) != 0) result = -1;
+        }
+    }
+    return result;
+}
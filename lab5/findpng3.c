@@ -1,4 +1,4 @@
-/** 
+/**
  * @brief Web Crawler to search the web for PNG images.
  * @authors Braden Bakker and Devon Miller-Junk
  */
@@ -10,13 +10,19 @@
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <curl/multi.h>
-#include <search.h>
 #include <time.h> // For program run time
+#include <sys/resource.h> // For the open file limit
 
 //Included Utility Code
 #include "./utils/linkedList.c"
+#include "./utils/url_inbox.c"
+#include "./utils/parse_pool.c"
+#include "./utils/bloom_filter.c"
+#include "./utils/url_intern.c"
 #include "./utils/cURL/curl_multi.c"
+#include "./utils/cURL/curl_epoll.c"
 
 #define SEED_URL "http://ece252-1.uwaterloo.ca/lab4/"
 #define ECE252_HEADER "X-Ece252-Fragment: "
@@ -26,22 +32,53 @@
 #define DEFAULT_THREAD_NUM 1
 #define DEFAULT_PNG_NUM 50
 #define DEFAULT_LOG_FILE ""
+#define DEFAULT_REACTOR_NUM 1
+#define DEFAULT_PARSER_NUM 1
+#define DEFAULT_WINDOW_FACTOR 2 // Transfers queued on a multi handle per connection
+#define H2_WINDOW_FACTOR 32 // Default with HTTP/2: transfers per connection, all running as streams at once
+#define PARSE_QUEUE_PER_PARSER 16 // Pages queued per parser thread before the reactors parse for themselves
 
 #define DEFAULT_STRING_SZ 250 // Size of the Default String
 
-#define MAX_HTABLE_SZ 500 // Size of the HashTable
+#define MAX_HTABLE_SZ 500 // URLs a reactor makes room for up front (intern table and Bloom filter)
+#define RESERVED_FDS 64 // File descriptors kept for everything that is not a connection
 
-// Web Crawler Input
+// Web Crawler Input (one per reactor)
 typedef struct web_crawler_input {
-    Node_t **png_urls; // The urls of valid PNGs
-    Node_t **to_visit; // A list (stack) of the next URLs to Visit
-    Node_t **log; // A log of every URL visited in order
-    int numpicture; // Total Number of Pictures Left to Acquire
-    int total_connections; // Maximum number of concurrent connections at once
+    Node_t **png_urls; // The urls of valid PNGs found by this reactor
+    url_intern_t urls; // Every URL this reactor owns and has seen, stored once. Its visited set. Only used by the reactor.
+    url_id_list_t to_visit; // Stack of the next URLs to Visit (IDs in urls), already marked visited
+    url_id_list_t log; // A log of every URL this reactor visited in order (IDs in urls)
+    int *numpicture; // Total Number of Pictures Left to Acquire (all reactors). Atomic.
+    int total_connections; // Maximum number of concurrent connections at once for this reactor
+    int window; // Maximum number of transfers added to this reactor's multi handle at once. The rest wait in to_visit.
+    long *num_pages; // Number of transfers completed (all reactors). Atomic.
+    int reactor_id; // Index of this reactor
+    int num_reactors; // Number of reactors
+    url_inbox_t *inboxes; // One inbox per reactor, for URLs found by the others
+    long *outstanding; // URLs sent to an inbox, queued or being transferred, all reactors. The crawl is over at 0. Atomic.
+    int *done; // Set to 1 when the crawl is over. Atomic.
+    parse_pool_t *parsers; // Threads parsing HTML pages off the event loop (NULL: the reactor parses them itself)
+    long *num_handles; // Number of easy handles created (all reactors). Atomic.
+    long *num_connects; // Number of new connections opened (all reactors). Atomic.
+    bloom_filter_t seen_filter; // Bloom filter of the URLs in this reactor's hash table, tested before it. Grows with it.
 } web_crawler_input_t;
 
+// HTML page handed from a reactor to a parser thread
+typedef struct parse_job {
+    web_crawler_input_t *crawler_in; // Reactor the page was fetched by
+    RECV_BUF *recv_buf; // The page. Owned by the job.
+    char *url; // Effective url of the page (base for relative links)
+} parse_job_t;
+
 // Main Function for Retrieving URL information
-int retrieve_urls(web_crawler_input_t crawler_in);
+void *retrieve_urls(void *arg);
+int url_owner(const char *url, int num_reactors);
+Node_t *concat_lists(Node_t *first, Node_t *second);
+
+// Writes every reactor's log to one file
+int logs_to_file(web_crawler_input_t *crawler_params, int num_reactors, char *file_path);
+int raise_open_file_limit(long connections);
 
 
 /**
@@ -67,13 +104,21 @@ int main(int argc, char *argv[]) {
 
     int numpicture = DEFAULT_PNG_NUM;
 
+    int num_reactors = DEFAULT_REACTOR_NUM;
+
+    int num_parsers = DEFAULT_PARSER_NUM;
+
+    int window_factor = 0; // 0 until -q is given, the default depends on the HTTP version
+
+    double bloom_fp_rate = BLOOM_DEFAULT_FP_RATE;
+
     char* logfile = (char *) malloc(DEFAULT_STRING_SZ * sizeof(char));
     strcpy(logfile, DEFAULT_LOG_FILE);
 
 
         // Fill Inputs
 	int c;
-    while ((c = getopt (argc, argv, "t:m:v:")) != -1) {
+    while ((c = getopt (argc, argv, "t:m:v:p:r:w:q:h:b:c:")) != -1) {
         switch (c) {
         case 't':
             total_connections = strtoul(optarg, NULL, 10);
@@ -92,238 +137,616 @@ int main(int argc, char *argv[]) {
         case 'v':
             strcpy(logfile, optarg);
             break;
+        case 'p':
+            if (strcmp(optarg, "stream") == 0) {
+                href_parser = HREF_PARSER_STREAM;
+            } else if (strcmp(optarg, "xml") == 0) {
+                href_parser = HREF_PARSER_XML;
+            } else {
+                perror("href parser must be xml or stream -- 'p'\n");
+                return -1;
+            }
+            break;
+        case 'r':
+            num_reactors = strtoul(optarg, NULL, 10);
+            if (num_reactors < 1) {
+                perror("number of reactors must be 1 or more -- 'r'\n");
+                return -1;
+            }
+            break;
+        case 'w':
+            num_parsers = strtol(optarg, NULL, 10);
+            if (num_parsers < 0) {
+                perror("number of parser threads must be 0 or more -- 'w'\n");
+                return -1;
+            }
+            break;
+        case 'q':
+            window_factor = strtoul(optarg, NULL, 10);
+            if (window_factor < 1) {
+                perror("transfers queued per connection must be 1 or more -- 'q'\n");
+                return -1;
+            }
+            break;
+        case 'h':
+            http_mode = http_mode_from_name(optarg);
+            if (http_mode < 0) {
+                perror("HTTP version must be 1.1, 2 or h2c -- 'h'\n");
+                return -1;
+            }
+            break;
+        case 'b':
+            bloom_fp_rate = strtod(optarg, NULL);
+            if (bloom_fp_rate <= 0.0 || bloom_fp_rate >= 1.0) {
+                perror("bloom filter false positive rate must be between 0 and 1 -- 'b'\n");
+                return -1;
+            }
+            break;
+        case 'c':
+            if (strcmp(optarg, "canonical") == 0) {
+                url_canonical = 1;
+            } else if (strcmp(optarg, "raw") == 0) {
+                url_canonical = 0;
+            } else {
+                perror("url form must be canonical or raw -- 'c'\n");
+                return -1;
+            }
+            break;
         default:
-            perror("Usage example: ./findpng2 -t 10 -m 50 -v log.txt\n");
+            perror("Usage example: ./findpng3 -t 10 -m 50 -v log.txt -p stream -r 4 -w 2 -q 2 -h h2c -b 0.01 -c canonical\n");
             free(logfile);
             free(seed_url);
             return -1;
         }
     }
+        // HTTP/2 multiplexes the window over the connections, HTTP/1.1 only queues it
+    if(window_factor == 0) window_factor = (http_mode == HTTP_MODE_1) ? DEFAULT_WINDOW_FACTOR : H2_WINDOW_FACTOR;
+
+        // Same form as the links found on pages, so the seed dedups with them
+    seed_url = url_canonicalize(seed_url);
+
+        // Every reactor needs at least one connection
+    if(num_reactors > total_connections) num_reactors = total_connections;
 
         // Program Variables
-    Node_t *png_urls = NULL; // The resulting png urls (of valid PNGs)
-    Node_t *to_visit = NULL; // A list (stack) of the next URLs to Visit. After pop need to ensure the URL has not been checked before (but also check before putting in to save memory)
-    Node_t *log = NULL; // A log of every URL visited in order
+    Node_t *png_urls[num_reactors]; // The resulting png urls (of valid PNGs), per reactor
+    url_inbox_t inboxes[num_reactors]; // URLs handed from one reactor to another
+    web_crawler_input_t crawler_params[num_reactors];
+    pthread_t pthread_ids[num_reactors];
+    long num_pages = 0; // Number of transfers completed
+    long num_handles = 0; // Number of easy handles created
+    long num_connects = 0; // New connections opened
+    long outstanding = 0; // Work left in the whole crawl
+    int done = 0; // Crawl is over
+    parse_pool_t parsers; // HTML parser threads shared by the reactors
+
+    if(raise_open_file_limit(total_connections) != 0){
+        fprintf(stderr, "Warning: open file limit is below %d connections\n", total_connections);
+    }
+
+        // Initialize cURL and libxml2 once, before any reactor starts
+    curl_global_init(CURL_GLOBAL_ALL);
+    xmlInitParser();
+
+    if(num_parsers > 0 && parse_pool_init(&parsers, num_parsers, num_parsers * PARSE_QUEUE_PER_PARSER, buf_pool_thread_flush) != 0){
+        perror("Error: could not start the parser threads\n");
+        return -1;
+    }
+
+    for(int i = 0; i < num_reactors; i++){
+        png_urls[i] = NULL;
+        if(url_inbox_init(inboxes + i) != 0) return -1;
+        if(url_intern_init(&(crawler_params[i].urls), MAX_HTABLE_SZ) != 0) return -1;
+
+        crawler_params[i].png_urls = png_urls + i;
+        memset(&(crawler_params[i].to_visit), 0, sizeof(url_id_list_t));
+        memset(&(crawler_params[i].log), 0, sizeof(url_id_list_t));
+        crawler_params[i].numpicture = &numpicture;
+            // Split the connections as evenly as possible
+        crawler_params[i].total_connections = total_connections / num_reactors + (i < total_connections % num_reactors ? 1 : 0);
+        crawler_params[i].window = window_factor * crawler_params[i].total_connections;
+        crawler_params[i].num_pages = &num_pages;
+        crawler_params[i].reactor_id = i;
+        crawler_params[i].num_reactors = num_reactors;
+        crawler_params[i].inboxes = inboxes;
+        crawler_params[i].outstanding = &outstanding;
+        crawler_params[i].done = &done;
+        crawler_params[i].parsers = (num_parsers > 0) ? &parsers : NULL;
+        crawler_params[i].num_handles = &num_handles;
+        crawler_params[i].num_connects = &num_connects;
+        if(bloom_init(&(crawler_params[i].seen_filter), MAX_HTABLE_SZ, bloom_fp_rate) != 0) return -1;
+    }
 
     /** @main_section: Start Main Part of the Program **/
 
-        // Push Initial Seed URL
-    push(&to_visit, seed_url);
-
-        //Main Function Call
-    web_crawler_input_t crawler_in;
-    crawler_in.png_urls = &png_urls;
-    crawler_in.to_visit = &to_visit;
-    crawler_in.log = &log;
-    crawler_in.numpicture = numpicture;
-    crawler_in.total_connections = total_connections;
-    if(retrieve_urls(crawler_in) != 0){
+        // Push Initial Seed URL to the reactor that owns it
+    outstanding = 1;
+    if(url_inbox_push(inboxes + url_owner(seed_url, num_reactors), seed_url) != 0){
+        free(logfile);
+        return -1;
+    }
+
+        // Create Reactors
+    for(int i = 0; i < num_reactors; i++){
+        pthread_create(pthread_ids + i, NULL, retrieve_urls, (void *)(crawler_params + i));
+    }
+
+        // Join Reactors
+    int failed = 0;
+    void *result;
+    for(int i = 0; i < num_reactors; i++){
+        pthread_join(pthread_ids[i], &result);
+        if(result != NULL) failed = 1;
+    }
+
+        // Pages still queued are skipped (the crawl is over), then the parsers exit
+    if(num_parsers > 0) parse_pool_destroy(&parsers);
+
+        // Merge the per reactor lists
+    for(int i = num_reactors - 1; i > 0; i--){
+        png_urls[i - 1] = concat_lists(png_urls[i - 1], png_urls[i]);
+    }
+
+    if(failed){
         perror("Error: retrieve_urls returned error\n");
         free(logfile);
-        free(seed_url);
-        freeMemory(png_urls);
+        freeMemory(png_urls[0]);
         return -1;
     }
 
     /** @output_section: Output Timing Result **/
 
         // Output to logfile if applicable
-    if(strcmp(logfile, DEFAULT_LOG_FILE) != 0) linkedlist_to_file(log, logfile);
+    if(strcmp(logfile, DEFAULT_LOG_FILE) != 0) logs_to_file(crawler_params, num_reactors, logfile);
 
         // Output valid PNG urls to file
-    linkedlist_to_file(png_urls, OUTPUT_FILE);
+    linkedlist_to_file(png_urls[0], OUTPUT_FILE);
 
         // Print Timing
     gettimeofday(&program_end, NULL);
-    printf("findpng2 execution time: %.6lf seconds\n", (double)((double)(program_end.tv_sec - program_start.tv_sec) + (((double)(program_end.tv_usec - program_start.tv_usec)) / 1000000.0)));
+    double run_time = (double)((double)(program_end.tv_sec - program_start.tv_sec) + (((double)(program_end.tv_usec - program_start.tv_usec)) / 1000000.0));
+        // Print Crawl Statistics (stderr so the timing stays the last line of stdout)
+    fprintf(stderr, "findpng3 throughput: %.1lf pages per second (%s href parser, %d reactors, %d parser threads)\n", run_time > 0 ? (double)num_pages / run_time : 0.0, href_parser == HREF_PARSER_STREAM ? "stream" : "xml", num_reactors, num_parsers);
+    fprintf(stderr, "findpng3 memory: peak RSS %ld KB, %ld receive buffer mallocs / %ld pages = %.3lf allocations per page (%ld pool requests)\n", peak_rss_kb(), buf_pool_stats.mallocs, num_pages, num_pages > 0 ? (double)buf_pool_stats.mallocs / (double)num_pages : 0.0, buf_pool_stats.requests);
+    fprintf(stderr, "findpng3 handles: %ld easy handles created for %ld transfers\n", num_handles, num_pages);
+    fprintf(stderr, "findpng3 connections: %ld connects / %ld pages = %.3lf connects per page (HTTP %s, %d transfers per connection)\n", num_connects, num_pages, num_pages > 0 ? (double)num_connects / (double)num_pages : 0.0, http_mode_name(http_mode), window_factor);
+    long bloom_lookups = 0, bloom_new = 0, bloom_false_positives = 0;
+    long num_urls = 0, arena_bytes = 0;
+    for(int i = 0; i < num_reactors; i++){
+        bloom_lookups += crawler_params[i].seen_filter.lookups;
+        bloom_new += crawler_params[i].seen_filter.definitely_new;
+        bloom_false_positives += crawler_params[i].seen_filter.false_positives;
+        num_urls += crawler_params[i].urls.count;
+        arena_bytes += crawler_params[i].urls.arena_bytes;
+    }
+    fprintf(stderr, "findpng3 bloom filter: %ld lookups, %ld definitely new (%.1lf%% skipped the string compares), %ld false positives (%.1lf bits per key, %d hashes per key, %lu blocks per reactor)\n", bloom_lookups, bloom_new, bloom_lookups > 0 ? 100.0 * (double)bloom_new / (double)bloom_lookups : 0.0, bloom_false_positives, bloom_bits_per_key(&(crawler_params[0].seen_filter)), crawler_params[0].seen_filter.num_hashes, (unsigned long)crawler_params[0].seen_filter.num_blocks);
+    fprintf(stderr, "findpng3 urls: %ld distinct URLs interned in %ld KB of arena, %ld links rewritten to canonical form (%s urls)\n", num_urls, arena_bytes / 1024, url_canon_rewritten, url_canonical ? "canonical" : "raw");
+    printf("findpng3 execution time: %.6lf seconds\n", run_time);
 
     /** @final_section: Cleanup **/
 
         //Free Memory
     free(logfile);
-    freeMemory(png_urls);
-    freeMemory(to_visit);
-    freeMemory(log);
+    freeMemory(png_urls[0]);
+    for(int i = 0; i < num_reactors; i++){
+        url_inbox_destroy(inboxes + i);
+        bloom_destroy(&(crawler_params[i].seen_filter));
+        url_id_list_free(&(crawler_params[i].to_visit));
+        url_id_list_free(&(crawler_params[i].log));
+        url_intern_destroy(&(crawler_params[i].urls));
+    }
+    buf_pool_destroy();
+
+        // cURL and libxml2 cleanup
+    xmlCleanupParser();
+    curl_global_cleanup();
 
     return 0;
 }
 
 /**
- * @brief: Retrieve the next URL in the list that is not in the hash table.
+ * @brief: Writes the logs of every reactor to one file, one URL per line (reactor 0 first, each newest first).
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int logs_to_file(web_crawler_input_t *crawler_params, int num_reactors, char *file_path){
+    FILE *fp = fopen(file_path, "wb+");
+    if(!fp) return -1;
+
+    int result = 0;
+    for(int i = 0; i < num_reactors && result == 0; i++){
+        result = url_id_list_write(&(crawler_params[i].log), &(crawler_params[i].urls), fp);
+    }
+    if(fclose(fp) != 0) result = -1;
+    return result;
+}
+
+/**
+ * @brief: Appends one list to the end of another.
+ * @return: head of the combined list
+ */
+Node_t *concat_lists(Node_t *first, Node_t *second){
+    if(first == NULL) return second;
+    Node_t *tail = first;
+    while(tail->next != NULL) tail = tail->next;
+    tail->next = second;
+    return first;
+}
+
+/**
+ * @brief: Finds the reactor that owns a URL: a hash (FNV-1a) of its host and path.
+ * The scheme, query and fragment are left out, so a page is always crawled by the same reactor.
  * @params:
- * head_node: linked list of urls
- * htable: hash table in question.
- * @return: NULL if no url matches, or pointer to a matching url.
+ * url: the url
+ * num_reactors: number of reactors
+ * @return: index of the owning reactor
  */
-char *get_next_valid_url(Node_t **head_node, struct hsearch_data *htable, Node_t **log){
-    // Initial Setup
-    ENTRY url_entry, *ret_entry;
-    url_entry.data = NULL;
-    
-    // Check for new URL
-    while(*head_node != NULL){
-        // Pop url
-        url_entry.key = pop(head_node);
-        if(url_entry.key == NULL) return NULL;
-
-        //Search in hashtable
-        hsearch_r(url_entry, FIND, &ret_entry, htable);
-        if(ret_entry == NULL){
-            // Add to hashtable
-            hsearch_r(url_entry, ENTER, &ret_entry, htable);
-            if(ret_entry == NULL){ //If hashtable is full
-                perror("Error: Hashtable is full\n");
-                free(url_entry.key);
-                return NULL;
+int url_owner(const char *url, int num_reactors){
+    if(num_reactors == 1) return 0;
+
+    url_parts_t parts;
+    unsigned int hash = 2166136261u;
+    url_split(&parts, url, strlen(url));
+
+    for(size_t i = 0; i < parts.authority.len; i++){
+        hash = (hash ^ (unsigned char) parts.authority.str[i]) * 16777619u;
+    }
+    for(size_t i = 0; i < parts.path.len; i++){
+        hash = (hash ^ (unsigned char) parts.path.str[i]) * 16777619u;
+    }
+    return hash % num_reactors;
+}
+
+/**
+ * @brief: Marks the crawl as over, cancels every running transfer (at its next call back) and wakes every reactor.
+ */
+void crawl_stop(web_crawler_input_t *crawler_in){
+    __atomic_store_n(crawler_in->done, 1, __ATOMIC_RELEASE);
+    cancel_transfers();
+    for(int i = 0; i < crawler_in->num_reactors; i++){
+        url_inbox_wake(crawler_in->inboxes + i);
+    }
+}
+
+/**
+ * @brief: Accounts for one URL being fully handled (dropped, failed or processed). Ends the crawl when nothing is left.
+ */
+void finish_url(web_crawler_input_t *crawler_in){
+    if(__atomic_sub_fetch(crawler_in->outstanding, 1, __ATOMIC_ACQ_REL) == 0) crawl_stop(crawler_in);
+}
+
+/**
+ * @brief: Rebuilds a reactor's Bloom filter at twice its size once its intern table holds more URLs than the
+ * filter was sized for, so the false positive rate stays at -b as the crawl grows.
+ * If there is no memory for the bigger filter the old one is kept (still correct, just less selective).
+ */
+void grow_seen_filter(web_crawler_input_t *crawler_in){
+    bloom_filter_t *seen_filter = &(crawler_in->seen_filter);
+
+    if(crawler_in->urls.count <= seen_filter->expected_items) return;
+    if(bloom_resize(seen_filter, 2 * seen_filter->expected_items) != 0) return;
+    for(url_id_t id = 0; id < crawler_in->urls.count; id++){
+        bloom_add(seen_filter, url_intern_str(&(crawler_in->urls), id));
+    }
+}
+
+/**
+ * @brief: Queue a URL to visit if this reactor has not seen it yet (and add it to its visited set).
+ * It is logged by fill_multi_handlers once its transfer starts, as it may still be waiting in to_visit when the crawl ends.
+ * @params:
+ * crawler_in: this reactor's input data. Its Bloom filter is checked first: URLs it has never seen are
+ *             added to the intern table without comparing strings.
+ * url: malloced url. Freed (the intern table keeps its own copy).
+ * @return: 1 if the url was queued, 0 otherwise.
+ */
+int add_if_unvisited(web_crawler_input_t *crawler_in, char *url){
+    url_id_t id;
+    int added = 1;
+
+    if(bloom_maybe_contains(&(crawler_in->seen_filter), url)){
+        id = url_intern(&(crawler_in->urls), url, &added);
+        if(added) bloom_false_positive(&(crawler_in->seen_filter));
+    }else{
+        id = url_intern_new(&(crawler_in->urls), url);
+    }
+
+    if(id == URL_ID_NONE || !added || url_id_list_push(&(crawler_in->to_visit), id) != 0){
+        free(url);
+        return 0;
+    }
+    bloom_add(&(crawler_in->seen_filter), url);
+    grow_seen_filter(crawler_in);
+    free(url);
+    return 1;
+}
+
+/**
+ * @brief: Sends newly found URLs to their owners. URLs this reactor owns are checked against its visited set directly,
+ * the others are batched per owner and pushed to that owner's inbox.
+ * @params:
+ * crawler_in: this reactor's input data
+ * urls: list of malloced urls. Consumed.
+ * on_reactor: 1 when called by the reactor itself, 0 otherwise (then its own URLs go to its inbox too)
+ */
+void route_urls(web_crawler_input_t *crawler_in, Node_t *urls, int on_reactor){
+    int num_reactors = crawler_in->num_reactors;
+    Node_t *first[num_reactors], *last[num_reactors];
+    long count[num_reactors];
+    memset(first, 0, sizeof(first));
+    memset(count, 0, sizeof(count));
+
+    while(urls != NULL){
+        Node_t *node = urls;
+        urls = urls->next;
+
+        int owner = url_owner(node->data, num_reactors);
+        if(owner == crawler_in->reactor_id && on_reactor){
+            if(add_if_unvisited(crawler_in, node->data)){
+                __atomic_add_fetch(crawler_in->outstanding, 1, __ATOMIC_RELAXED);
             }
-            // char *temp_url = (char *) malloc((1 + strlen(url_entry.key)) * sizeof(char));
-            // strcpy(temp_url, url_entry.key);
-            // push(log, temp_url);
-            push(log, url_entry.key);
-            return url_entry.key;
+            free(node);
+            continue;
         }
 
-        // Free
-        free(url_entry.key);
+        node->next = first[owner];
+        if(first[owner] == NULL) last[owner] = node;
+        first[owner] = node;
+        count[owner]++;
+    }
+
+    for(int i = 0; i < num_reactors; i++){
+        if(first[i] == NULL) continue;
+            // Count before the owner can see (and finish) them
+        __atomic_add_fetch(crawler_in->outstanding, count[i], __ATOMIC_RELAXED);
+        url_inbox_push_list(crawler_in->inboxes + i, first[i], last[i]);
     }
-    return NULL;
 }
 
 /**
  * @brief: Process the data received from cURL. Add to the desired lists.
  * @params:
- * curl_handle: linked list of urls
- * htable: hash table in question.
+ * curl_handle: the finished transfer
+ * recv_buf: its data
+ * crawler_in: this reactor's input data
  * @return: Number of urls added to the png_urls
  */
-int multi_process_data(CURL *curl_handle, RECV_BUF *recv_buf, Node_t **to_visit, Node_t **png_urls, struct hsearch_data *visited_urls, int *still_waiting){
+int multi_process_data(CURL *curl_handle, RECV_BUF *recv_buf, web_crawler_input_t *crawler_in){
     Node_t *temp_to_vist = NULL;
     Node_t *temp_png_urls = NULL;
     char *url;
     int returnValue = 0;
-    ENTRY url_entry, *ret_entry;
-    url_entry.data = NULL;
 
     if (process_data(curl_handle, recv_buf, &temp_to_vist, &temp_png_urls) != 0){
+        freeMemory(temp_to_vist);
+        freeMemory(temp_png_urls);
         return 0;
     }
 
-    if(temp_png_urls != NULL){
-        while(temp_png_urls != NULL){
-            // Make Copy of String
-            url = pop(&temp_png_urls);
-            if(url != NULL){
-                push(png_urls, url);
-                returnValue++;
-            }
-        }
-    }
-    
-    if(temp_to_vist != NULL){
-        while(temp_to_vist != NULL){
-            url_entry.key = pop(&temp_to_vist);
-            hsearch_r(url_entry, FIND, &ret_entry, visited_urls);
-            if(ret_entry == NULL){
-                push(to_visit, url_entry.key);
-                if(*still_waiting == 0) *still_waiting = 1;
-            }else{
-                free(url_entry.key);
-            }
+    while(temp_png_urls != NULL){
+        url = pop(&temp_png_urls);
+        if(url == NULL) continue;
+            // Only keep it if the target is not reached yet (other reactors find PNGs too)
+        if(__atomic_fetch_sub(crawler_in->numpicture, 1, __ATOMIC_ACQ_REL) > 0){
+            push(crawler_in->png_urls, url);
+            returnValue++;
+        }else{
+            free(url);
         }
     }
+    if(returnValue > 0 && __atomic_load_n(crawler_in->numpicture, __ATOMIC_ACQUIRE) <= 0) crawl_stop(crawler_in);
 
-    freeMemory(temp_to_vist);
-    freeMemory(temp_png_urls);
+    route_urls(crawler_in, temp_to_vist, 1);
 
     return returnValue;
 }
 
 /**
- * @brief: takes all urls from to_visit and creates cURL handlers
+ * @brief: Parser thread task: extracts the links of a page and sends them to their reactors in one batch per reactor.
+ * @params:
+ * arg: parse_job_t*. Freed by the function.
+ */
+void parse_page(void *arg){
+    parse_job_t *job = (parse_job_t *) arg;
+    Node_t *found_urls = NULL;
+
+        // Nothing to do once the crawl is over
+    if(!__atomic_load_n(job->crawler_in->done, __ATOMIC_ACQUIRE)){
+        process_html_body(job->url, job->recv_buf, &found_urls);
+        route_urls(job->crawler_in, found_urls, 0);
+    }
+
+    recv_buf_cleanup(job->recv_buf);
+    free(job->recv_buf);
+    free(job->url);
+    finish_url(job->crawler_in);
+    free(job);
+}
+
+/**
+ * @brief: Hands a finished HTML transfer to the parser threads.
+ * @params:
+ * curl_handle: the finished transfer
+ * recv_buf: its data. Owned by the parser thread on success.
+ * crawler_in: this reactor's input data
+ * @return:
+ * 1: queued (the parser calls finish_url)
+ * 0: not an HTML page, the queue is full or out of memory. The reactor processes it.
+ */
+int offload_html(CURL *curl_handle, RECV_BUF *recv_buf, web_crawler_input_t *crawler_in){
+    long response_code = 0;
+    char *ct = NULL, *url = NULL;
+
+    if(crawler_in->parsers == NULL) return 0;
+
+    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_getinfo(curl_handle, CURLINFO_CONTENT_TYPE, &ct);
+    curl_easy_getinfo(curl_handle, CURLINFO_EFFECTIVE_URL, &url);
+    if(response_code >= 400 || ct == NULL || url == NULL || strstr(ct, CT_HTML) == NULL) return 0;
+
+    parse_job_t *job = (parse_job_t *) malloc(sizeof(parse_job_t));
+    if(job == NULL) return 0;
+    job->url = (char *) malloc((1 + strlen(url)) * sizeof(char));
+    if(job->url == NULL){
+        free(job);
+        return 0;
+    }
+    job->crawler_in = crawler_in;
+    job->recv_buf = recv_buf;
+    strcpy(job->url, url);
+
+    if(parse_pool_try_submit(crawler_in->parsers, parse_page, (void *) job) != 0){
+        free(job->url);
+        free(job);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief: takes urls from to_visit and starts their transfers (logging them), until the reactor's window is full.
+ * The rest stay in to_visit (an ID per url) rather than as queued easy handles and buffers.
  * @params:
  * cm: curl multi handle
- * to_visit: linked list of urls
- * htable: hash table in question.
- * @return: N/A
+ * crawler_in: this reactor's input data
+ * idle_handles: finished handles to reuse
+ * in_flight: number of transfers on cm. Updated.
+ * @return: Number of handles added
  */
-void fill_multi_handlers(CURLM *cm, Node_t **to_visit, struct hsearch_data *htable, Node_t **log){
-    char *url;
-    while(*to_visit != NULL){
-        url = get_next_valid_url(to_visit, htable, log);
-        if(url != NULL){
-            curl_multi_init_easy(cm, url);
+int fill_multi_handlers(CURLM *cm, web_crawler_input_t *crawler_in, easy_free_list_t *idle_handles, int *in_flight){
+    url_id_t id;
+    int added = 0;
+    while(crawler_in->to_visit.count > 0 && *in_flight < crawler_in->window){
+        id = url_id_list_pop(&(crawler_in->to_visit));
+        if(curl_multi_add_url(cm, idle_handles, url_intern_str(&(crawler_in->urls), id)) == 0){
+            url_id_list_push(&(crawler_in->log), id); // Visited, the log only misses it if out of memory
+            added++;
+            (*in_flight)++;
+        }else{
+            finish_url(crawler_in);
         }
     }
+    return added;
 }
 
+/**
+ * @brief: Raises the soft limit on open files so that every connection gets a socket (the default is often 1024).
+ * @params:
+ * connections: number of concurrent connections wanted.
+ * @return:
+ * -1: Error (the limit is left as is)
+ * 0: Success, or the limit was already high enough
+ */
+int raise_open_file_limit(long connections){
+    struct rlimit lim;
+    rlim_t wanted = (rlim_t) connections + RESERVED_FDS;
+
+    if(getrlimit(RLIMIT_NOFILE, &lim) != 0) return -1;
+    if(lim.rlim_cur >= wanted) return 0;
+
+    lim.rlim_cur = (lim.rlim_max != RLIM_INFINITY && lim.rlim_max < wanted) ? lim.rlim_max : wanted;
+    if(setrlimit(RLIMIT_NOFILE, &lim) != 0) return -1;
+    return (lim.rlim_cur >= wanted) ? 0 : -1;
+}
 
 /**
- * @brief: Retrieve URLs in a crawler, and log the PNG images retrieved.
+ * @brief: Reactor thread. Retrieve the URLs this reactor owns with its own multi handle, and log the PNG images retrieved.
  * @params:
- * crawler_in: input data
+ * arg: web_crawler_input_t* for this reactor
  * @return:
- * 0: sucess
+ * NULL: sucess
  * other: error
  */
-int retrieve_urls(web_crawler_input_t crawler_in){
+void *retrieve_urls(void *arg){
+    web_crawler_input_t *crawler_in = (web_crawler_input_t *) arg;
 
     /** Initial Variable Setup **/
-    int still_running = 1, res, msgs_left = 0;
-    char *url;
-
-    // Setup Hashtable
-    struct hsearch_data *visited_urls = calloc(1, sizeof(struct hsearch_data));
-    if(hcreate_r(MAX_HTABLE_SZ, visited_urls) == 0){
-        perror("Error: insufficient space to create hashtable\n");
-        free(visited_urls);
-        return -1;
-    }
+    int res, msgs_left = 0;
+    Node_t *inbox_urls;
 
         // Initialize cURL
-    curl_global_init(CURL_GLOBAL_ALL);
     CURLM *cm = curl_multi_init();
-    curl_multi_setopt(cm, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) crawler_in.total_connections);
-    curl_multi_setopt(cm, CURLMOPT_MAX_HOST_CONNECTIONS, 6L);
+    curl_multi_setopt(cm, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) crawler_in->total_connections);
+    curl_multi_setopt(cm, CURLMOPT_MAX_HOST_CONNECTIONS, (long) crawler_in->total_connections);
+    curl_multi_setopt(cm, CURLMOPT_MAXCONNECTS, (long) crawler_in->total_connections);
+    if(http_mode != HTTP_MODE_1){
+            // Run the whole window as streams over the connections instead of queueing it behind them
+        curl_multi_setopt(cm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(cm, CURLMOPT_MAX_CONCURRENT_STREAMS, (long) (crawler_in->window / crawler_in->total_connections));
+    }
+
+        // Drive the multi handle from epoll (socket action) instead of curl_multi_wait + curl_multi_perform
+        // The inbox eventfd wakes the loop up when another reactor sends URLs
+    epoll_loop_t loop;
+    if(epoll_loop_init(&loop, cm) != 0 || epoll_loop_add_wakefd(&loop, crawler_in->inboxes[crawler_in->reactor_id].eventfd) != 0){
+        curl_multi_cleanup(cm);
+        crawl_stop(crawler_in);
+        return (void *) -1;
+    }
     CURL *curl_handle = NULL;
     CURLMsg *msg = NULL;
     RECV_BUF *recv_buf;
 
-        // Start First Request
-    url = get_next_valid_url(crawler_in.to_visit, visited_urls, crawler_in.log);
-    curl_multi_init_easy(cm, url);
+        // Finished handles are kept for the next transfers (at most one window of them)
+    easy_free_list_t idle_handles;
+    int in_flight = 0;
+    if(easy_free_list_init(&idle_handles, crawler_in->window) != 0){
+        epoll_loop_cleanup(&loop);
+        curl_multi_cleanup(cm);
+        crawl_stop(crawler_in);
+        return (void *) -1;
+    }
 
     /** Main Loop **/
-    while(crawler_in.numpicture > 0 && still_running > 0){
+    while(!__atomic_load_n(crawler_in->done, __ATOMIC_ACQUIRE)){
+
+        // Take URLs found by other reactors (and the seed)
+        inbox_urls = url_inbox_take_all(crawler_in->inboxes + crawler_in->reactor_id);
+        while(inbox_urls != NULL){
+            Node_t *node = inbox_urls;
+            inbox_urls = inbox_urls->next;
+            if(!add_if_unvisited(crawler_in, node->data)) finish_url(crawler_in);
+            free(node);
+        }
+
+        // Start Requests
+        fill_multi_handlers(cm, crawler_in, &idle_handles, &in_flight);
 
-        // Perform Requests
-        res = curl_multi_wait(cm, NULL, 0, MAX_WAIT_MSECS, NULL);
-        if(res != CURLM_OK) {
-            fprintf(stderr, "error: curl_multi_wait() returned %d\n", res);
-            return EXIT_FAILURE;
+        // Perform Requests (only the sockets with events)
+        res = epoll_loop_wait(&loop, MAX_WAIT_MSECS);
+        if(res < 0) {
+            fprintf(stderr, "error: epoll_loop_wait() returned %d\n", res);
+            crawl_stop(crawler_in);
+            break;
         }
-        curl_multi_perform(cm, &still_running);
 
         // Process Results Continuously
         while ((msg = curl_multi_info_read(cm, &msgs_left))) {
             if (msg->msg == CURLMSG_DONE) {
+                __atomic_add_fetch(crawler_in->num_pages, 1, __ATOMIC_RELAXED);
+                in_flight--;
                 // Get Data
                 curl_handle = msg->easy_handle;
                 curl_easy_getinfo(curl_handle, CURLINFO_PRIVATE, &recv_buf);
-                curl_easy_getinfo(curl_handle, CURLINFO_EFFECTIVE_URL, &url);
-
-                // Process Data if valid cURL
-                if(msg->data.result == CURLE_OK){
-                    // Process Data
-                    crawler_in.numpicture -= multi_process_data(curl_handle, recv_buf, crawler_in.to_visit, crawler_in.png_urls, visited_urls, &still_running);
+                long connects = 0;
+                curl_easy_getinfo(curl_handle, CURLINFO_NUM_CONNECTS, &connects);
+                __atomic_add_fetch(crawler_in->num_connects, connects, __ATOMIC_RELAXED);
+
+                // Process Data if valid cURL (and the target is not reached yet)
+                // HTML pages go to the parser threads when there is room, PNGs are handled here
+                int offloaded = 0;
+                if(recv_buf_complete(msg->data.result, recv_buf) && !__atomic_load_n(crawler_in->done, __ATOMIC_ACQUIRE)){
+                    offloaded = offload_html(curl_handle, recv_buf, crawler_in);
+                    if(!offloaded) multi_process_data(curl_handle, recv_buf, crawler_in);
                 }
 
-                fill_multi_handlers(cm, crawler_in.to_visit, visited_urls, crawler_in.log);
-
-                // Cleanup
-                curl_multi_remove_handle(cm, curl_handle);
-                curl_easy_cleanup(curl_handle);
-                recv_buf_cleanup(recv_buf);
-                if(recv_buf != NULL) free(recv_buf);
+                // Recycle the handle (an offloaded page's buffer now belongs to its parser)
+                if(offloaded){
+                    curl_easy_setopt(curl_handle, CURLOPT_PRIVATE, NULL);
+                }else{
+                    finish_url(crawler_in);
+                }
+                curl_multi_recycle(cm, &idle_handles, curl_handle);
                 recv_buf = NULL;
             }
             else {
@@ -332,34 +755,15 @@ int retrieve_urls(web_crawler_input_t crawler_in){
         }
     }
 
-    // Cleanup All the Other Requests Currently Running. This part Runs them all concurrently to speed up the process.
-    // Can't find a way to cancel requests already submitted, so instead just run them as quickly as possible.
-    curl_multi_perform(cm, &still_running);
-    curl_multi_setopt(cm, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) still_running);
-    do{
-        res = curl_multi_wait(cm, NULL, 0, 0, NULL);
-        curl_multi_perform(cm, &still_running);
-    }while(still_running > 0);
-    while ((msg = curl_multi_info_read(cm, &msgs_left))) {
-        curl_multi_remove_handle(cm, msg->easy_handle);
-        if (msg->msg == CURLMSG_DONE) {
-            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &recv_buf);
-            recv_buf_cleanup(recv_buf);
-        }
-        curl_easy_cleanup(msg->easy_handle);
-        if(recv_buf != NULL) free(recv_buf);
-        recv_buf = NULL;
-    }
+    // Cancel All the Other Requests Currently Running (pending or mid-body). Nothing left is worth waiting for.
+    curl_multi_cancel_all(cm, &idle_handles);
+    __atomic_add_fetch(crawler_in->num_handles, idle_handles.created, __ATOMIC_RELAXED);
+    easy_free_list_cleanup(&idle_handles);
 
         // cURL cleanup
+    epoll_loop_cleanup(&loop);
     curl_multi_cleanup(cm);
+    buf_pool_thread_flush();
 
-        // cURL cleanup
-    curl_global_cleanup();
-
-        //Free Memory
-    hdestroy_r(visited_urls);
-    free(visited_urls);
-
-    return 0;
-}
\ No newline at end of file
+    return NULL;
+}
@@ -0,0 +1,196 @@
+/**
+ * @brief: Size-class pool for receive buffers. Buffers are powers of two between BUF_POOL_MIN_SZ and BUF_POOL_MAX_SZ.
+ *         A freed buffer goes to a small cache owned by the calling thread (no locking), and when that cache is
+ *         full to a shared overflow list (one mutex per size class). Bigger requests bypass the pool.
+ *         Counters are kept so the crawlers can report allocations per page.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h> // For getrusage (peak RSS)
+
+#pragma once
+
+#define BUF_POOL_MIN_SHIFT 12 // Smallest class is 4K
+#define BUF_POOL_NUM_CLASSES 11 // 4K, 8K, ..., 4M
+#define BUF_POOL_MIN_SZ ((size_t)1 << BUF_POOL_MIN_SHIFT)
+#define BUF_POOL_MAX_SZ ((size_t)1 << (BUF_POOL_MIN_SHIFT + BUF_POOL_NUM_CLASSES - 1))
+#define BUF_POOL_LOCAL_CAP 8 // Buffers per class cached by each thread
+#define BUF_POOL_SHARED_CAP 64 // Buffers per class kept in the shared overflow list
+
+/**
+ * A stack of free buffers of one size class.
+ */
+typedef struct buf_stack {
+    void *bufs[BUF_POOL_SHARED_CAP];
+    int count;
+} buf_stack_t;
+
+/**
+ * Per-thread cache. Only touched by its owner.
+ */
+typedef struct buf_local_cache {
+    void *bufs[BUF_POOL_NUM_CLASSES][BUF_POOL_LOCAL_CAP];
+    int count[BUF_POOL_NUM_CLASSES];
+} buf_local_cache_t;
+
+/**
+ * Counters for the run summary. Atomic.
+ */
+typedef struct buf_pool_stats {
+    long requests; // Buffers handed out (including regrowth)
+    long mallocs; // Buffers that had to come from malloc
+} buf_pool_stats_t;
+
+static __thread buf_local_cache_t buf_local_cache; // This thread's cache
+static buf_stack_t buf_shared[BUF_POOL_NUM_CLASSES]; // Overflow shared by all threads
+static pthread_mutex_t buf_shared_m[BUF_POOL_NUM_CLASSES] = { [0 ... BUF_POOL_NUM_CLASSES - 1] = PTHREAD_MUTEX_INITIALIZER };
+buf_pool_stats_t buf_pool_stats;
+
+/**
+ * @brief: Finds the size class that fits the requested size.
+ * @return: class index, or -1 if the size is bigger than the biggest class.
+ */
+int buf_pool_class(size_t size){
+    int class_idx = 0;
+    size_t class_sz = BUF_POOL_MIN_SZ;
+    while(class_sz < size){
+        class_sz <<= 1;
+        class_idx++;
+        if(class_idx >= BUF_POOL_NUM_CLASSES) return -1;
+    }
+    return class_idx;
+}
+
+/**
+ * @brief: Gets a buffer of at least min_size bytes.
+ * @params:
+ * min_size: the number of bytes needed.
+ * size: set to the real capacity of the returned buffer. Pass this value back to buf_pool_free.
+ * @return: the buffer, NULL if out of memory.
+ */
+void *buf_pool_alloc(size_t min_size, size_t *size){
+    int class_idx = buf_pool_class(min_size);
+    void *buf = NULL;
+
+    __atomic_add_fetch(&(buf_pool_stats.requests), 1, __ATOMIC_RELAXED);
+
+    if(class_idx < 0){
+        /** Too big to pool **/
+        *size = min_size;
+        __atomic_add_fetch(&(buf_pool_stats.mallocs), 1, __ATOMIC_RELAXED);
+        return malloc(min_size);
+    }
+    *size = BUF_POOL_MIN_SZ << class_idx;
+
+    /** Thread cache first, then the shared overflow, then malloc **/
+    if(buf_local_cache.count[class_idx] > 0){
+        return buf_local_cache.bufs[class_idx][--buf_local_cache.count[class_idx]];
+    }
+
+    pthread_mutex_lock(&buf_shared_m[class_idx]);
+    if(buf_shared[class_idx].count > 0){
+        buf = buf_shared[class_idx].bufs[--buf_shared[class_idx].count];
+    }
+    pthread_mutex_unlock(&buf_shared_m[class_idx]);
+    if(buf != NULL) return buf;
+
+    __atomic_add_fetch(&(buf_pool_stats.mallocs), 1, __ATOMIC_RELAXED);
+    return malloc(*size);
+}
+
+/**
+ * @brief: Gives a buffer back to the pool.
+ * @params:
+ * buf: buffer from buf_pool_alloc (NULL is ignored).
+ * size: the capacity buf_pool_alloc reported for it.
+ */
+void buf_pool_free(void *buf, size_t size){
+    if(buf == NULL) return;
+
+    int class_idx = buf_pool_class(size);
+    if(class_idx < 0 || (BUF_POOL_MIN_SZ << class_idx) != size){
+        free(buf);
+        return;
+    }
+
+    if(buf_local_cache.count[class_idx] < BUF_POOL_LOCAL_CAP){
+        buf_local_cache.bufs[class_idx][buf_local_cache.count[class_idx]++] = buf;
+        return;
+    }
+
+    pthread_mutex_lock(&buf_shared_m[class_idx]);
+    if(buf_shared[class_idx].count < BUF_POOL_SHARED_CAP){
+        buf_shared[class_idx].bufs[buf_shared[class_idx].count++] = buf;
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&buf_shared_m[class_idx]);
+
+    free(buf);
+}
+
+/**
+ * @brief: Replaces a buffer with one of at least twice its size (or min_size if that is bigger), keeping the first used bytes.
+ * @params:
+ * buf: the buffer to grow. Given back to the pool on success.
+ * size: capacity of buf. Updated to the new capacity on success.
+ * used: number of bytes in buf to keep.
+ * min_size: the number of bytes needed.
+ * @return: the new buffer, NULL if out of memory (buf is left untouched).
+ */
+void *buf_pool_grow(void *buf, size_t *size, size_t used, size_t min_size){
+    size_t new_size = *size * 2;
+    if(new_size < min_size) new_size = min_size;
+
+    void *new_buf = buf_pool_alloc(new_size, &new_size);
+    if(new_buf == NULL) return NULL;
+
+    memcpy(new_buf, buf, used);
+    buf_pool_free(buf, *size);
+    *size = new_size;
+    return new_buf;
+}
+
+/**
+ * @brief: Moves the calling thread's cached buffers to the shared overflow (or frees them). Call before a pool-using thread exits.
+ */
+void buf_pool_thread_flush(){
+    for(int i = 0; i < BUF_POOL_NUM_CLASSES; i++){
+        pthread_mutex_lock(&buf_shared_m[i]);
+        while(buf_local_cache.count[i] > 0){
+            void *buf = buf_local_cache.bufs[i][--buf_local_cache.count[i]];
+            if(buf_shared[i].count < BUF_POOL_SHARED_CAP){
+                buf_shared[i].bufs[buf_shared[i].count++] = buf;
+            }else{
+                free(buf);
+            }
+        }
+        pthread_mutex_unlock(&buf_shared_m[i]);
+    }
+}
+
+/**
+ * @brief: Frees every pooled buffer. Call once at exit, after all pool-using threads are joined.
+ */
+void buf_pool_destroy(){
+    buf_pool_thread_flush();
+    for(int i = 0; i < BUF_POOL_NUM_CLASSES; i++){
+        pthread_mutex_lock(&buf_shared_m[i]);
+        while(buf_shared[i].count > 0){
+            free(buf_shared[i].bufs[--buf_shared[i].count]);
+        }
+        pthread_mutex_unlock(&buf_shared_m[i]);
+    }
+}
+
+/**
+ * @return: the peak resident set size of the process in kilobytes, -1 on error.
+ */
+long peak_rss_kb(){
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return usage.ru_maxrss; // Linux reports kilobytes
+}
@@ -0,0 +1,190 @@
+/**
+ * @brief: Event loop driving a cURL multi handle with epoll and a timerfd through curl_multi_socket_action.
+ *         libcurl reports which sockets to watch (CURLMOPT_SOCKETFUNCTION) and when it next needs a timeout
+ *         (CURLMOPT_TIMERFUNCTION). Each wakeup then only touches the sockets that have events, instead of
+ *         curl_multi_perform walking every transfer.
+ * @see https://curl.se/libcurl/c/curl_multi_socket_action.html
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <curl/multi.h>
+
+#pragma once
+
+#define EPOLL_MAX_EVENTS 256 // Events handled per epoll_wait call
+
+/**
+ * Event loop state for one multi handle.
+ */
+typedef struct epoll_loop {
+    CURLM *cm; // Multi handle driven by this loop
+    int epfd; // epoll instance watching cURL's sockets and the timer
+    int timerfd; // Fires when libcurl's timeout expires
+    int still_running; // Transfers still running, as last reported by curl_multi_socket_action
+    int wakefd; // Optional eventfd that interrupts the wait (-1 if none)
+} epoll_loop_t;
+
+/**
+ * @brief: CURLMOPT_SOCKETFUNCTION callback. Adds, changes or removes a socket in the epoll set.
+ * @return: 0 (anything else would be an error for libcurl)
+ */
+int epoll_socket_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp){
+    epoll_loop_t *loop = (epoll_loop_t *) userp;
+    struct epoll_event ev;
+
+    if(what == CURL_POLL_REMOVE){
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, s, NULL); // Fails harmlessly if the socket is already closed
+        return 0;
+    }
+
+    ev.events = 0;
+    if(what & CURL_POLL_IN) ev.events |= EPOLLIN;
+    if(what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+    ev.data.fd = s;
+
+        // Modify if already watched, add otherwise
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT){
+        if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, s, &ev) != 0) perror("epoll_ctl");
+    }
+    return 0;
+}
+
+/**
+ * @brief: CURLMOPT_TIMERFUNCTION callback. Arms (or disarms, for -1) the timerfd.
+ * A timeout of 0 means "as soon as possible", but an all-zero timerfd value disarms it, so 1ns is used instead.
+ * @return: 0
+ */
+int epoll_timer_cb(CURLM *cm, long timeout_ms, void *userp){
+    epoll_loop_t *loop = (epoll_loop_t *) userp;
+    struct itimerspec its = {0};
+
+    if(timeout_ms > 0){
+        its.it_value.tv_sec = timeout_ms / 1000;
+        its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }else if(timeout_ms == 0){
+        its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(loop->timerfd, 0, &its, NULL);
+    return 0;
+}
+
+/**
+ * @brief: Creates the epoll instance and timer, and hooks them into the multi handle.
+ * @params:
+ * loop: pointer to an allocated struct. Will be filled by the function.
+ * cm: multi handle to drive. Its transfers must then only be driven through epoll_loop_wait.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int epoll_loop_init(epoll_loop_t *loop, CURLM *cm){
+    loop->cm = cm;
+    loop->still_running = 0;
+    loop->wakefd = -1;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epfd < 0){
+        perror("epoll_create1");
+        return -1;
+    }
+
+    loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(loop->timerfd < 0){
+        perror("timerfd_create");
+        close(loop->epfd);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = loop->timerfd;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timerfd, &ev) != 0){
+        perror("epoll_ctl");
+        close(loop->timerfd);
+        close(loop->epfd);
+        return -1;
+    }
+
+    curl_multi_setopt(cm, CURLMOPT_SOCKETFUNCTION, epoll_socket_cb);
+    curl_multi_setopt(cm, CURLMOPT_SOCKETDATA, (void *)loop);
+    curl_multi_setopt(cm, CURLMOPT_TIMERFUNCTION, epoll_timer_cb);
+    curl_multi_setopt(cm, CURLMOPT_TIMERDATA, (void *)loop);
+
+    return 0;
+}
+
+/**
+ * @brief: Adds an eventfd that interrupts epoll_loop_wait when written to (e.g. new work from another thread).
+ * epoll_loop_wait clears it.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int epoll_loop_add_wakefd(epoll_loop_t *loop, int wakefd){
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = wakefd;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, wakefd, &ev) != 0){
+        perror("epoll_ctl");
+        return -1;
+    }
+    loop->wakefd = wakefd;
+    return 0;
+}
+
+/**
+ * @brief: Waits for socket or timer events and lets libcurl act on them. Updates loop->still_running.
+ * Finished transfers are then read with curl_multi_info_read as usual.
+ * @params:
+ * loop: the event loop
+ * timeout_ms: longest time to wait for an event
+ * @return:
+ * -1: Error
+ * otherwise: number of events handled (0 on timeout)
+ */
+int epoll_loop_wait(epoll_loop_t *loop, int timeout_ms){
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int num_events = epoll_wait(loop->epfd, events, EPOLL_MAX_EVENTS, timeout_ms);
+
+    if(num_events < 0){
+        if(errno == EINTR) return 0;
+        perror("epoll_wait");
+        return -1;
+    }
+
+    for(int i = 0; i < num_events; i++){
+        if(events[i].data.fd == loop->timerfd){
+            uint64_t expirations;
+            if(read(loop->timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("read timerfd");
+            curl_multi_socket_action(loop->cm, CURL_SOCKET_TIMEOUT, 0, &(loop->still_running));
+        }else if(events[i].data.fd == loop->wakefd){
+            uint64_t count;
+            if(read(loop->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read eventfd");
+        }else{
+            int flags = 0;
+            if(events[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+            if(events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+            if(events[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+            curl_multi_socket_action(loop->cm, events[i].data.fd, flags, &(loop->still_running));
+        }
+    }
+
+    return num_events;
+}
+
+/**
+ * @brief: Unhooks the loop from its multi handle and closes the epoll instance and timer.
+ * Call before curl_multi_cleanup.
+ */
+void epoll_loop_cleanup(epoll_loop_t *loop){
+    curl_multi_setopt(loop->cm, CURLMOPT_SOCKETFUNCTION, NULL);
+    curl_multi_setopt(loop->cm, CURLMOPT_TIMERFUNCTION, NULL);
+    close(loop->timerfd);
+    close(loop->epfd);
+}
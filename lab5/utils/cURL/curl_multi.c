@@ -65,14 +65,21 @@
 //     return curl_handle;
 // }
 
-int curl_multi_init_easy(CURLM *cm, const char *url)
+CURL *curl_multi_init_easy(CURLM *cm, const char *url)
 {
-  RECV_BUF *recv_buf = malloc(sizeof(RECV_BUF));
+  RECV_BUF *recv_buf = calloc(1, sizeof(RECV_BUF)); /* zeroed, so cleanup is safe if init fails part way */
+  if ( recv_buf == NULL ) {
+    perror("calloc");
+    return NULL;
+  }
+
   CURL *curl_handle = easy_handle_init(recv_buf, url);
 
   if ( curl_handle == NULL ) {
     fprintf(stderr, "Curl initialization failed. Exiting...\n");
-    return 1;
+    recv_buf_cleanup(recv_buf);
+    free(recv_buf);
+    return NULL;
   }
 
   curl_easy_setopt(curl_handle, CURLOPT_PRIVATE, recv_buf);
@@ -80,5 +87,195 @@ int curl_multi_init_easy(CURLM *cm, const char *url)
   /* Add to Multi */
   curl_multi_add_handle(cm, curl_handle);
 
+  return curl_handle;
+}
+
+/**
+ * @brief free list of finished easy handles, each with its receive buffer
+ *        (CURLOPT_PRIVATE), so a new transfer reuses the handle and its options
+ *        instead of curl_easy_init + full option setup + a new buffer.
+ */
+typedef struct easy_free_list {
+  CURL **handles;   /* stack of idle handles */
+  int count;        /* number of idle handles */
+  int capacity;     /* idle handles kept at most, the rest are cleaned up */
+  CURL **active;    /* handles currently on the multi handle (libcurl cannot list them) */
+  int num_active;   /* number of active handles */
+  int active_capacity; /* size of active, grows if needed */
+  long created;     /* handles made by easy_handle_init */
+  long reused;      /* transfers started on a recycled handle */
+} easy_free_list_t;
+
+/**
+ * @brief create an empty free list
+ * @param int capacity maximum number of idle handles to keep
+ * @return 0 on success; 1 on fail
+ */
+int easy_free_list_init(easy_free_list_t *list, int capacity)
+{
+  list->handles = malloc(capacity * sizeof(CURL *));
+  list->active = malloc(capacity * sizeof(CURL *));
+  if ( list->handles == NULL || list->active == NULL ) {
+    free(list->handles);
+    free(list->active);
+    return 1;
+  }
+  list->count = 0;
+  list->capacity = capacity;
+  list->num_active = 0;
+  list->active_capacity = capacity;
+  list->created = 0;
+  list->reused = 0;
   return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief clean up an easy handle together with its receive buffer (if it still has one)
+ */
+void easy_handle_free(CURL *curl_handle)
+{
+  RECV_BUF *recv_buf = NULL;
+  curl_easy_getinfo(curl_handle, CURLINFO_PRIVATE, &recv_buf);
+  curl_easy_cleanup(curl_handle);
+  if ( recv_buf != NULL ) {
+    recv_buf_cleanup(recv_buf);
+    free(recv_buf);
+  }
+}
+
+/**
+ * @brief remember that curl_handle is on the multi handle
+ * @return 0 on success; 1 on fail
+ */
+int easy_active_add(easy_free_list_t *list, CURL *curl_handle)
+{
+  if ( list->num_active == list->active_capacity ) {
+    CURL **p = realloc(list->active, 2 * list->active_capacity * sizeof(CURL *));
+    if ( p == NULL ) {
+      return 1;
+    }
+    list->active = p;
+    list->active_capacity *= 2;
+  }
+  list->active[list->num_active++] = curl_handle;
+  return 0;
+}
+
+/**
+ * @brief forget curl_handle as active (swap with the last one, order does not matter)
+ */
+void easy_active_remove(easy_free_list_t *list, CURL *curl_handle)
+{
+  for ( int i = 0; i < list->num_active; i++ ) {
+    if ( list->active[i] == curl_handle ) {
+      list->active[i] = list->active[--list->num_active];
+      return;
+    }
+  }
+}
+
+/**
+ * @brief start a transfer of url on the multi handle, on a recycled handle if there is one
+ * @param CURLM *cm the multi handle
+ * @param easy_free_list_t *list idle handles
+ * @param const char *url is the target url to fetch resoruce
+ * @return 0 on success; 1 on fail
+ */
+int curl_multi_add_url(CURLM *cm, easy_free_list_t *list, const char *url)
+{
+  CURL *curl_handle;
+  RECV_BUF *recv_buf = NULL;
+
+  if ( list->count == 0 ) {
+    curl_handle = curl_multi_init_easy(cm, url);
+    if ( curl_handle == NULL ) {
+      return 1;
+    }
+    list->created++;
+    if ( easy_active_add(list, curl_handle) != 0 ) {
+      curl_multi_remove_handle(cm, curl_handle);
+      easy_handle_free(curl_handle);
+      return 1;
+    }
+    return 0;
+  }
+
+  curl_handle = list->handles[--list->count];
+  curl_easy_getinfo(curl_handle, CURLINFO_PRIVATE, &recv_buf);
+
+  if ( recv_buf == NULL ) {
+    /* its buffer was handed to a parser thread, give it a new one */
+    recv_buf = malloc(sizeof(RECV_BUF));
+    if ( recv_buf == NULL || recv_buf_init(recv_buf, BUF_SIZE) != 0 ) {
+      free(recv_buf);
+      curl_easy_cleanup(curl_handle);
+      return 1;
+    }
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)recv_buf);
+    curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *)recv_buf);
+    curl_easy_setopt(curl_handle, CURLOPT_PRIVATE, recv_buf);
+  }
+
+  if ( easy_handle_reuse(curl_handle, recv_buf, url) != 0 ) {
+    easy_handle_free(curl_handle);
+    return 1;
+  }
+  if ( easy_active_add(list, curl_handle) != 0 ) {
+    easy_handle_free(curl_handle);
+    return 1;
+  }
+  list->reused++;
+
+  /* Add to Multi */
+  curl_multi_add_handle(cm, curl_handle);
+
+  return 0;
+}
+
+/**
+ * @brief take a finished transfer off the multi handle and keep the handle for the next url
+ * @param CURLM *cm the multi handle
+ * @param easy_free_list_t *list idle handles
+ * @param CURL *curl_handle the finished handle. Set its CURLOPT_PRIVATE to NULL first
+ *        if its receive buffer was given away.
+ */
+void curl_multi_recycle(CURLM *cm, easy_free_list_t *list, CURL *curl_handle)
+{
+  curl_multi_remove_handle(cm, curl_handle);
+  easy_active_remove(list, curl_handle);
+
+  if ( list->count == list->capacity ) {
+    easy_handle_free(curl_handle);
+    return;
+  }
+  list->handles[list->count++] = curl_handle;
+}
+
+/**
+ * @brief cancel every transfer still on the multi handle: each is taken off right away
+ *        (closing its connection if the response was not read to the end) and recycled.
+ *        Nothing is waited for and none of them is processed.
+ * @return number of transfers cancelled
+ */
+int curl_multi_cancel_all(CURLM *cm, easy_free_list_t *list)
+{
+  int cancelled = list->num_active;
+
+  while ( list->num_active > 0 ) {
+    curl_multi_recycle(cm, list, list->active[list->num_active - 1]);
+  }
+  return cancelled;
+}
+
+/**
+ * @brief clean up every idle handle and the list itself. Cancel active transfers first
+ *        (curl_multi_cancel_all).
+ */
+void easy_free_list_cleanup(easy_free_list_t *list)
+{
+  while ( list->count > 0 ) {
+    easy_handle_free(list->handles[--list->count]);
+  }
+  free(list->handles);
+  free(list->active);
+}
@@ -37,22 +37,50 @@
 #include <libxml/parser.h>
 #include <libxml/xpath.h>
 #include <libxml/uri.h>
+#include "href_scan.c"
+#include "buf_pool.c"
 
 
 
 #define SEED_URL "http://ece252-1.uwaterloo.ca/lab4/"
 #define ECE252_HEADER "X-Ece252-Fragment: "
-#define BUF_SIZE 1048576  /* 1024*1024 = 1M */
-#define BUF_INC  524288   /* 1024*512  = 0.5M */
+#define BUF_SIZE 16384    /* 16K first size class; grows by doubling (buf_pool.c) */
+#define CONTENT_LENGTH_HEADER "Content-Length: "
+#define CONTENT_TYPE_HEADER "Content-Type: "
+#define RECV_MAX_SIZE 8388608      /* 8M: bigger bodies are abandoned, not crawled */
+#define DRAIN_MAX_SIZE 65536       /* 64K: unwanted bodies up to this size are read and dropped so the
+                                      connection stays reusable; bigger (or unknown) ones end the transfer */
 
 #define CT_PNG  "image/png"
 #define CT_HTML "text/html"
 #define CT_PNG_LEN  9
 #define CT_HTML_LEN 9
 #define PNG_HDR_SIZE    8 /* number of bytes of png image signature data */
+
+#define BODY_KEEP 0 /* store the whole body (HTML) */
+#define BODY_PNG  1 /* store the PNG signature only */
+#define BODY_DROP 2 /* store nothing (ignored content type or error status) */
+
+#define HREF_PARSER_XML    0 /* libxml2 DOM + //a/@href XPath (find_http) */
+#define HREF_PARSER_STREAM 1 /* streaming tokenizer (find_http_stream in href_scan.c) */
+
+#define HTTP_MODE_1   0 /* HTTP/1.1 only: one transfer per connection at a time */
+#define HTTP_MODE_2   1 /* HTTP/2 where TLS (ALPN) offers it, HTTP/1.1 otherwise */
+#define HTTP_MODE_H2C 2 /* HTTP/2 over plain TCP with prior knowledge (h2c): the server must speak it */
+
 typedef unsigned char U8;
 const int png_header[PNG_HDR_SIZE] = {-119, 80, 78, 71, 13, 10, 26, 10};
 
+/* which href extractor process_html uses. Set once by main before any transfer starts */
+int href_parser = HREF_PARSER_XML;
+
+/* which HTTP version easy_handle_init asks for. Set once by main before any transfer starts */
+int http_mode = HTTP_MODE_1;
+
+/* set (by cancel_transfers) once the crawl has what it needs: every transfer still
+   running is then ended by its next call back instead of being read to the end. Atomic */
+int transfers_cancelled = 0;
+
 #define max(a, b) \
    ({ __typeof__ (a) _a = (a); \
        __typeof__ (b) _b = (b); \
@@ -64,6 +92,11 @@ typedef struct recv_buf2 {
     size_t max_size; /* max capacity of buf in bytes*/
     int seq;         /* >=0 sequence number extracted from http header */
                      /* <0 indicates an invalid seq number */
+    int status;      /* status code of the response whose headers are being received */
+    long content_length; /* Content-Length of that response, <0 if not sent */
+    int body_kind;   /* BODY_KEEP, BODY_PNG or BODY_DROP, decided when the headers end */
+    int close_early; /* 1 if the transfer is ended once nothing more of the body is wanted */
+    int cut_short;   /* 1 if a call back ended the transfer on purpose (not a real error) */
 } RECV_BUF;
 
 
@@ -73,12 +106,20 @@ xmlXPathObjectPtr getnodeset (xmlDocPtr doc, xmlChar *xpath);
 int find_http(char *fname, int size, int follow_relative_links, const char *base_url, Node_t **to_visit);
 size_t header_cb_curl(char *p_recv, size_t size, size_t nmemb, void *userdata);
 size_t write_cb_curl3(char *p_recv, size_t size, size_t nmemb, void *p_userdata);
+int xferinfo_cb_curl(void *p_userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+void cancel_transfers(void);
+int http_mode_from_name(const char *name);
+const char *http_mode_name(int mode);
 int recv_buf_init(RECV_BUF *ptr, size_t max_size);
 int recv_buf_cleanup(RECV_BUF *ptr);
+void recv_buf_reset(RECV_BUF *ptr);
+int recv_buf_complete(CURLcode res, RECV_BUF *ptr);
 void cleanup(CURL *curl, RECV_BUF *ptr);
 int write_file(const char *path, const void *in, size_t len);
 CURL *easy_handle_init(RECV_BUF *ptr, const char *url);
+int easy_handle_reuse(CURL *curl_handle, RECV_BUF *ptr, const char *url);
 int process_data(CURL *curl_handle, RECV_BUF *p_recv_buf, Node_t **to_visit, Node_t **png_urls);
+int process_html_body(const char *url, RECV_BUF *p_recv_buf, Node_t **to_visit);
 
 // Returns 1 on equal, 0 otherwise
 int png_header_checker(char* data){
@@ -160,15 +201,16 @@ int find_http(char *buf, int size, int follow_relative_links, const char *base_u
             if ( href != NULL && !strncmp((const char *)href, "http", 4) ) {
                 recordurl = (char *) malloc((1 + strlen((const char *)href)) * sizeof(char));
                 strcpy(recordurl, (char *)href);
-                //push to linked list
-                push(to_visit, recordurl);
+                //push to linked list (in canonical form, so spellings of one URL dedup)
+                push(to_visit, url_canonicalize(recordurl));
             }
             xmlFree(href);
         }
         xmlXPathFreeObject (result);
     }
     xmlFreeDoc(doc);
-    xmlCleanupParser();
+    /* xmlCleanupParser() is not called here: it frees global parser state other threads may be using.
+       main calls it once at exit. */
     return 0;
 }
 /**
@@ -184,12 +226,19 @@ int find_http(char *buf, int size, int follow_relative_links, const char *base_u
  * header data are received.  we are only interested in the ECE252_HEADER line 
  * received so that we can extract the image sequence number from it. This
  * explains the if block in the code.
+ * The status line, Content-Type and Content-Length are also looked at, so that
+ * when the headers end we already know how much of the body is worth keeping:
+ * bodies we would throw away (error status, not HTML or PNG) are dropped, and a
+ * transfer that is not worth draining is ended by returning 0 (CURLE_WRITE_ERROR).
  */
 size_t header_cb_curl(char *p_recv, size_t size, size_t nmemb, void *userdata)
 {
     int realsize = size * nmemb;
     RECV_BUF *p = userdata;
 
+    if (__atomic_load_n(&transfers_cancelled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
 #ifdef DEBUG1_
     //printf("%s", p_recv);
 #endif /* DEBUG1_ */
@@ -199,6 +248,56 @@ size_t header_cb_curl(char *p_recv, size_t size, size_t nmemb, void *userdata)
         /* extract img sequence number */
 	p->seq = atoi(p_recv + strlen(ECE252_HEADER));
 
+    } else if (realsize > 5 && strncmp(p_recv, "HTTP/", 5) == 0) {
+
+        /* status line: a new response starts (there is one per redirect) */
+        char *code = memchr(p_recv, ' ', realsize);
+        p->status = (code != NULL) ? atoi(code + 1) : 0;
+        p->content_length = -1;
+        p->body_kind = BODY_DROP; /* until a Content-Type says otherwise */
+
+    } else if (realsize > strlen(CONTENT_TYPE_HEADER) &&
+        strncasecmp(p_recv, CONTENT_TYPE_HEADER, strlen(CONTENT_TYPE_HEADER)) == 0) {
+
+        /* same matching as process_data */
+        if ( memmem(p_recv, realsize, CT_HTML, CT_HTML_LEN) ) {
+            p->body_kind = BODY_KEEP;
+        } else if ( memmem(p_recv, realsize, CT_PNG, CT_PNG_LEN) ) {
+            p->body_kind = BODY_PNG;
+        }
+
+    } else if (realsize > strlen(CONTENT_LENGTH_HEADER) &&
+        strncasecmp(p_recv, CONTENT_LENGTH_HEADER, strlen(CONTENT_LENGTH_HEADER)) == 0) {
+
+        p->content_length = strtol(p_recv + strlen(CONTENT_LENGTH_HEADER), NULL, 10);
+
+    } else if ((realsize == 2 && p_recv[0] == '\r') || (realsize == 1 && p_recv[0] == '\n')) {
+
+        /* end of headers. 1xx and redirects carry no body for us, the next response decides */
+        if (p->status < 200 || (p->status >= 300 && p->status < 400)) {
+            return realsize;
+        }
+        if (p->status >= 400) {
+            p->body_kind = BODY_DROP;
+        }
+        p->close_early = (p->content_length < 0 || p->content_length > DRAIN_MAX_SIZE);
+
+        if (p->body_kind == BODY_DROP && p->close_early) {
+            p->cut_short = 1;
+            return 0;
+        }
+        if (p->body_kind == BODY_KEEP && p->content_length > RECV_MAX_SIZE) {
+            return 0; /* oversized page: give up on it */
+        }
+        if (p->body_kind == BODY_KEEP && p->content_length >= 0 &&
+            (size_t)p->content_length + 1 > p->max_size) {
+            /* size the buffer for the whole body up front (+1 for the terminating 0).
+               With compression the decoded body can still be bigger, write_cb_curl3 grows it then */
+            char *q = buf_pool_grow(p->buf, &(p->max_size), p->size, p->content_length + 1);
+            if (q != NULL) {
+                p->buf = q;
+            }
+        }
     }
     return realsize;
 }
@@ -212,23 +311,49 @@ size_t header_cb_curl(char *p_recv, size_t size, size_t nmemb, void *userdata)
  *        cast it to the proper struct to make good use of it.
  *        This function maybe invoked more than once by one invokation of
  *        curl_easy_perform().
+ *        Only the PNG signature of an image is kept: process_png checks nothing else.
  */
 
 size_t write_cb_curl3(char *p_recv, size_t size, size_t nmemb, void *p_userdata)
 {
     size_t realsize = size * nmemb;
     RECV_BUF *p = (RECV_BUF *)p_userdata;
- 
+
+    if (__atomic_load_n(&transfers_cancelled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    if (p->body_kind == BODY_PNG) {
+        size_t n = PNG_HDR_SIZE - p->size;
+        if (n > realsize) {
+            n = realsize;
+        }
+        memcpy(p->buf + p->size, p_recv, n);
+        p->size += n;
+        p->buf[p->size] = 0;
+        if (p->size < PNG_HDR_SIZE) {
+            return realsize;
+        }
+        p->body_kind = BODY_DROP; /* signature complete, the rest is not needed */
+    }
+    if (p->body_kind == BODY_DROP) {
+        if (p->close_early) {
+            p->cut_short = 1;
+            return 0;
+        }
+        return realsize;
+    }
+
+    if (p->size + realsize > RECV_MAX_SIZE) {
+        return 0; /* oversized page (no Content-Length to catch it earlier) */
+    }
     if (p->size + realsize + 1 > p->max_size) {/* hope this rarely happens */ 
         /* received data is not 0 terminated, add one byte for terminating 0 */
-        size_t new_size = p->max_size + max(BUF_INC, realsize + 1);   
-        char *q = realloc(p->buf, new_size);
+        char *q = buf_pool_grow(p->buf, &(p->max_size), p->size, p->size + realsize + 1);
         if (q == NULL) {
-            //perror("realloc"); /* out of memory */
+            //perror("buf_pool_grow"); /* out of memory */
             return -1;
         }
         p->buf = q;
-        p->max_size = new_size;
     }
 
     memcpy(p->buf + p->size, p_recv, realsize); /*copy data from libcurl*/
@@ -238,6 +363,54 @@ size_t write_cb_curl3(char *p_recv, size_t size, size_t nmemb, void *p_userdata)
     return realsize;
 }
 
+/**
+ * @brief progress call back. libcurl calls it about once a second even while a transfer
+ *        is waiting on the network, so a stalled transfer sees a cancel that the write and
+ *        header call backs would only see when the next bytes arrive.
+ * @return 0 to continue; non zero ends the transfer with CURLE_ABORTED_BY_CALLBACK
+ */
+
+int xferinfo_cb_curl(void *p_userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    return __atomic_load_n(&transfers_cancelled, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief ends every transfer still running, on every thread, at its next call back.
+ *        Transfers ended this way fail (recv_buf_complete is false), they are not processed.
+ */
+
+void cancel_transfers(void)
+{
+    __atomic_store_n(&transfers_cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief map a command line name ("1.1", "2" or "h2c") to its HTTP_MODE_*
+ * @return the mode; -1 if the name is unknown
+ */
+
+int http_mode_from_name(const char *name)
+{
+    if (strcmp(name, "1.1") == 0) {
+        return HTTP_MODE_1;
+    } else if (strcmp(name, "2") == 0) {
+        return HTTP_MODE_2;
+    } else if (strcmp(name, "h2c") == 0) {
+        return HTTP_MODE_H2C;
+    }
+    return -1;
+}
+
+/**
+ * @brief command line name of an HTTP_MODE_* (for the statistics)
+ */
+
+const char *http_mode_name(int mode)
+{
+    return mode == HTTP_MODE_H2C ? "h2c" : (mode == HTTP_MODE_2 ? "2" : "1.1");
+}
+
 
 int recv_buf_init(RECV_BUF *ptr, size_t max_size)
 {
@@ -247,25 +420,53 @@ int recv_buf_init(RECV_BUF *ptr, size_t max_size)
         return 1;
     }
 
-    p = malloc(max_size);
+    p = buf_pool_alloc(max_size, &max_size);
     if (p == NULL) {
 	return 2;
     }
     
     ptr->buf = p;
     ptr->size = 0;
-    ptr->max_size = max_size;
-    ptr->seq = -1;              /* valid seq should be positive */
+    ptr->max_size = max_size;   /* the size class can be bigger than asked for */
+    recv_buf_reset(ptr);
     return 0;
 }
 
+/**
+ * @brief empty a receive buffer for a new transfer, keeping its memory
+ * @param RECV_BUF *ptr the buffer
+ */
+void recv_buf_reset(RECV_BUF *ptr)
+{
+    ptr->size = 0;
+    ptr->seq = -1;              /* valid seq should be positive */
+    ptr->status = 0;
+    ptr->content_length = -1;
+    ptr->body_kind = BODY_KEEP; /* non-HTTP transfers have no headers to decide from */
+    ptr->close_early = 0;
+    ptr->cut_short = 0;
+}
+
+/**
+ * @brief tell whether a finished transfer has data worth processing
+ * @param CURLcode res result of the transfer
+ * @param RECV_BUF *ptr its receive buffer
+ * @return 1 if the transfer succeeded, or was ended early on purpose by the call backs
+ *         (e.g. after the PNG signature); 0 otherwise
+ */
+int recv_buf_complete(CURLcode res, RECV_BUF *ptr)
+{
+    return res == CURLE_OK || (res == CURLE_WRITE_ERROR && ptr->cut_short);
+}
+
 int recv_buf_cleanup(RECV_BUF *ptr)
 {
     if (ptr == NULL) {
 	return 1;
     }
     
-    free(ptr->buf);
+    buf_pool_free(ptr->buf, ptr->max_size);
+    ptr->buf = NULL;
     ptr->size = 0;
     ptr->max_size = 0;
     return 0;
@@ -352,6 +553,20 @@ CURL *easy_handle_init(RECV_BUF *ptr, const char *url)
     /* user defined data structure passed to the call back function */
     curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *)ptr);
 
+    /* HTTP version. With HTTP/2 a new transfer waits for a connection that can take
+       one more stream rather than opening its own (PIPEWAIT) */
+    if ( http_mode == HTTP_MODE_1 ) {
+        curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
+    } else {
+        curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, http_mode == HTTP_MODE_H2C ?
+                         (long)CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl_handle, CURLOPT_PIPEWAIT, 1L);
+    }
+
+    /* register progress call back so cancel_transfers also reaches idle transfers */
+    curl_easy_setopt(curl_handle, CURLOPT_XFERINFOFUNCTION, xferinfo_cb_curl);
+    curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 0L);
+
     /* some servers requires a user-agent field */
     curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "ece252 lab4 crawler");
 
@@ -381,13 +596,55 @@ CURL *easy_handle_init(RECV_BUF *ptr, const char *url)
     return curl_handle;
 }
 
+/**
+ * @brief point an easy handle made by easy_handle_init at a new url, keeping its options,
+ *        its receive buffer and its connection for the next transfer (no curl_easy_reset).
+ * @param CURL *curl_handle handle returned by easy_handle_init
+ * @param RECV_BUF *ptr the same buffer that was passed to easy_handle_init, emptied for the new transfer
+ * @param const char *url is the target url to fetch resoruce
+ * @return 0 on success; 1 on fail
+ */
+
+int easy_handle_reuse(CURL *curl_handle, RECV_BUF *ptr, const char *url)
+{
+    if ( curl_handle == NULL || ptr == NULL || url == NULL ) {
+        return 1;
+    }
+
+    recv_buf_reset(ptr);
+
+    /* specify URL to get */
+    if ( curl_easy_setopt(curl_handle, CURLOPT_URL, url) != CURLE_OK ) {
+        return 1;
+    }
+    return 0;
+}
+
 int process_html(CURL *curl_handle, RECV_BUF *p_recv_buf, Node_t **to_visit)
 {
-    int follow_relative_link = 1;
     char *url = NULL; 
 
     curl_easy_getinfo(curl_handle, CURLINFO_EFFECTIVE_URL, &url);
-    find_http(p_recv_buf->buf, p_recv_buf->size, follow_relative_link, url, to_visit); 
+    return process_html_body(url, p_recv_buf, to_visit);
+}
+
+/**
+ * @brief extract the links of a received HTML page. Needs no curl handle, so it
+ *        can run on another thread once the transfer is cleaned up.
+ * @param const char *url the effective url of the page (base for relative links)
+ * @param RECV_BUF p_recv_buf contains the received page
+ * @param Node_t **to_visit the links found are pushed here
+ * @return 0
+ */
+int process_html_body(const char *url, RECV_BUF *p_recv_buf, Node_t **to_visit)
+{
+    int follow_relative_link = 1;
+
+    if ( href_parser == HREF_PARSER_STREAM ) {
+        find_http_stream(p_recv_buf->buf, p_recv_buf->size, follow_relative_link, url, to_visit);
+    } else {
+        find_http(p_recv_buf->buf, p_recv_buf->size, follow_relative_link, url, to_visit);
+    }
     return 0;
 }
 
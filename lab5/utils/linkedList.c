@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#pragma once
+
 typedef struct Node
 {
     // Character Array
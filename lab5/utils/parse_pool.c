@@ -0,0 +1,145 @@
+/**
+ * @brief: Fixed pool of worker threads fed through a bounded queue, so the reactors can hand CPU heavy work
+ *         (HTML parsing) off their event loops. Submitting never blocks: when the queue is full the caller is
+ *         told so and does the work itself, which slows the loop down instead of letting the queue grow.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#pragma once
+
+/**
+ * One unit of work: fnc(arg). fnc owns arg.
+ */
+typedef struct parse_task {
+    void (*fnc)(void *);
+    void *arg;
+} parse_task_t;
+
+typedef struct parse_pool {
+    parse_task_t *tasks; // Ring buffer of queued tasks
+    int capacity; // Size of the ring
+    int head; // Index of the oldest task
+    int count; // Number of queued tasks
+    int stop; // 1 once the pool is shutting down
+    pthread_mutex_t lock; // Access Control for all the fields above
+    pthread_cond_t not_empty; // Signalled when a task is queued or the pool stops
+    pthread_t *threads; // Worker threads
+    int num_threads; // Number of worker threads
+    void (*on_exit)(void); // Called by each worker before it exits (NULL for none)
+} parse_pool_t;
+
+/**
+ * @brief: Worker thread. Runs tasks until the pool stops and the queue is empty.
+ */
+void *parse_pool_worker(void *arg){
+    parse_pool_t *pool = (parse_pool_t *) arg;
+    parse_task_t task;
+
+    while(1){
+        /** @critical_section: Take a Task **/
+        pthread_mutex_lock(&(pool->lock));
+        while(pool->count == 0 && !pool->stop){
+            pthread_cond_wait(&(pool->not_empty), &(pool->lock));
+        }
+        if(pool->count == 0){ // Stopped and drained
+            pthread_mutex_unlock(&(pool->lock));
+            break;
+        }
+        task = pool->tasks[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pthread_mutex_unlock(&(pool->lock));
+        /** @end_critical_section: **/
+
+        task.fnc(task.arg);
+    }
+
+    if(pool->on_exit != NULL) pool->on_exit();
+    return NULL;
+}
+
+/**
+ * @brief: Creates the queue and starts the workers.
+ * @params:
+ * pool: pointer to an allocated struct. Will be filled by the function.
+ * num_threads: number of workers (at least 1)
+ * capacity: maximum number of queued tasks
+ * on_exit: called by each worker before it exits, e.g. to give back thread local caches (NULL for none)
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int parse_pool_init(parse_pool_t *pool, int num_threads, int capacity, void (*on_exit)(void)){
+    pool->tasks = (parse_task_t *) malloc(capacity * sizeof(parse_task_t));
+    pool->threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    if(pool->tasks == NULL || pool->threads == NULL){
+        free(pool->tasks);
+        free(pool->threads);
+        return -1;
+    }
+    pool->capacity = capacity;
+    pool->head = 0;
+    pool->count = 0;
+    pool->stop = 0;
+    pool->num_threads = num_threads;
+    pool->on_exit = on_exit;
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->not_empty), NULL);
+
+    for(int i = 0; i < num_threads; i++){
+        if(pthread_create(pool->threads + i, NULL, parse_pool_worker, (void *) pool) != 0){
+            perror("pthread_create");
+            pool->num_threads = i;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief: Queues fnc(arg) for a worker. Thread-safe, never blocks.
+ * @return:
+ * -1: Queue full (or pool stopped), the caller still owns arg
+ * 0: Success
+ */
+int parse_pool_try_submit(parse_pool_t *pool, void (*fnc)(void *), void *arg){
+    int result = -1;
+
+    /** @critical_section: Queue the Task **/
+    pthread_mutex_lock(&(pool->lock));
+    if(!pool->stop && pool->count < pool->capacity){
+        parse_task_t *task = pool->tasks + ((pool->head + pool->count) % pool->capacity);
+        task->fnc = fnc;
+        task->arg = arg;
+        pool->count++;
+        result = 0;
+        pthread_cond_signal(&(pool->not_empty));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    /** @end_critical_section: **/
+
+    return result;
+}
+
+/**
+ * @brief: Stops the pool: queued tasks still run, then the workers exit and are joined.
+ */
+void parse_pool_destroy(parse_pool_t *pool){
+    pthread_mutex_lock(&(pool->lock));
+    pool->stop = 1;
+    pthread_cond_broadcast(&(pool->not_empty));
+    pthread_mutex_unlock(&(pool->lock));
+
+    for(int i = 0; i < pool->num_threads; i++){
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&(pool->lock));
+    pthread_cond_destroy(&(pool->not_empty));
+    free(pool->tasks);
+    free(pool->threads);
+}
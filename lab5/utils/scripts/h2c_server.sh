@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# Local h2c (HTTP/2 over plain TCP) test server for findpng3 -h h2c, using nghttpd from nghttp2
+# (Debian/Ubuntu package nghttp2-server). Serves a directory, e.g. a saved copy of the lab4 site,
+# then crawls it once over HTTP/1.1 and once over h2c and prints the connection statistics of each.
+# Run from lab5 after make:
+#   ./utils/scripts/h2c_server.sh SITE_DIR [PORT] [T] [M]
+
+SITE_DIR=${1:?usage: $0 SITE_DIR [PORT] [T] [M]}
+PORT=${2:-8080}
+T=${3:-10}
+M=${4:-50}
+SEED_URL=http://127.0.0.1:$PORT/
+
+if ! command -v nghttpd > /dev/null; then
+    echo "nghttpd not found (install nghttp2-server)" >&2
+    exit 1
+fi
+
+nghttpd --no-tls -d "$SITE_DIR" $PORT &
+SERVER=$!
+trap 'kill $SERVER' EXIT
+sleep 1
+
+for MODE in 1.1 h2c
+do
+    # findpng3 prints its statistics on stderr and its execution time as the last line of stdout
+    ./findpng3 -t $T -m $M -h $MODE $SEED_URL 2>&1 >/dev/null | grep connections
+done
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+# Scaling benchmark for findpng3 reactors: runs the crawler with 1 to MAX_R reactors
+# and writes the average execution time of each to a csv (same layout as lab4_eceubuntu1.csv).
+# Run from lab5 after make:
+#   ./utils/scripts/reactor_scaling.sh [MAX_R] [T] [M] [RUNS] [SEED_URL]
+
+MAX_R=${1:-`nproc`}
+T=${2:-64}
+M=${3:-50}
+RUNS=${4:-5}
+SEED_URL=${5:-http://ece252-1.uwaterloo.ca/lab4/}
+OUT=results/reactor_scaling.csv
+
+mkdir -p results
+echo "R,T,M,Time" > $OUT
+
+R=1
+while [ $R -le $MAX_R ]
+do
+    # findpng3 prints its execution time as the last line of stdout
+    TIME=`for i in $(seq $RUNS); do ./findpng3 -r $R -t $T -m $M $SEED_URL 2>/dev/null | tail -1 | awk '{print $(NF-1)}'; done | awk '{s += $1} END {printf "%.6f", s / NR}'`
+    echo "$R,$T,$M,$TIME" | tee -a $OUT
+    R=`expr $R + 1`
+done
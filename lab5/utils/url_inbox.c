@@ -0,0 +1,101 @@
+/**
+ * @brief: Lock-free multi-producer single-consumer inbox of URLs.
+ *         Any thread can push (a compare-and-swap onto a stack of Node_t), only the owner takes,
+ *         and it takes everything at once (one exchange). An eventfd wakes the owner up when the
+ *         inbox goes from empty to non-empty, so it can sleep in epoll next to its sockets.
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "linkedList.c"
+
+#pragma once
+
+typedef struct url_inbox {
+    Node_t *head; // Stack of pushed URLs (newest first). Atomic.
+    int eventfd; // Readable while there may be URLs to take
+} url_inbox_t;
+
+/**
+ * @brief: Initializes an empty inbox.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int url_inbox_init(url_inbox_t *inbox){
+    inbox->head = NULL;
+    inbox->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(inbox->eventfd < 0){
+        perror("eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief: Wakes the owner of the inbox (also used to tell it to stop).
+ */
+void url_inbox_wake(url_inbox_t *inbox){
+    uint64_t one = 1;
+    if(write(inbox->eventfd, &one, sizeof(one)) < 0) perror("write eventfd");
+}
+
+/**
+ * @brief: Pushes a list of nodes in one step. Thread-safe, lock-free.
+ * @params:
+ * inbox: destination inbox
+ * first: first node of the list to push
+ * last: last node of that list (its next pointer is overwritten)
+ */
+void url_inbox_push_list(url_inbox_t *inbox, Node_t *first, Node_t *last){
+    Node_t *old_head = __atomic_load_n(&(inbox->head), __ATOMIC_RELAXED);
+    do{
+        last->next = old_head;
+    }while(!__atomic_compare_exchange_n(&(inbox->head), &old_head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        // Only the push that makes the inbox non-empty needs to wake the owner
+    if(old_head == NULL) url_inbox_wake(inbox);
+}
+
+/**
+ * @brief: Pushes one URL. Thread-safe, lock-free.
+ * @params:
+ * url: malloced string. The inbox owns it from now on (it is freed on error).
+ * @return:
+ * -1: Error (out of memory)
+ * 0: Success
+ */
+int url_inbox_push(url_inbox_t *inbox, char *url){
+    Node_t *node = (Node_t *)malloc(sizeof(Node_t));
+    if(node == NULL){
+        perror("malloc");
+        free(url);
+        return -1;
+    }
+    node->data = url;
+    url_inbox_push_list(inbox, node, node);
+    return 0;
+}
+
+/**
+ * @brief: Takes every URL in the inbox. Only called by the owner.
+ * The eventfd is cleared by whoever waits on it (see epoll_loop_wait), not here.
+ * @return: list of the URLs (newest first), NULL if empty. Free with freeMemory.
+ */
+Node_t *url_inbox_take_all(url_inbox_t *inbox){
+    if(__atomic_load_n(&(inbox->head), __ATOMIC_RELAXED) == NULL) return NULL;
+    return __atomic_exchange_n(&(inbox->head), NULL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief: Frees whatever is left in the inbox and closes its eventfd.
+ */
+void url_inbox_destroy(url_inbox_t *inbox){
+    freeMemory(__atomic_exchange_n(&(inbox->head), NULL, __ATOMIC_ACQUIRE));
+    close(inbox->eventfd);
+}
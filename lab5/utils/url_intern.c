@@ -0,0 +1,276 @@
+/**
+ * @brief: URL intern table. Every distinct URL is copied once into a bump arena and gets a 32 bit ID,
+ *         so the visited set, the frontier and the log are arrays of IDs instead of a malloced string
+ *         (and a list node) per entry. Not thread-safe: each table has a single owner (a reactor).
+ * Written by Devon Miller-Junk and Braden Bakker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#pragma once
+
+#define URL_ARENA_CHUNK_SZ 65536 // Arena grows by chunks of this size (bigger for a longer URL)
+#define URL_ID_NONE ((url_id_t) -1)
+
+typedef uint32_t url_id_t;
+
+typedef struct url_arena_chunk {
+    struct url_arena_chunk *next; // Previous chunk (newest first)
+    size_t used; // Bytes handed out
+    size_t size; // Bytes in data
+    char data[];
+} url_arena_chunk_t;
+
+typedef struct url_intern {
+    url_arena_chunk_t *chunks; // Arena holding the strings
+    const char **strings; // ID -> string in the arena
+    uint32_t *hashes; // ID -> hash of its string (for probing and growing without rehashing strings)
+    uint32_t count; // Number of IDs handed out
+    uint32_t capacity; // Size of strings and hashes
+    url_id_t *slots; // Open addressing table of IDs (URL_ID_NONE if empty), at most half full
+    uint32_t mask; // Number of slots - 1 (a power of two)
+    size_t arena_bytes; // Bytes allocated for the arena
+} url_intern_t;
+
+/**
+ * Growable array of IDs, used as a stack (frontier) or an append-only list (log).
+ */
+typedef struct url_id_list {
+    url_id_t *ids;
+    uint32_t count;
+    uint32_t capacity;
+} url_id_list_t;
+
+/**
+ * @brief: 32 bit FNV-1a hash of a string.
+ */
+uint32_t url_intern_hash(const char *url){
+    uint32_t hash = 2166136261u;
+    for(const unsigned char *p = (const unsigned char *) url; *p != '\0'; p++){
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief: Creates an empty table.
+ * @params:
+ * table: pointer to an allocated struct. Will be filled by the function.
+ * expected: number of URLs to make room for up front (it grows past that)
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int url_intern_init(url_intern_t *table, uint32_t expected){
+    uint32_t num_slots = 16;
+    while(num_slots < 2 * expected) num_slots *= 2;
+
+    table->chunks = NULL;
+    table->count = 0;
+    table->capacity = (expected > 0) ? expected : 1;
+    table->mask = num_slots - 1;
+    table->arena_bytes = 0;
+    table->strings = (const char **) malloc(table->capacity * sizeof(char *));
+    table->hashes = (uint32_t *) malloc(table->capacity * sizeof(uint32_t));
+    table->slots = (url_id_t *) malloc(num_slots * sizeof(url_id_t));
+    if(table->strings == NULL || table->hashes == NULL || table->slots == NULL){
+        perror("malloc");
+        free(table->strings);
+        free(table->hashes);
+        free(table->slots);
+        return -1;
+    }
+    memset(table->slots, 0xff, num_slots * sizeof(url_id_t)); // All URL_ID_NONE
+    return 0;
+}
+
+/**
+ * @brief: Copies a string into the arena.
+ * @return: the copy, NULL on error
+ */
+const char *url_arena_strdup(url_intern_t *table, const char *url, size_t len){
+    url_arena_chunk_t *chunk = table->chunks;
+
+    if(chunk == NULL || chunk->size - chunk->used < len + 1){
+        size_t size = (len + 1 > URL_ARENA_CHUNK_SZ) ? len + 1 : URL_ARENA_CHUNK_SZ;
+        chunk = (url_arena_chunk_t *) malloc(sizeof(url_arena_chunk_t) + size);
+        if(chunk == NULL){
+            perror("malloc");
+            return NULL;
+        }
+        chunk->next = table->chunks;
+        chunk->used = 0;
+        chunk->size = size;
+        table->chunks = chunk;
+        table->arena_bytes += size;
+    }
+
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, url, len + 1);
+    chunk->used += len + 1;
+    return copy;
+}
+
+/**
+ * @brief: Doubles the slot table once it is half full.
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int url_intern_grow_slots(url_intern_t *table){
+    uint32_t num_slots = 2 * (table->mask + 1);
+    url_id_t *slots = (url_id_t *) malloc(num_slots * sizeof(url_id_t));
+    if(slots == NULL){
+        perror("malloc");
+        return -1;
+    }
+    memset(slots, 0xff, num_slots * sizeof(url_id_t));
+
+    for(url_id_t id = 0; id < table->count; id++){
+        uint32_t i = table->hashes[id] & (num_slots - 1);
+        while(slots[i] != URL_ID_NONE) i = (i + 1) & (num_slots - 1);
+        slots[i] = id;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->mask = num_slots - 1;
+    return 0;
+}
+
+/**
+ * @brief: Gives a URL that is not in the table yet its ID, at slot i.
+ * @return: the new ID, URL_ID_NONE on error
+ */
+url_id_t url_intern_insert_at(url_intern_t *table, const char *url, uint32_t hash, uint32_t i){
+    if(table->count == table->capacity){
+        uint32_t capacity = 2 * table->capacity;
+        const char **strings = (const char **) realloc(table->strings, capacity * sizeof(char *));
+        if(strings == NULL) return URL_ID_NONE;
+        table->strings = strings;
+        uint32_t *hashes = (uint32_t *) realloc(table->hashes, capacity * sizeof(uint32_t));
+        if(hashes == NULL) return URL_ID_NONE;
+        table->hashes = hashes;
+        table->capacity = capacity;
+    }
+
+    const char *copy = url_arena_strdup(table, url, strlen(url));
+    if(copy == NULL) return URL_ID_NONE;
+
+    url_id_t id = table->count++;
+    table->strings[id] = copy;
+    table->hashes[id] = hash;
+    table->slots[i] = id;
+
+    if(2 * table->count > table->mask + 1 && url_intern_grow_slots(table) != 0) return URL_ID_NONE;
+    return id;
+}
+
+/**
+ * @brief: Looks a URL up and adds it if it is not there yet.
+ * @params:
+ * url: the URL. Copied, the caller keeps it.
+ * added: set to 1 if the URL was new, 0 otherwise
+ * @return: the URL's ID, URL_ID_NONE on error
+ */
+url_id_t url_intern(url_intern_t *table, const char *url, int *added){
+    uint32_t hash = url_intern_hash(url);
+    uint32_t i = hash & table->mask;
+
+    *added = 0;
+    while(table->slots[i] != URL_ID_NONE){
+        url_id_t id = table->slots[i];
+        if(table->hashes[id] == hash && strcmp(table->strings[id], url) == 0) return id;
+        i = (i + 1) & table->mask;
+    }
+    *added = 1;
+    return url_intern_insert_at(table, url, hash, i);
+}
+
+/**
+ * @brief: Adds a URL the caller knows is not in the table (e.g. a Bloom filter said so). Skips the string compares.
+ * @return: the new ID, URL_ID_NONE on error
+ */
+url_id_t url_intern_new(url_intern_t *table, const char *url){
+    uint32_t hash = url_intern_hash(url);
+    uint32_t i = hash & table->mask;
+
+    while(table->slots[i] != URL_ID_NONE) i = (i + 1) & table->mask;
+    return url_intern_insert_at(table, url, hash, i);
+}
+
+/**
+ * @brief: The string of an ID. Valid until url_intern_destroy.
+ */
+const char *url_intern_str(url_intern_t *table, url_id_t id){
+    return table->strings[id];
+}
+
+/**
+ * @brief: Frees the table, its arena and every string handed out.
+ */
+void url_intern_destroy(url_intern_t *table){
+    while(table->chunks != NULL){
+        url_arena_chunk_t *next = table->chunks->next;
+        free(table->chunks);
+        table->chunks = next;
+    }
+    free(table->strings);
+    free(table->hashes);
+    free(table->slots);
+}
+
+/**
+ * @brief: Appends an ID (push for a stack).
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int url_id_list_push(url_id_list_t *list, url_id_t id){
+    if(list->count == list->capacity){
+        uint32_t capacity = (list->capacity > 0) ? 2 * list->capacity : 64;
+        url_id_t *ids = (url_id_t *) realloc(list->ids, capacity * sizeof(url_id_t));
+        if(ids == NULL){
+            perror("realloc");
+            return -1;
+        }
+        list->ids = ids;
+        list->capacity = capacity;
+    }
+    list->ids[list->count++] = id;
+    return 0;
+}
+
+/**
+ * @brief: Removes the last ID (pop for a stack).
+ * @return: the ID, URL_ID_NONE if the list is empty
+ */
+url_id_t url_id_list_pop(url_id_list_t *list){
+    if(list->count == 0) return URL_ID_NONE;
+    return list->ids[--list->count];
+}
+
+/**
+ * @brief: Writes the URLs of a list to a file, one per line, newest first (the order linkedlist_to_file gives a pushed list).
+ * @return:
+ * -1: Error
+ * 0: Success
+ */
+int url_id_list_write(url_id_list_t *list, url_intern_t *table, FILE *fp){
+    for(uint32_t i = list->count; i > 0; i--){
+        if(fputs(url_intern_str(table, list->ids[i - 1]), fp) == EOF || fputc('\n', fp) == EOF) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief: Frees the list's array.
+ */
+void url_id_list_free(url_id_list_t *list){
+    free(list->ids);
+    list->ids = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}